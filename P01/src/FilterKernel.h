@@ -0,0 +1,184 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+//      FilterKernel.h
+//
+//      Filter kernels as compile time constants.  A kernel is a type whose
+//  size, weights and divisor are template arguments, so a filter templated
+//  on it sees every tap as a constant: SKernel_Sum expands into one
+//  multiply-add per tap, with no loop and no table lookup left.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef _FILTER_KERNEL_H_
+#define _FILTER_KERNEL_H_
+
+#include <stddef.h>
+
+// ROWS x COLUMNS weights, row by row, whose weighted sums are divided by
+// BASE.  The taps start (ROWS - 1) / 2 rows above the pixel and
+// (COLUMNS - 1) / 2 columns left of it, so even sizes reach one further
+// down and right.
+template<int BASE, int ROWS, int COLUMNS, int... WEIGHTS> struct SFilterKernel
+{
+    static_assert(sizeof...(WEIGHTS) == ROWS * COLUMNS, "SFilterKernel needs a weight for every tap");
+
+    static constexpr int    base = BASE;
+    static constexpr int    rows = ROWS;
+    static constexpr int    columns = COLUMNS;
+    static constexpr int    top = -((ROWS - 1) / 2);
+    static constexpr int    left = -((COLUMNS - 1) / 2);
+    static constexpr int    weights[ROWS * COLUMNS] = { WEIGHTS... };
+};// SFilterKernel
+
+template<int BASE, int ROWS, int COLUMNS, int... WEIGHTS>
+constexpr int SFilterKernel<BASE, ROWS, COLUMNS, WEIGHTS...>::weights[];
+
+
+// The sum of tap TAP onwards of kernel K around center, each pixel times
+// its weight over the base, added in row order to sum.  Each tap is its
+// own instantiation, so the whole sum is straight line code.
+template<class K, int TAP = 0, bool DONE = (TAP == K::rows * K::columns)> struct SKernel_Sum
+{
+    template<class T> static float Add(float sum, const T* center, ptrdiff_t stride)
+    {
+        const T v = center[(K::top + TAP / K::columns) * stride + K::left + TAP % K::columns];
+
+        return SKernel_Sum<K, TAP + 1>::Add(sum + (float)v * (float)K::weights[TAP] / (float)K::base, center, stride);
+    }// Add
+};// SKernel_Sum
+
+template<class K, int TAP> struct SKernel_Sum<K, TAP, true>
+{
+    template<class T> static float Add(float sum, const T*, ptrdiff_t)
+    {
+        return sum;
+    }// Add
+};// SKernel_Sum
+
+
+// The sum of TAPS, each a weight of one dimension of a separable kernel.
+constexpr int Tap_Sum()
+{
+    return 0;
+}// Tap_Sum
+
+template<class... REST> constexpr int Tap_Sum(int tap, REST... rest)
+{
+    return tap + Tap_Sum(rest...);
+}// Tap_Sum
+
+
+// One dimension of a separable kernel: TAPS weights, the first of them 
+// FIRST pixels before the output pixel.  The fixed point row kernels take
+// the weights as shorts, the others as floats.
+template<int FIRST, int... TAPS> struct STaps
+{
+    static constexpr int            first = FIRST;
+    static constexpr int            count = sizeof...(TAPS);
+    static constexpr int            sum = Tap_Sum(TAPS...);
+    static constexpr unsigned short fixed[sizeof...(TAPS)] = { TAPS... };
+    static constexpr float          weights[sizeof...(TAPS)] = { TAPS... };
+};// STaps
+
+template<int FIRST, int... TAPS>
+constexpr unsigned short STaps<FIRST, TAPS...>::fixed[];
+
+template<int FIRST, int... TAPS>
+constexpr float STaps<FIRST, TAPS...>::weights[];
+
+
+// The sum of tap TAP onwards of TAPS along a line from p, step apart, 
+// each pixel times its weight, added in order to sum.  Like SKernel_Sum,
+// each tap is its own instantiation.
+template<class TAPS, int TAP = 0, bool DONE = (TAP == TAPS::count)> struct STaps_Sum
+{
+    template<class T> static float Add(float sum, const T* p, ptrdiff_t step)
+    {
+        return STaps_Sum<TAPS, TAP + 1>::Add(sum + TAPS::weights[TAP] * (float)p[TAP * step], p, step);
+    }// Add
+};// STaps_Sum
+
+template<class TAPS, int TAP> struct STaps_Sum<TAPS, TAP, true>
+{
+    template<class T> static float Add(float sum, const T*, ptrdiff_t)
+    {
+        return sum;
+    }// Add
+};// STaps_Sum
+
+
+// Fixed_H_Row divides a 16 bit sum by a divisor as sum * multiplier >> 
+// (16 + shift), with the multiplier 2^(16 + shift) / divisor rounded up.
+// Writing the sum as q * divisor + r, that is q plus (r + sum * excess / 
+// 2^(16 + shift)) / divisor, where excess is what the rounding added to 
+// multiplier * divisor; so the quotient is exact for every sum when 
+// 0xFFFF * excess < 2^(16 + shift).  Fixed_Shift is the least shift that 
+// does it with a multiplier that fits in 16 bits.
+constexpr unsigned long long Fixed_Multiplier(int divisor, int shift)
+{
+    return ((1ull << (16 + shift)) + divisor - 1) / divisor;
+}// Fixed_Multiplier
+
+constexpr int Fixed_Shift(int divisor, int shift = 0)
+{
+    return (Fixed_Multiplier(divisor, shift) <= 0xFFFF && 
+            0xFFFF * (Fixed_Multiplier(divisor, shift) * divisor - (1ull << (16 + shift))) < (1ull << (16 + shift))) 
+           ? shift : Fixed_Shift(divisor, shift + 1);
+}// Fixed_Shift
+
+
+// A separable kernel, the outer product of the DOWN and ACROSS taps, 
+// divided by the product of their sums.  Filters run it as a pass down
+// the columns and one across; bytes run it in fixed point, with every 
+// sum in 16 bits and the division as multiplier and shift.
+template<class DOWN, class ACROSS = DOWN> struct SSeparableKernel
+{
+    typedef DOWN    TDown;
+    typedef ACROSS  TAcross;
+
+    static constexpr int            base = DOWN::sum * ACROSS::sum;
+    static constexpr int            shift = Fixed_Shift(base);
+    static constexpr unsigned short multiplier = (unsigned short)Fixed_Multiplier(base, shift);
+
+    static_assert(base > 1 && 255 * base <= 0xFFFF, "SSeparableKernel's fixed point sums must fit in 16 bits");
+};// SSeparableKernel
+
+
+// Whether the taps of K, from tap on, are the outer product of S's.
+template<class K, class S> constexpr bool Same_Weights(int tap = 0)
+{
+    return tap == K::rows * K::columns || 
+           (K::weights[tap] == S::TDown::fixed[tap / K::columns] * S::TAcross::fixed[tap % K::columns] && 
+            Same_Weights<K, S>(tap + 1));
+}// Same_Weights
+
+// Whether the kernel K is the separable kernel S.
+template<class K, class S> constexpr bool Same_Kernel()
+{
+    return K::base == S::base && K::rows == S::TDown::count && K::columns == S::TAcross::count && 
+           K::top == S::TDown::first && K::left == S::TAcross::first && Same_Weights<K, S>();
+}// Same_Kernel
+
+
+// the 5x5 Bartlett and Gaussian kernels
+typedef SSeparableKernel<STaps<-2, 1, 2, 3, 2, 1> > TBartlettKernel;
+typedef SSeparableKernel<STaps<-2, 1, 4, 6, 4, 1> > TGaussianKernel;
+
+// the taps Half_Size and Double_Size interpolate with
+typedef STaps<-1, 1, 2, 1>                          TTentTaps;
+typedef STaps<-1, 1, 3, 3, 1>                       TCubicTaps;
+
+// the 3x3 kernel Half_Size filters with before dropping every other pixel,
+// and its fixed point form
+typedef SFilterKernel<16, 3, 3, 1, 2, 1,
+                                2, 4, 2,
+                                1, 2, 1>            THalfKernel;
+typedef SSeparableKernel<TTentTaps>                 THalfFixedKernel;
+
+static_assert(Same_Kernel<THalfKernel, THalfFixedKernel>(), "THalfFixedKernel must be THalfKernel");
+
+// the pixels Double_Size adds beside and diagonally between the old ones
+typedef SSeparableKernel<TCubicTaps, TTentTaps>     TDoubleEdgeKernel;
+typedef SSeparableKernel<TCubicTaps>                TDoubleCornerKernel;
+
+#endif // _FILTER_KERNEL_H_
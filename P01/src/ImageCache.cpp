@@ -0,0 +1,246 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+//      ImageCache.cpp
+//
+//      Implementation of CImageCache, the native image cache files.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+#include "ImageCache.h"
+#include <stdio.h>
+#include <string.h>
+#include <iostream>
+#include <string>
+
+using namespace std;
+
+// constants
+const char          c_acCacheMagic[8]   = { 'T', 'G', 'A', 'C', 'A', 'C', 'H', 'E' };
+const unsigned int  c_uCacheByteOrder   = 0x01020304;   // reads back differently on a machine of the other byte order
+const unsigned int  c_uCacheVersion     = 1;
+const unsigned int  c_uCachePageSize    = 4096;         // pixels start on a multiple of this
+const unsigned int  c_uCacheRowAlignment = 64;          // written rows start on a multiple of this
+
+
+// header at the very start of a cache file, in the byte order of the
+// machine that wrote it
+struct SCacheHeader
+{
+    char            acMagic[8];     // c_acCacheMagic
+    unsigned int    uByteOrder;     // c_uCacheByteOrder
+    unsigned int    uVersion;       // c_uCacheVersion
+    unsigned int    uWidth;         // width of the image in pixels
+    unsigned int    uHeight;        // height of the image in pixels
+    unsigned int    uDataOffset;    // file offset of the top row, page aligned
+    unsigned int    uStride;        // bytes from one row to the next, at least width * 4
+};// SCacheHeader
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Constructor.  Only Map makes these.
+//
+///////////////////////////////////////////////////////////////////////////////
+CImageCache::CImageCache() : m_pBase(NULL), m_size(0), m_pPixels(NULL), m_width(0), m_height(0), m_stride(0)
+{}// CImageCache
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Destructor.  Unmap the file, discarding any changes to the pixels.
+//
+///////////////////////////////////////////////////////////////////////////////
+CImageCache::~CImageCache()
+{
+    if (!m_pBase)
+        return;
+
+#ifdef _WIN32
+    UnmapViewOfFile(m_pBase);
+#else
+    munmap(m_pBase, m_size);
+#endif
+}// ~CImageCache
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Return true if the file name ends in the cache extension.
+//
+///////////////////////////////////////////////////////////////////////////////
+bool CImageCache::Is_Cache_File(const char* sFilename)
+{
+    size_t  length = sFilename ? strlen(sFilename) : 0;
+    size_t  extLength = strlen(c_sCacheExtension);
+
+    return length >= extLength && !strcmp(sFilename + length - extLength, c_sCacheExtension);
+}// Is_Cache_File
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Map a cache file copy-on-write and check its header.  Return a new
+//  CImageCache which must be deleted by caller, or NULL on failure.
+//
+///////////////////////////////////////////////////////////////////////////////
+CImageCache* CImageCache::Map(const char* sFilename)
+{
+    void*   pBase = NULL;
+    size_t  size = 0;
+
+#ifdef _WIN32
+    HANDLE          hFile, hMapping;
+    LARGE_INTEGER   fileSize;
+
+    hFile = CreateFileA(sFilename, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+                        FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if (hFile == INVALID_HANDLE_VALUE)
+    {
+        cout << "Cache Error: cannot open file" << endl;
+        return NULL;
+    }// if
+
+    if (GetFileSizeEx(hFile, &fileSize) && fileSize.QuadPart >= (LONGLONG)sizeof(SCacheHeader))
+    {
+        hMapping = CreateFileMappingA(hFile, NULL, PAGE_WRITECOPY, 0, 0, NULL);
+        if (hMapping)
+        {
+            // the view keeps the mapping alive once the handles are closed
+            pBase = MapViewOfFile(hMapping, FILE_MAP_COPY, 0, 0, 0);
+            size = (size_t)fileSize.QuadPart;
+            CloseHandle(hMapping);
+        }// if
+    }// if
+    CloseHandle(hFile);
+#else
+    struct stat     fileStat;
+    int             fd;
+
+    fd = open(sFilename, O_RDONLY);
+    if (fd < 0)
+    {
+        cout << "Cache Error: cannot open file" << endl;
+        return NULL;
+    }// if
+
+    if (!fstat(fd, &fileStat) && fileStat.st_size >= (off_t)sizeof(SCacheHeader))
+    {
+        size = (size_t)fileStat.st_size;
+        pBase = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+        if (pBase == MAP_FAILED)
+            pBase = NULL;
+    }// if
+    close(fd);
+#endif
+
+    if (!pBase)
+    {
+        cout << "Cache Error: cannot map file" << endl;
+        return NULL;
+    }// if
+
+    CImageCache* result = new CImageCache();
+    result->m_pBase = pBase;
+    result->m_size = size;
+
+    SCacheHeader header;
+    memcpy(&header, pBase, sizeof(header));
+
+    if (memcmp(header.acMagic, c_acCacheMagic, sizeof(c_acCacheMagic)) ||
+        header.uByteOrder != c_uCacheByteOrder || header.uVersion != c_uCacheVersion)
+    {
+        cout << "Cache Error: not a cache file from this machine" << endl;
+        delete result;
+        return NULL;
+    }// if
+
+    if (header.uDataOffset < sizeof(SCacheHeader) || header.uDataOffset % c_uCachePageSize ||
+        header.uWidth > 0x7FFFFFFF / 4 || header.uStride < header.uWidth * 4 || header.uStride % 4 || 
+        header.uHeight > 0x7FFFFFFF ||
+        (header.uStride && header.uHeight > ((size_t)-1 - header.uDataOffset) / header.uStride) ||
+        size < header.uDataOffset + (size_t)header.uStride * header.uHeight)
+    {
+        cout << "Cache Error: bad header or truncated file" << endl;
+        delete result;
+        return NULL;
+    }// if
+
+    result->m_width = (int)header.uWidth;
+    result->m_height = (int)header.uHeight;
+    result->m_stride = header.uStride;
+    result->m_pPixels = (unsigned char*)pBase + header.uDataOffset;
+
+    return result;
+}// Map
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Write the image as a cache file: the header, padding up to the first
+//  page boundary, then the rows, each padded to a 64 byte boundary.  The file is
+//  written under a temporary name and renamed into place, so an image that
+//  is still mapped from the same file keeps its pixels.
+//
+///////////////////////////////////////////////////////////////////////////////
+bool CImageCache::Write(const char* sFilename, int width, int height, const unsigned char* data, size_t stride)
+{
+    unsigned char   page[c_uCachePageSize];
+    SCacheHeader    header;
+    size_t          rowSize = (size_t)width * 4;
+    size_t          fileStride = (rowSize + c_uCacheRowAlignment - 1) / c_uCacheRowAlignment * c_uCacheRowAlignment;
+
+    memcpy(header.acMagic, c_acCacheMagic, sizeof(c_acCacheMagic));
+    header.uByteOrder = c_uCacheByteOrder;
+    header.uVersion = c_uCacheVersion;
+    header.uWidth = width;
+    header.uHeight = height;
+    header.uDataOffset = c_uCachePageSize;
+    header.uStride = (unsigned int)fileStride;
+
+    memset(page, 0, sizeof(page));
+    memcpy(page, &header, sizeof(header));
+
+    string sTemporary = string(sFilename) + ".tmp";
+
+    FILE* file = fopen(sTemporary.c_str(), "wb");
+    if (!file)
+    {
+        cout << "Cache Error: cannot open file" << endl;
+        return false;
+    }// if
+
+    // the page is all zeros past the header, so it doubles as row padding
+    bool bResult = fwrite(page, 1, sizeof(page), file) == sizeof(page);
+    memset(page, 0, sizeof(header));
+    for (int y = 0; bResult && y < height; y++)
+    {
+        bResult = fwrite(data + y * stride, 1, rowSize, file) == rowSize &&
+                  fwrite(page, 1, fileStride - rowSize, file) == fileStride - rowSize;
+    }// for
+    bResult = !fclose(file) && bResult;
+
+#ifdef _WIN32
+    bResult = bResult && MoveFileExA(sTemporary.c_str(), sFilename, MOVEFILE_REPLACE_EXISTING);
+#else
+    bResult = bResult && !rename(sTemporary.c_str(), sFilename);
+#endif
+
+    if (!bResult)
+    {
+        cout << "Cache Error: cannot write to file" << endl;
+        remove(sTemporary.c_str());
+    }// if
+
+    return bResult;
+}// Write
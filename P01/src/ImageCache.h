@@ -0,0 +1,57 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+//      ImageCache.h
+//
+//      Native image cache files.  A cache file is a small header followed,
+//  at a page boundary, by the premultiplied RGBA rows of an image laid out
+//  like TargaImage::data.  Loading one is a file mapping with no
+//  decoding at all, so intermediate results can be reloaded immediately.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef _IMAGE_CACHE_H_
+#define _IMAGE_CACHE_H_
+
+#include <stddef.h>
+
+const char  c_sCacheExtension[] = ".tic";       // file extension of cache files
+
+class CImageCache
+{
+    // methods
+    public:
+        ~CImageCache(void);
+
+        // Does the file name have the cache extension?
+        static bool Is_Cache_File(const char* sFilename);
+
+        // Map a cache file.  Returns NULL on failure.  Writes to the pixels
+        // are private to this process and never reach the file.
+        static CImageCache* Map(const char* sFilename);
+
+        // Write a width x height premultiplied RGBA image, whose rows are
+        // stride bytes apart, as a cache file.  Rows are stored 64 byte
+        // aligned whatever stride is.
+        static bool Write(const char* sFilename, int width, int height, const unsigned char* data, size_t stride);
+
+        int             Width(void) const   { return m_width; }
+        int             Height(void) const  { return m_height; }
+        unsigned char*  Pixels(void) const  { return m_pPixels; }
+        size_t          Stride(void) const  { return m_stride; }    // bytes from one row to the next
+
+    private:
+        CImageCache(void);
+        CImageCache(const CImageCache&);
+        CImageCache& operator=(const CImageCache&);
+
+    // members
+    private:
+        void*           m_pBase;        // start of the mapping
+        size_t          m_size;         // size of the mapping in bytes
+        unsigned char*  m_pPixels;      // first row, inside the mapping
+        int             m_width;
+        int             m_height;
+        size_t          m_stride;
+};// CImageCache
+
+#endif // _IMAGE_CACHE_H_
@@ -0,0 +1,1208 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Kernels.cpp
+//
+//      The kernel tables behind SKernels.  The scalar kernels are the loops
+//  TargaImage used to run, arithmetic and all, and every SIMD kernel does
+//  the same operations in the same order per lane so it gives the same
+//  bytes.  SIMD kernels are compiled for their instruction set with target
+//  attributes, so nothing else needs special compiler flags, and only run
+//  when CPUID says the processor has it.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#include "Kernels.h"
+#include <math.h>
+#include <string.h>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#define KERNELS_X86
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
+#if defined(__GNUC__)
+#define KERNEL_TARGET(isa) __attribute__((target(isa)))
+#else
+#define KERNEL_TARGET(isa)
+#endif
+
+using namespace std;
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Scalar reference kernels.
+//
+///////////////////////////////////////////////////////////////////////////////
+static void Gray_Row_Scalar(const unsigned char* rgba, unsigned char* gray, int n)
+{
+    float Y;
+
+    for (int x = 0; x < n; x++, rgba += 4)
+    {
+        Y = 0.3 * (float)rgba[0] + 0.59 * (float)rgba[1] + 0.11 * (float)rgba[2];
+        gray[x] = Y;
+    }
+}// Gray_Row_Scalar
+
+
+static void RGBA_To_RGB_Row_Scalar(const unsigned char* rgba, unsigned char* rgb, int n)
+{
+    for (int x = 0; x < n; x++, rgba += 4, rgb += 3)
+    {
+        unsigned char   alpha = rgba[3];
+
+        if (alpha == 0)
+        {
+            rgb[0] = rgb[1] = rgb[2] = 0;
+            continue;
+        }// if
+
+        float   alpha_scale = (float)255 / (float)alpha;
+        int     val;
+
+        for (int i = 0; i < 3; i++)
+        {
+            val = (int)floor(rgba[i] * alpha_scale);
+            if (val < 0)
+                rgb[i] = 0;
+            else if (val > 255)
+                rgb[i] = 255;
+            else
+                rgb[i] = val;
+        }// for
+    }// for
+}// RGBA_To_RGB_Row_Scalar
+
+
+static void Mask_Row_Scalar(unsigned char* rgba, int n, const unsigned char mask[4])
+{
+    for (int x = 0; x < n; x++, rgba += 4)
+    {
+        rgba[0] &= mask[0];
+        rgba[1] &= mask[1];
+        rgba[2] &= mask[2];
+        rgba[3] &= mask[3];
+    }// for
+}// Mask_Row_Scalar
+
+
+static void Threshold_Row_Scalar(unsigned char* row, int n, unsigned char threshold, unsigned char dark, unsigned char bright)
+{
+    for (int x = 0; x < n; x++)
+        row[x] = row[x] >= threshold ? bright : dark;
+}// Threshold_Row_Scalar
+
+
+static void Convolve_V_Row_Scalar(const unsigned char* src, ptrdiff_t stride, const float* taps, int radius, float* dst, int n)
+{
+    const unsigned char *top = src - radius * stride;
+
+    for (int x = 0; x < n; x++)
+    {
+        float sum = 0;
+
+        for (int k = 0; k <= 2 * radius; k++)
+            sum += taps[k] * (float)top[k * stride + x];
+
+        dst[x] = sum;
+    }// for
+}// Convolve_V_Row_Scalar
+
+
+static void Convolve_H_Row_Scalar(const float* src, const float* taps, int radius, float base, unsigned char* dst, int n)
+{
+    const float *left = src - radius;
+
+    for (int x = 0; x < n; x++)
+    {
+        float sum = 0;
+
+        for (int k = 0; k <= 2 * radius; k++)
+            sum += taps[k] * left[x + k];
+
+        dst[x] = (unsigned char)(int)(sum / base);
+    }// for
+}// Convolve_H_Row_Scalar
+
+
+static void Fixed_V_Row_Scalar(const unsigned char* src, ptrdiff_t stride, const unsigned short* taps, int count, 
+                               unsigned short* dst, int n)
+{
+    for (int x = 0; x < n; x++)
+    {
+        unsigned int sum = 0;
+
+        for (int k = 0; k < count; k++)
+            sum += taps[k] * src[k * stride + x];
+
+        dst[x] = (unsigned short)sum;
+    }// for
+}// Fixed_V_Row_Scalar
+
+
+static void Fixed_H_Row_Scalar(const unsigned short* src, const unsigned short* taps, int count, unsigned short multiplier,
+                               int shift, unsigned char* dst, int n)
+{
+    for (int x = 0; x < n; x++)
+    {
+        unsigned int sum = 0;
+
+        for (int k = 0; k < count; k++)
+            sum += taps[k] * src[x + k];
+
+        dst[x] = (unsigned char)(((sum & 0xFFFF) * multiplier) >> 16 >> shift);
+    }// for
+}// Fixed_H_Row_Scalar
+
+
+static const SKernels   c_scalar = { "scalar", Gray_Row_Scalar, RGBA_To_RGB_Row_Scalar, Mask_Row_Scalar,
+                                     Threshold_Row_Scalar, Convolve_V_Row_Scalar, Convolve_H_Row_Scalar,
+                                     Fixed_V_Row_Scalar, Fixed_H_Row_Scalar };
+
+
+#ifdef KERNELS_X86
+///////////////////////////////////////////////////////////////////////////////
+//
+//      SSE2 kernels, four pixels at a time.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+// four bytes widened to 32 bit lanes, and back keeping the low byte of each
+KERNEL_TARGET("sse2") static inline __m128i Load_Bytes_SSE2(const unsigned char* p)
+{
+    int bytes;
+
+    memcpy(&bytes, p, 4);
+    return _mm_unpacklo_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128(bytes), _mm_setzero_si128()), _mm_setzero_si128());
+}// Load_Bytes_SSE2
+
+KERNEL_TARGET("sse2") static inline void Store_Bytes_SSE2(unsigned char* p, __m128i v)
+{
+    int bytes;
+
+    v = _mm_and_si128(v, _mm_set1_epi32(0xFF));
+    v = _mm_packs_epi32(v, v);
+    bytes = _mm_cvtsi128_si32(_mm_packus_epi16(v, v));
+    memcpy(p, &bytes, 4);
+}// Store_Bytes_SSE2
+
+
+KERNEL_TARGET("sse2") static void Gray_Row_SSE2(const unsigned char* rgba, unsigned char* gray, int n)
+{
+    const __m128i   low = _mm_set1_epi32(0xFF);
+    const __m128d   wr = _mm_set1_pd(0.3), wg = _mm_set1_pd(0.59), wb = _mm_set1_pd(0.11);
+    int             x = 0;
+
+    for (; x + 4 <= n; x += 4, rgba += 16)
+    {
+        __m128i v = _mm_loadu_si128((const __m128i*)rgba);
+        __m128i r = _mm_and_si128(v, low);
+        __m128i g = _mm_and_si128(_mm_srli_epi32(v, 8), low);
+        __m128i b = _mm_and_si128(_mm_srli_epi32(v, 16), low);
+        __m128d lo, hi;
+
+        lo = _mm_add_pd(_mm_add_pd(_mm_mul_pd(wr, _mm_cvtepi32_pd(r)), _mm_mul_pd(wg, _mm_cvtepi32_pd(g))),
+                        _mm_mul_pd(wb, _mm_cvtepi32_pd(b)));
+        r = _mm_srli_si128(r, 8);
+        g = _mm_srli_si128(g, 8);
+        b = _mm_srli_si128(b, 8);
+        hi = _mm_add_pd(_mm_add_pd(_mm_mul_pd(wr, _mm_cvtepi32_pd(r)), _mm_mul_pd(wg, _mm_cvtepi32_pd(g))),
+                        _mm_mul_pd(wb, _mm_cvtepi32_pd(b)));
+
+        Store_Bytes_SSE2(gray + x, _mm_cvttps_epi32(_mm_movelh_ps(_mm_cvtpd_ps(lo), _mm_cvtpd_ps(hi))));
+    }// for
+
+    Gray_Row_Scalar(rgba, gray + x, n - x);
+}// Gray_Row_SSE2
+
+
+KERNEL_TARGET("sse2") static void RGBA_To_RGB_Row_SSE2(const unsigned char* rgba, unsigned char* rgb, int n)
+{
+    const __m128i   low = _mm_set1_epi32(0xFF);
+    const __m128    full = _mm_set1_ps(255.0f);
+    unsigned char   bytes[16];
+    int             x = 0;
+
+    for (; x + 4 <= n; x += 4, rgba += 16)
+    {
+        __m128i v = _mm_loadu_si128((const __m128i*)rgba);
+        __m128i a = _mm_srli_epi32(v, 24);
+        __m128i clear = _mm_cmpeq_epi32(a, _mm_setzero_si128());
+        __m128  scale = _mm_div_ps(full, _mm_cvtepi32_ps(a));
+        __m128i r = _mm_cvttps_epi32(_mm_mul_ps(_mm_cvtepi32_ps(_mm_and_si128(v, low)), scale));
+        __m128i g = _mm_cvttps_epi32(_mm_mul_ps(_mm_cvtepi32_ps(_mm_and_si128(_mm_srli_epi32(v, 8), low)), scale));
+        __m128i b = _mm_cvttps_epi32(_mm_mul_ps(_mm_cvtepi32_ps(_mm_and_si128(_mm_srli_epi32(v, 16), low)), scale));
+
+        // transparent pixels are black, and the packs saturate to 255
+        r = _mm_andnot_si128(clear, r);
+        g = _mm_andnot_si128(clear, g);
+        b = _mm_andnot_si128(clear, b);
+        _mm_storeu_si128((__m128i*)bytes, _mm_packus_epi16(_mm_packs_epi32(r, g), _mm_packs_epi32(b, b)));
+
+        for (int i = 0; i < 4; i++, rgb += 3)
+        {
+            rgb[0] = bytes[i];
+            rgb[1] = bytes[4 + i];
+            rgb[2] = bytes[8 + i];
+        }// for
+    }// for
+
+    RGBA_To_RGB_Row_Scalar(rgba, rgb, n - x);
+}// RGBA_To_RGB_Row_SSE2
+
+
+KERNEL_TARGET("sse2") static void Mask_Row_SSE2(unsigned char* rgba, int n, const unsigned char mask[4])
+{
+    int     bits;
+    int     x = 0;
+
+    memcpy(&bits, mask, 4);
+    for (; x + 4 <= n; x += 4, rgba += 16)
+        _mm_storeu_si128((__m128i*)rgba, _mm_and_si128(_mm_loadu_si128((const __m128i*)rgba), _mm_set1_epi32(bits)));
+
+    Mask_Row_Scalar(rgba, n - x, mask);
+}// Mask_Row_SSE2
+
+
+KERNEL_TARGET("sse2") static void Threshold_Row_SSE2(unsigned char* row, int n, unsigned char threshold, unsigned char dark, unsigned char bright)
+{
+    const __m128i   t = _mm_set1_epi8((char)threshold);
+    const __m128i   d = _mm_set1_epi8((char)dark);
+    const __m128i   l = _mm_set1_epi8((char)bright);
+    int             x = 0;
+
+    for (; x + 16 <= n; x += 16)
+    {
+        __m128i v = _mm_loadu_si128((const __m128i*)(row + x));
+        __m128i ge = _mm_cmpeq_epi8(_mm_max_epu8(v, t), v);
+
+        _mm_storeu_si128((__m128i*)(row + x), _mm_or_si128(_mm_and_si128(ge, l), _mm_andnot_si128(ge, d)));
+    }// for
+
+    Threshold_Row_Scalar(row + x, n - x, threshold, dark, bright);
+}// Threshold_Row_SSE2
+
+
+KERNEL_TARGET("sse2") static void Convolve_V_Row_SSE2(const unsigned char* src, ptrdiff_t stride, const float* taps, int radius, float* dst, int n)
+{
+    const unsigned char *top = src - radius * stride;
+    int                 x = 0;
+
+    for (; x + 4 <= n; x += 4)
+    {
+        __m128 sum = _mm_setzero_ps();
+
+        for (int k = 0; k <= 2 * radius; k++)
+            sum = _mm_add_ps(sum, _mm_mul_ps(_mm_set1_ps(taps[k]), _mm_cvtepi32_ps(Load_Bytes_SSE2(top + k * stride + x))));
+
+        _mm_storeu_ps(dst + x, sum);
+    }// for
+
+    Convolve_V_Row_Scalar(src + x, stride, taps, radius, dst + x, n - x);
+}// Convolve_V_Row_SSE2
+
+
+KERNEL_TARGET("sse2") static void Convolve_H_Row_SSE2(const float* src, const float* taps, int radius, float base, unsigned char* dst, int n)
+{
+    const float     *left = src - radius;
+    const __m128    b = _mm_set1_ps(base);
+    int             x = 0;
+
+    for (; x + 4 <= n; x += 4)
+    {
+        __m128 sum = _mm_setzero_ps();
+
+        for (int k = 0; k <= 2 * radius; k++)
+            sum = _mm_add_ps(sum, _mm_mul_ps(_mm_set1_ps(taps[k]), _mm_loadu_ps(left + x + k)));
+
+        Store_Bytes_SSE2(dst + x, _mm_cvttps_epi32(_mm_div_ps(sum, b)));
+    }// for
+
+    Convolve_H_Row_Scalar(src + x, taps, radius, base, dst + x, n - x);
+}// Convolve_H_Row_SSE2
+
+
+// the fixed point kernels work in 16 bit lanes, sixteen pixels at a time
+KERNEL_TARGET("sse2") static void Fixed_V_Row_SSE2(const unsigned char* src, ptrdiff_t stride, const unsigned short* taps, int count,
+                                                   unsigned short* dst, int n)
+{
+    const __m128i   zero = _mm_setzero_si128();
+    int             x = 0;
+
+    for (; x + 16 <= n; x += 16)
+    {
+        __m128i lo = zero, hi = zero;
+
+        for (int k = 0; k < count; k++)
+        {
+            __m128i v = _mm_loadu_si128((const __m128i*)(src + k * stride + x));
+            __m128i t = _mm_set1_epi16((short)taps[k]);
+
+            lo = _mm_add_epi16(lo, _mm_mullo_epi16(_mm_unpacklo_epi8(v, zero), t));
+            hi = _mm_add_epi16(hi, _mm_mullo_epi16(_mm_unpackhi_epi8(v, zero), t));
+        }// for
+
+        _mm_storeu_si128((__m128i*)(dst + x), lo);
+        _mm_storeu_si128((__m128i*)(dst + x + 8), hi);
+    }// for
+
+    Fixed_V_Row_Scalar(src + x, stride, taps, count, dst + x, n - x);
+}// Fixed_V_Row_SSE2
+
+
+KERNEL_TARGET("sse2") static void Fixed_H_Row_SSE2(const unsigned short* src, const unsigned short* taps, int count,
+                                                   unsigned short multiplier, int shift, unsigned char* dst, int n)
+{
+    const __m128i   m = _mm_set1_epi16((short)multiplier);
+    const __m128i   s = _mm_cvtsi32_si128(shift);
+    int             x = 0;
+
+    for (; x + 16 <= n; x += 16)
+    {
+        __m128i lo = _mm_setzero_si128(), hi = _mm_setzero_si128();
+
+        for (int k = 0; k < count; k++)
+        {
+            __m128i t = _mm_set1_epi16((short)taps[k]);
+
+            lo = _mm_add_epi16(lo, _mm_mullo_epi16(_mm_loadu_si128((const __m128i*)(src + x + k)), t));
+            hi = _mm_add_epi16(hi, _mm_mullo_epi16(_mm_loadu_si128((const __m128i*)(src + x + 8 + k)), t));
+        }// for
+
+        lo = _mm_srl_epi16(_mm_mulhi_epu16(lo, m), s);
+        hi = _mm_srl_epi16(_mm_mulhi_epu16(hi, m), s);
+        _mm_storeu_si128((__m128i*)(dst + x), _mm_packus_epi16(lo, hi));
+    }// for
+
+    Fixed_H_Row_Scalar(src + x, taps, count, multiplier, shift, dst + x, n - x);
+}// Fixed_H_Row_SSE2
+
+
+static const SKernels   c_sse2 = { "sse2", Gray_Row_SSE2, RGBA_To_RGB_Row_SSE2, Mask_Row_SSE2,
+                                   Threshold_Row_SSE2, Convolve_V_Row_SSE2, Convolve_H_Row_SSE2,
+                                   Fixed_V_Row_SSE2, Fixed_H_Row_SSE2 };
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      AVX2 kernels, eight pixels at a time.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+// eight bytes widened to 32 bit lanes, and back keeping the low byte of each
+KERNEL_TARGET("avx2") static inline __m256i Load_Bytes_AVX2(const unsigned char* p)
+{
+    return _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*)p));
+}// Load_Bytes_AVX2
+
+KERNEL_TARGET("avx2") static inline void Store_Bytes_AVX2(unsigned char* p, __m256i v)
+{
+    __m128i lo, hi;
+
+    v = _mm256_and_si256(v, _mm256_set1_epi32(0xFF));
+    lo = _mm256_castsi256_si128(v);
+    hi = _mm256_extracti128_si256(v, 1);
+    lo = _mm_packs_epi32(lo, hi);
+    _mm_storel_epi64((__m128i*)p, _mm_packus_epi16(lo, lo));
+}// Store_Bytes_AVX2
+
+
+KERNEL_TARGET("avx2") static inline __m128 Gray_Half_AVX2(__m128i r, __m128i g, __m128i b)
+{
+    const __m256d   wr = _mm256_set1_pd(0.3), wg = _mm256_set1_pd(0.59), wb = _mm256_set1_pd(0.11);
+
+    return _mm256_cvtpd_ps(_mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(wr, _mm256_cvtepi32_pd(r)),
+                                                       _mm256_mul_pd(wg, _mm256_cvtepi32_pd(g))),
+                                         _mm256_mul_pd(wb, _mm256_cvtepi32_pd(b))));
+}// Gray_Half_AVX2
+
+
+KERNEL_TARGET("avx2") static void Gray_Row_AVX2(const unsigned char* rgba, unsigned char* gray, int n)
+{
+    const __m256i   low = _mm256_set1_epi32(0xFF);
+    int             x = 0;
+
+    for (; x + 8 <= n; x += 8, rgba += 32)
+    {
+        __m256i v = _mm256_loadu_si256((const __m256i*)rgba);
+        __m256i r = _mm256_and_si256(v, low);
+        __m256i g = _mm256_and_si256(_mm256_srli_epi32(v, 8), low);
+        __m256i b = _mm256_and_si256(_mm256_srli_epi32(v, 16), low);
+        __m128  lo = Gray_Half_AVX2(_mm256_castsi256_si128(r), _mm256_castsi256_si128(g), _mm256_castsi256_si128(b));
+        __m128  hi = Gray_Half_AVX2(_mm256_extracti128_si256(r, 1), _mm256_extracti128_si256(g, 1), _mm256_extracti128_si256(b, 1));
+
+        Store_Bytes_AVX2(gray + x, _mm256_cvttps_epi32(_mm256_set_m128(hi, lo)));
+    }// for
+
+    Gray_Row_Scalar(rgba, gray + x, n - x);
+}// Gray_Row_AVX2
+
+
+KERNEL_TARGET("avx2") static void RGBA_To_RGB_Row_AVX2(const unsigned char* rgba, unsigned char* rgb, int n)
+{
+    const __m256i   low = _mm256_set1_epi32(0xFF);
+    const __m256    full = _mm256_set1_ps(255.0f);
+    unsigned char   bytes[32];
+    int             x = 0;
+
+    for (; x + 8 <= n; x += 8, rgba += 32)
+    {
+        __m256i v = _mm256_loadu_si256((const __m256i*)rgba);
+        __m256i a = _mm256_srli_epi32(v, 24);
+        __m256i clear = _mm256_cmpeq_epi32(a, _mm256_setzero_si256());
+        __m256  scale = _mm256_div_ps(full, _mm256_cvtepi32_ps(a));
+        __m256i r = _mm256_cvttps_epi32(_mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_and_si256(v, low)), scale));
+        __m256i g = _mm256_cvttps_epi32(_mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_and_si256(_mm256_srli_epi32(v, 8), low)), scale));
+        __m256i b = _mm256_cvttps_epi32(_mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_and_si256(_mm256_srli_epi32(v, 16), low)), scale));
+
+        // transparent pixels are black, and the packs saturate to 255.
+        // They work within 128 bit halves, so each half holds four pixels
+        // laid out as in the SSE2 kernel.
+        r = _mm256_andnot_si256(clear, r);
+        g = _mm256_andnot_si256(clear, g);
+        b = _mm256_andnot_si256(clear, b);
+        _mm256_storeu_si256((__m256i*)bytes, _mm256_packus_epi16(_mm256_packs_epi32(r, g), _mm256_packs_epi32(b, b)));
+
+        for (int i = 0; i < 8; i++, rgb += 3)
+        {
+            rgb[0] = bytes[(i & 4) * 4 + (i & 3)];
+            rgb[1] = bytes[(i & 4) * 4 + 4 + (i & 3)];
+            rgb[2] = bytes[(i & 4) * 4 + 8 + (i & 3)];
+        }// for
+    }// for
+
+    RGBA_To_RGB_Row_Scalar(rgba, rgb, n - x);
+}// RGBA_To_RGB_Row_AVX2
+
+
+KERNEL_TARGET("avx2") static void Mask_Row_AVX2(unsigned char* rgba, int n, const unsigned char mask[4])
+{
+    int     bits;
+    int     x = 0;
+
+    memcpy(&bits, mask, 4);
+    for (; x + 8 <= n; x += 8, rgba += 32)
+        _mm256_storeu_si256((__m256i*)rgba, _mm256_and_si256(_mm256_loadu_si256((const __m256i*)rgba), _mm256_set1_epi32(bits)));
+
+    Mask_Row_Scalar(rgba, n - x, mask);
+}// Mask_Row_AVX2
+
+
+KERNEL_TARGET("avx2") static void Threshold_Row_AVX2(unsigned char* row, int n, unsigned char threshold, unsigned char dark, unsigned char bright)
+{
+    const __m256i   t = _mm256_set1_epi8((char)threshold);
+    const __m256i   d = _mm256_set1_epi8((char)dark);
+    const __m256i   l = _mm256_set1_epi8((char)bright);
+    int             x = 0;
+
+    for (; x + 32 <= n; x += 32)
+    {
+        __m256i v = _mm256_loadu_si256((const __m256i*)(row + x));
+        __m256i ge = _mm256_cmpeq_epi8(_mm256_max_epu8(v, t), v);
+
+        _mm256_storeu_si256((__m256i*)(row + x), _mm256_blendv_epi8(d, l, ge));
+    }// for
+
+    Threshold_Row_Scalar(row + x, n - x, threshold, dark, bright);
+}// Threshold_Row_AVX2
+
+
+KERNEL_TARGET("avx2") static void Convolve_V_Row_AVX2(const unsigned char* src, ptrdiff_t stride, const float* taps, int radius, float* dst, int n)
+{
+    const unsigned char *top = src - radius * stride;
+    int                 x = 0;
+
+    for (; x + 8 <= n; x += 8)
+    {
+        __m256 sum = _mm256_setzero_ps();
+
+        for (int k = 0; k <= 2 * radius; k++)
+            sum = _mm256_add_ps(sum, _mm256_mul_ps(_mm256_set1_ps(taps[k]), _mm256_cvtepi32_ps(Load_Bytes_AVX2(top + k * stride + x))));
+
+        _mm256_storeu_ps(dst + x, sum);
+    }// for
+
+    Convolve_V_Row_SSE2(src + x, stride, taps, radius, dst + x, n - x);
+}// Convolve_V_Row_AVX2
+
+
+KERNEL_TARGET("avx2") static void Convolve_H_Row_AVX2(const float* src, const float* taps, int radius, float base, unsigned char* dst, int n)
+{
+    const float     *left = src - radius;
+    const __m256    b = _mm256_set1_ps(base);
+    int             x = 0;
+
+    for (; x + 8 <= n; x += 8)
+    {
+        __m256 sum = _mm256_setzero_ps();
+
+        for (int k = 0; k <= 2 * radius; k++)
+            sum = _mm256_add_ps(sum, _mm256_mul_ps(_mm256_set1_ps(taps[k]), _mm256_loadu_ps(left + x + k)));
+
+        Store_Bytes_AVX2(dst + x, _mm256_cvttps_epi32(_mm256_div_ps(sum, b)));
+    }// for
+
+    Convolve_H_Row_SSE2(src + x, taps, radius, base, dst + x, n - x);
+}// Convolve_H_Row_AVX2
+
+
+KERNEL_TARGET("avx2") static void Fixed_V_Row_AVX2(const unsigned char* src, ptrdiff_t stride, const unsigned short* taps, int count,
+                                                   unsigned short* dst, int n)
+{
+    int x = 0;
+
+    for (; x + 32 <= n; x += 32)
+    {
+        __m256i lo = _mm256_setzero_si256(), hi = _mm256_setzero_si256();
+
+        for (int k = 0; k < count; k++)
+        {
+            const unsigned char *p = src + k * stride + x;
+            __m256i             t = _mm256_set1_epi16((short)taps[k]);
+
+            lo = _mm256_add_epi16(lo, _mm256_mullo_epi16(_mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*)p)), t));
+            hi = _mm256_add_epi16(hi, _mm256_mullo_epi16(_mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*)(p + 16))), t));
+        }// for
+
+        _mm256_storeu_si256((__m256i*)(dst + x), lo);
+        _mm256_storeu_si256((__m256i*)(dst + x + 16), hi);
+    }// for
+
+    Fixed_V_Row_SSE2(src + x, stride, taps, count, dst + x, n - x);
+}// Fixed_V_Row_AVX2
+
+
+KERNEL_TARGET("avx2") static void Fixed_H_Row_AVX2(const unsigned short* src, const unsigned short* taps, int count,
+                                                   unsigned short multiplier, int shift, unsigned char* dst, int n)
+{
+    const __m256i   m = _mm256_set1_epi16((short)multiplier);
+    const __m128i   s = _mm_cvtsi32_si128(shift);
+    int             x = 0;
+
+    for (; x + 32 <= n; x += 32)
+    {
+        __m256i lo = _mm256_setzero_si256(), hi = _mm256_setzero_si256();
+
+        for (int k = 0; k < count; k++)
+        {
+            __m256i t = _mm256_set1_epi16((short)taps[k]);
+
+            lo = _mm256_add_epi16(lo, _mm256_mullo_epi16(_mm256_loadu_si256((const __m256i*)(src + x + k)), t));
+            hi = _mm256_add_epi16(hi, _mm256_mullo_epi16(_mm256_loadu_si256((const __m256i*)(src + x + 16 + k)), t));
+        }// for
+
+        // the pack works within 128 bit halves, so the quarters come out
+        // as lo, hi, lo, hi and are put back in order
+        lo = _mm256_srl_epi16(_mm256_mulhi_epu16(lo, m), s);
+        hi = _mm256_srl_epi16(_mm256_mulhi_epu16(hi, m), s);
+        _mm256_storeu_si256((__m256i*)(dst + x), _mm256_permute4x64_epi64(_mm256_packus_epi16(lo, hi), 0xD8));
+    }// for
+
+    Fixed_H_Row_SSE2(src + x, taps, count, multiplier, shift, dst + x, n - x);
+}// Fixed_H_Row_AVX2
+
+
+static const SKernels   c_avx2 = { "avx2", Gray_Row_AVX2, RGBA_To_RGB_Row_AVX2, Mask_Row_AVX2,
+                                   Threshold_Row_AVX2, Convolve_V_Row_AVX2, Convolve_H_Row_AVX2,
+                                   Fixed_V_Row_AVX2, Fixed_H_Row_AVX2 };
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      AVX-512 kernels, sixteen pixels at a time.  They need the byte and
+//  word instructions of AVX512BW as well as AVX512F.
+//
+///////////////////////////////////////////////////////////////////////////////
+#if defined(__GNUC__) && !defined(__clang__)
+// AVX-512 brings FMA with it, and GCC would fuse multiplies and adds that
+// the scalar kernels round separately
+#define KERNEL_AVX512 KERNEL_TARGET("avx512f,avx512bw") __attribute__((optimize("fp-contract=off")))
+
+// the plain AVX-512 conversions, shifts and lane moves start from an 
+// undefined vector in GCC's headers, which -Wmaybe-uninitialized reports
+// once they are inlined here
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+#else
+#define KERNEL_AVX512 KERNEL_TARGET("avx512f,avx512bw")
+#endif
+
+// sixteen bytes widened to 32 bit lanes, and back keeping the low byte of each
+KERNEL_AVX512 static inline __m512i Load_Bytes_AVX512(const unsigned char* p)
+{
+    return _mm512_cvtepu8_epi32(_mm_loadu_si128((const __m128i*)p));
+}// Load_Bytes_AVX512
+
+KERNEL_AVX512 static inline void Store_Bytes_AVX512(unsigned char* p, __m512i v)
+{
+    _mm_storeu_si128((__m128i*)p, _mm512_cvtepi32_epi8(v));
+}// Store_Bytes_AVX512
+
+KERNEL_AVX512 static inline __m512i Join_AVX512(__m256i lo, __m256i hi)
+{
+    return _mm512_inserti64x4(_mm512_castsi256_si512(lo), hi, 1);
+}// Join_AVX512
+
+
+KERNEL_AVX512 static inline __m256 Gray_Half_AVX512(__m256i r, __m256i g, __m256i b)
+{
+    const __m512d   wr = _mm512_set1_pd(0.3), wg = _mm512_set1_pd(0.59), wb = _mm512_set1_pd(0.11);
+
+    return _mm512_cvtpd_ps(_mm512_add_pd(_mm512_add_pd(_mm512_mul_pd(wr, _mm512_cvtepi32_pd(r)),
+                                                       _mm512_mul_pd(wg, _mm512_cvtepi32_pd(g))),
+                                         _mm512_mul_pd(wb, _mm512_cvtepi32_pd(b))));
+}// Gray_Half_AVX512
+
+
+KERNEL_AVX512 static void Gray_Row_AVX512(const unsigned char* rgba, unsigned char* gray, int n)
+{
+    const __m512i   low = _mm512_set1_epi32(0xFF);
+    int             x = 0;
+
+    for (; x + 16 <= n; x += 16, rgba += 64)
+    {
+        __m512i v = _mm512_loadu_si512((const void*)rgba);
+        __m512i r = _mm512_and_si512(v, low);
+        __m512i g = _mm512_and_si512(_mm512_srli_epi32(v, 8), low);
+        __m512i b = _mm512_and_si512(_mm512_srli_epi32(v, 16), low);
+        __m256  lo = Gray_Half_AVX512(_mm512_castsi512_si256(r), _mm512_castsi512_si256(g), _mm512_castsi512_si256(b));
+        __m256  hi = Gray_Half_AVX512(_mm512_extracti64x4_epi64(r, 1), _mm512_extracti64x4_epi64(g, 1), _mm512_extracti64x4_epi64(b, 1));
+
+        Store_Bytes_AVX512(gray + x, Join_AVX512(_mm256_cvttps_epi32(lo), _mm256_cvttps_epi32(hi)));
+    }// for
+
+    Gray_Row_AVX2(rgba, gray + x, n - x);
+}// Gray_Row_AVX512
+
+
+KERNEL_AVX512 static void RGBA_To_RGB_Row_AVX512(const unsigned char* rgba, unsigned char* rgb, int n)
+{
+    const __m512i   low = _mm512_set1_epi32(0xFF);
+    const __m512    full = _mm512_set1_ps(255.0f);
+    unsigned char   bytes[3][16];
+    int             x = 0;
+
+    for (; x + 16 <= n; x += 16, rgba += 64)
+    {
+        __m512i     v = _mm512_loadu_si512((const void*)rgba);
+        __m512i     a = _mm512_srli_epi32(v, 24);
+        __mmask16   opaque = _mm512_test_epi32_mask(a, a);
+        __m512      scale = _mm512_div_ps(full, _mm512_cvtepi32_ps(a));
+        __m512i     c;
+
+        // transparent pixels are black, the rest are clamped to 255
+        for (int i = 0; i < 3; i++)
+        {
+            c = _mm512_and_si512(_mm512_srli_epi32(v, 8 * i), low);
+            c = _mm512_cvttps_epi32(_mm512_mul_ps(_mm512_cvtepi32_ps(c), scale));
+            c = _mm512_maskz_min_epi32(opaque, c, low);
+            _mm_storeu_si128((__m128i*)bytes[i], _mm512_cvtepi32_epi8(c));
+        }// for
+
+        for (int i = 0; i < 16; i++, rgb += 3)
+        {
+            rgb[0] = bytes[0][i];
+            rgb[1] = bytes[1][i];
+            rgb[2] = bytes[2][i];
+        }// for
+    }// for
+
+    RGBA_To_RGB_Row_AVX2(rgba, rgb, n - x);
+}// RGBA_To_RGB_Row_AVX512
+
+
+KERNEL_AVX512 static void Mask_Row_AVX512(unsigned char* rgba, int n, const unsigned char mask[4])
+{
+    int     bits;
+    int     x = 0;
+
+    memcpy(&bits, mask, 4);
+    for (; x + 16 <= n; x += 16, rgba += 64)
+        _mm512_storeu_si512((void*)rgba, _mm512_and_si512(_mm512_loadu_si512((const void*)rgba), _mm512_set1_epi32(bits)));
+
+    Mask_Row_AVX2(rgba, n - x, mask);
+}// Mask_Row_AVX512
+
+
+KERNEL_AVX512 static void Threshold_Row_AVX512(unsigned char* row, int n, unsigned char threshold, unsigned char dark, unsigned char bright)
+{
+    const __m512i   t = _mm512_set1_epi8((char)threshold);
+    const __m512i   d = _mm512_set1_epi8((char)dark);
+    const __m512i   l = _mm512_set1_epi8((char)bright);
+    int             x = 0;
+
+    for (; x + 64 <= n; x += 64)
+    {
+        __m512i v = _mm512_loadu_si512((const void*)(row + x));
+
+        _mm512_storeu_si512((void*)(row + x), _mm512_mask_blend_epi8(_mm512_cmpge_epu8_mask(v, t), d, l));
+    }// for
+
+    Threshold_Row_AVX2(row + x, n - x, threshold, dark, bright);
+}// Threshold_Row_AVX512
+
+
+KERNEL_AVX512 static void Convolve_V_Row_AVX512(const unsigned char* src, ptrdiff_t stride, const float* taps, int radius, float* dst, int n)
+{
+    const unsigned char *top = src - radius * stride;
+    int                 x = 0;
+
+    for (; x + 16 <= n; x += 16)
+    {
+        __m512 sum = _mm512_setzero_ps();
+
+        for (int k = 0; k <= 2 * radius; k++)
+            sum = _mm512_add_ps(sum, _mm512_mul_ps(_mm512_set1_ps(taps[k]), _mm512_cvtepi32_ps(Load_Bytes_AVX512(top + k * stride + x))));
+
+        _mm512_storeu_ps(dst + x, sum);
+    }// for
+
+    Convolve_V_Row_AVX2(src + x, stride, taps, radius, dst + x, n - x);
+}// Convolve_V_Row_AVX512
+
+
+KERNEL_AVX512 static void Convolve_H_Row_AVX512(const float* src, const float* taps, int radius, float base, unsigned char* dst, int n)
+{
+    const float     *left = src - radius;
+    const __m512    b = _mm512_set1_ps(base);
+    int             x = 0;
+
+    for (; x + 16 <= n; x += 16)
+    {
+        __m512 sum = _mm512_setzero_ps();
+
+        for (int k = 0; k <= 2 * radius; k++)
+            sum = _mm512_add_ps(sum, _mm512_mul_ps(_mm512_set1_ps(taps[k]), _mm512_loadu_ps(left + x + k)));
+
+        Store_Bytes_AVX512(dst + x, _mm512_cvttps_epi32(_mm512_div_ps(sum, b)));
+    }// for
+
+    Convolve_H_Row_AVX2(src + x, taps, radius, base, dst + x, n - x);
+}// Convolve_H_Row_AVX512
+
+
+KERNEL_AVX512 static void Fixed_V_Row_AVX512(const unsigned char* src, ptrdiff_t stride, const unsigned short* taps, int count,
+                                             unsigned short* dst, int n)
+{
+    int x = 0;
+
+    for (; x + 64 <= n; x += 64)
+    {
+        __m512i lo = _mm512_setzero_si512(), hi = _mm512_setzero_si512();
+
+        for (int k = 0; k < count; k++)
+        {
+            const unsigned char *p = src + k * stride + x;
+            __m512i             t = _mm512_set1_epi16((short)taps[k]);
+
+            lo = _mm512_add_epi16(lo, _mm512_mullo_epi16(_mm512_cvtepu8_epi16(_mm256_loadu_si256((const __m256i*)p)), t));
+            hi = _mm512_add_epi16(hi, _mm512_mullo_epi16(_mm512_cvtepu8_epi16(_mm256_loadu_si256((const __m256i*)(p + 32))), t));
+        }// for
+
+        _mm512_storeu_si512((void*)(dst + x), lo);
+        _mm512_storeu_si512((void*)(dst + x + 32), hi);
+    }// for
+
+    Fixed_V_Row_AVX2(src + x, stride, taps, count, dst + x, n - x);
+}// Fixed_V_Row_AVX512
+
+
+KERNEL_AVX512 static void Fixed_H_Row_AVX512(const unsigned short* src, const unsigned short* taps, int count,
+                                             unsigned short multiplier, int shift, unsigned char* dst, int n)
+{
+    const __m512i   m = _mm512_set1_epi16((short)multiplier);
+    const __m128i   s = _mm_cvtsi32_si128(shift);
+    int             x = 0;
+
+    for (; x + 32 <= n; x += 32)
+    {
+        __m512i sum = _mm512_setzero_si512();
+
+        for (int k = 0; k < count; k++)
+            sum = _mm512_add_epi16(sum, _mm512_mullo_epi16(_mm512_loadu_si512((const void*)(src + x + k)), 
+                                                           _mm512_set1_epi16((short)taps[k])));
+
+        _mm256_storeu_si256((__m256i*)(dst + x), _mm512_cvtepi16_epi8(_mm512_srl_epi16(_mm512_mulhi_epu16(sum, m), s)));
+    }// for
+
+    Fixed_H_Row_AVX2(src + x, taps, count, multiplier, shift, dst + x, n - x);
+}// Fixed_H_Row_AVX512
+
+
+static const SKernels   c_avx512 = { "avx512", Gray_Row_AVX512, RGBA_To_RGB_Row_AVX512, Mask_Row_AVX512,
+                                     Threshold_Row_AVX512, Convolve_V_Row_AVX512, Convolve_H_Row_AVX512,
+                                     Fixed_V_Row_AVX512, Fixed_H_Row_AVX512 };
+
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic pop
+#endif
+#endif // KERNELS_X86
+
+
+// every table, worst to best
+static const SKernels* const    c_apTables[] = { &c_scalar
+#ifdef KERNELS_X86
+                                               , &c_sse2, &c_avx2, &c_avx512
+#endif
+                                               };
+const int                       c_numTables = sizeof(c_apTables) / sizeof(c_apTables[0]);
+
+static const SKernels*          s_pSelected = NULL;     // table chosen by Select, or NULL for the best
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Can the processor run the table?  Checked with CPUID, which for AVX
+//  also covers the operating system saving the wider registers.
+//
+///////////////////////////////////////////////////////////////////////////////
+static bool Is_Supported(const SKernels* pTable)
+{
+#ifdef KERNELS_X86
+#if defined(__GNUC__)
+    __builtin_cpu_init();
+    if (pTable == &c_sse2)
+        return __builtin_cpu_supports("sse2");
+    if (pTable == &c_avx2)
+        return __builtin_cpu_supports("avx2");
+    if (pTable == &c_avx512)
+        return __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw");
+#elif defined(_MSC_VER)
+    int     info[4];
+    bool    bOSAVX, bOSAVX512;
+
+    __cpuid(info, 1);
+    bOSAVX = (info[2] & (1 << 27)) && (_xgetbv(0) & 0x06) == 0x06;
+    bOSAVX512 = bOSAVX && (_xgetbv(0) & 0xE0) == 0xE0;
+    if (pTable == &c_sse2)
+        return (info[3] & (1 << 26)) != 0;
+    __cpuidex(info, 7, 0);
+    if (pTable == &c_avx2)
+        return bOSAVX && (info[1] & (1 << 5));
+    if (pTable == &c_avx512)
+        return bOSAVX512 && (info[1] & (1 << 16)) && (info[1] & (1 << 30));
+#endif
+#endif
+    return pTable == &c_scalar;
+}// Is_Supported
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      The best table the processor can run.
+//
+///////////////////////////////////////////////////////////////////////////////
+static const SKernels* Best_Table()
+{
+    for (int i = c_numTables - 1; i > 0; i--)
+        if (Is_Supported(c_apTables[i]))
+            return c_apTables[i];
+
+    return &c_scalar;
+}// Best_Table
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      The table in use: the one picked by Select, or else the best one,
+//  found once.
+//
+///////////////////////////////////////////////////////////////////////////////
+const SKernels& SKernels::Active()
+{
+    static const SKernels* pBest = Best_Table();
+
+    return s_pSelected ? *s_pSelected : *pBest;
+}// Active
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      The scalar reference table.
+//
+///////////////////////////////////////////////////////////////////////////////
+const SKernels& SKernels::Scalar()
+{
+    return c_scalar;
+}// Scalar
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Use the named table from now on.  Meant for startup, before any
+//  image operation runs.
+//
+///////////////////////////////////////////////////////////////////////////////
+bool SKernels::Select(const char* sName)
+{
+    for (int i = 0; i < c_numTables; i++)
+    {
+        if (sName && !strcmp(sName, c_apTables[i]->name))
+        {
+            if (!Is_Supported(c_apTables[i]))
+            {
+                cout << "Kernels:  this processor can't run " << sName << endl;
+                return false;
+            }// if
+
+            s_pSelected = c_apTables[i];
+            return true;
+        }// if
+    }// for
+
+    cout << "Kernels:  no kernels named " << (sName ? sName : "") << endl;
+    return false;
+}// Select
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Generate test bytes.  A fixed xorshift sequence, so a failure can be
+//  reproduced.
+//
+///////////////////////////////////////////////////////////////////////////////
+static void Fill_Random(vector<unsigned char>& bytes, unsigned int& state)
+{
+    for (size_t i = 0; i < bytes.size(); i++)
+    {
+        state ^= state << 13;
+        state ^= state >> 17;
+        state ^= state << 5;
+        bytes[i] = (unsigned char)(state >> 8);
+    }// for
+}// Fill_Random
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Report the first difference between two outputs, if there is one.
+//
+///////////////////////////////////////////////////////////////////////////////
+static bool Same_Output(const SKernels& table, const char* sKernel, int n, const vector<unsigned char>& expected,
+                        const vector<unsigned char>& actual)
+{
+    for (size_t i = 0; i < expected.size(); i++)
+    {
+        if (expected[i] != actual[i])
+        {
+            cout << "Kernels " << table.name << ":  " << sKernel << " differs from scalar for " << n << " pixels at byte "
+                 << i << ", " << (int)actual[i] << " instead of " << (int)expected[i] << endl;
+            return false;
+        }// if
+    }// for
+
+    return true;
+}// Same_Output
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Run a separable filter over a plane of n bytes across, with the 
+//  scalar kernels and with table's, and report the first difference in
+//  either pass.  The plane is random, or every byte 255 if bFull.
+//
+///////////////////////////////////////////////////////////////////////////////
+struct SSeparableTest
+{
+    const char  *sName;
+    int         radius;
+    float       taps[9];
+    float       base;
+};// SSeparableTest
+
+static const SSeparableTest c_asFilters[] = { { "box", 2, { 1, 1, 1, 1, 1 }, 25.0f },
+                                              { "bartlett", 2, { 1, 2, 3, 2, 1 }, 81.0f },
+                                              { "gaussian", 2, { 1, 4, 6, 4, 1 }, 256.0f },
+                                              { "binomial 9", 4, { 1, 8, 28, 56, 70, 56, 28, 8, 1 }, 65536.0f } };
+static const int            c_numFilters = sizeof(c_asFilters) / sizeof(c_asFilters[0]);
+
+static bool Same_Separable(const SKernels& table, const SSeparableTest& filter, int n, vector<unsigned char>& plane,
+                           unsigned int& state, bool bFull)
+{
+    // a border of the filter's radius, starting off alignment
+    const int               r = filter.radius;
+    const ptrdiff_t         stride = n + 2 * r + 3;
+    vector<float>           expectedSums(n + 2 * r + 1), actualSums(n + 2 * r + 1);
+    vector<unsigned char>   expected(n + 1, 0), actual(n + 1, 0);
+
+    plane.resize(stride * (2 * r + 1) + 1);
+    if (bFull)
+        plane.assign(plane.size(), 255);
+    else
+        Fill_Random(plane, state);
+
+    const unsigned char     *center = &plane[1 + r * stride + r];
+
+    SKernels::Scalar().Convolve_V_Row(center - r, stride, filter.taps, r, &expectedSums[0], n + 2 * r);
+    table.Convolve_V_Row(center - r, stride, filter.taps, r, &actualSums[0], n + 2 * r);
+    if (memcmp(&expectedSums[0], &actualSums[0], (n + 2 * r) * sizeof(float)))
+    {
+        cout << "Kernels " << table.name << ":  Convolve_V_Row " << filter.sName << " differs from scalar for " 
+             << n << " pixels" << endl;
+        return false;
+    }// if
+
+    SKernels::Scalar().Convolve_H_Row(&expectedSums[r], filter.taps, r, filter.base, &expected[0], n);
+    table.Convolve_H_Row(&expectedSums[r], filter.taps, r, filter.base, &actual[0], n);
+
+    return Same_Output(table, (string("Convolve_H_Row ") + filter.sName).c_str(), n, expected, actual);
+}// Same_Separable
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Run a fixed point filter over a plane of n bytes across, with the 
+//  scalar kernels and with table's, and report the first difference in
+//  either pass.  Filters with a float twin among c_asFilters must also give
+//  the twin's bytes.  The plane is random, or every byte 255 if bFull.
+//
+///////////////////////////////////////////////////////////////////////////////
+struct SFixedTest
+{
+    const char      *sName;
+    int             downCount;
+    unsigned short  downTaps[5];
+    int             acrossCount;
+    unsigned short  acrossTaps[5];
+    unsigned short  multiplier;
+    int             shift;
+    int             twin;               // index in c_asFilters, or -1
+};// SFixedTest
+
+static const SFixedTest c_asFixedFilters[] = { { "bartlett", 5, { 1, 2, 3, 2, 1 }, 5, { 1, 2, 3, 2, 1 }, 25891, 5, 1 },
+                                               { "gaussian", 5, { 1, 4, 6, 4, 1 }, 5, { 1, 4, 6, 4, 1 }, 256, 0, 2 },
+                                               { "half", 3, { 1, 2, 1 }, 3, { 1, 2, 1 }, 4096, 0, -1 },
+                                               { "double edge", 4, { 1, 3, 3, 1 }, 3, { 1, 2, 1 }, 2048, 0, -1 },
+                                               { "double corner", 4, { 1, 3, 3, 1 }, 4, { 1, 3, 3, 1 }, 1024, 0, -1 } };
+static const int        c_numFixedFilters = sizeof(c_asFixedFilters) / sizeof(c_asFixedFilters[0]);
+
+static bool Same_Fixed(const SKernels& table, const SFixedTest& filter, int n, vector<unsigned char>& plane,
+                       unsigned int& state, bool bFull)
+{
+    // starting off alignment
+    const int               width = n + filter.acrossCount - 1;
+    const ptrdiff_t         stride = width + 3;
+    vector<unsigned short>  expectedSums(width + 1), actualSums(width + 1);
+    vector<unsigned char>   expected(n + 1, 0), actual(n + 1, 0);
+
+    plane.resize(stride * filter.downCount + 1);
+    if (bFull)
+        plane.assign(plane.size(), 255);
+    else
+        Fill_Random(plane, state);
+
+    SKernels::Scalar().Fixed_V_Row(&plane[1], stride, filter.downTaps, filter.downCount, &expectedSums[0], width);
+    table.Fixed_V_Row(&plane[1], stride, filter.downTaps, filter.downCount, &actualSums[0], width);
+    if (memcmp(&expectedSums[0], &actualSums[0], width * sizeof(unsigned short)))
+    {
+        cout << "Kernels " << table.name << ":  Fixed_V_Row " << filter.sName << " differs from scalar for " 
+             << n << " pixels" << endl;
+        return false;
+    }// if
+
+    SKernels::Scalar().Fixed_H_Row(&expectedSums[0], filter.acrossTaps, filter.acrossCount, filter.multiplier, filter.shift,
+                                   &expected[0], n);
+    table.Fixed_H_Row(&expectedSums[0], filter.acrossTaps, filter.acrossCount, filter.multiplier, filter.shift, &actual[0], n);
+    if (!Same_Output(table, (string("Fixed_H_Row ") + filter.sName).c_str(), n, expected, actual))
+        return false;
+
+    if (filter.twin < 0)
+        return true;
+
+    // the float kernels, on the same plane
+    const SSeparableTest    &twin = c_asFilters[filter.twin];
+    const int               r = twin.radius;
+    vector<float>           sums(width + 1);
+
+    SKernels::Scalar().Convolve_V_Row(&plane[1 + r * stride], stride, twin.taps, r, &sums[0], width);
+    SKernels::Scalar().Convolve_H_Row(&sums[r], twin.taps, r, twin.base, &expected[0], n);
+
+    return Same_Output(table, (string("Fixed_H_Row ") + filter.sName + " against float").c_str(), n, expected, actual);
+}// Same_Fixed
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Check every kernel of every table the processor supports against the
+//  scalar reference.  Rows of every length up to a few vectors, and a long
+//  one, are tried with random bytes and with every byte 255, which is where
+//  sums round over the top.
+//
+///////////////////////////////////////////////////////////////////////////////
+bool SKernels::Verify()
+{
+    const unsigned char mask[4] = { 224, 224, 192, 255 };
+    unsigned int        state = 2463534242u;
+    bool                bAllMatch = true;
+
+    for (int t = 1; t < c_numTables; t++)
+    {
+        const SKernels& table = *c_apTables[t];
+        bool            bMatch = true;
+
+        if (!Is_Supported(&table))
+        {
+            cout << "Kernels " << table.name << ":  not supported, skipped" << endl;
+            continue;
+        }// if
+
+        for (int n = 0; n <= 200 && bMatch; n = n < 80 ? n + 1 : n * 2 + 17)
+        {
+            for (int pass = 0; pass < 2 && bMatch; pass++)
+            {
+                // starting off alignment
+                vector<unsigned char>   input((size_t)n * 4 + 2);
+                vector<unsigned char>   expected, actual, plane;
+
+                if (pass)
+                    input.assign(input.size(), 255);
+                else
+                    Fill_Random(input, state);
+
+                const unsigned char*    pixels = &input[1];
+
+                expected.assign(n + 1, 0);
+                actual.assign(n + 1, 0);
+                Scalar().Gray_Row(pixels, &expected[0], n);
+                table.Gray_Row(pixels, &actual[0], n);
+                bMatch = bMatch && Same_Output(table, "Gray_Row", n, expected, actual);
+
+                expected.assign(n * 3 + 1, 0);
+                actual.assign(n * 3 + 1, 0);
+                Scalar().RGBA_To_RGB_Row(pixels, &expected[0], n);
+                table.RGBA_To_RGB_Row(pixels, &actual[0], n);
+                bMatch = bMatch && Same_Output(table, "RGBA_To_RGB_Row", n, expected, actual);
+
+                expected.assign(pixels, pixels + n * 4 + 1);
+                actual = expected;
+                Scalar().Mask_Row(&expected[0], n, mask);
+                table.Mask_Row(&actual[0], n, mask);
+                bMatch = bMatch && Same_Output(table, "Mask_Row", n, expected, actual);
+
+                expected = actual = input;
+                Scalar().Threshold_Row(&expected[0], (int)input.size(), (unsigned char)(127 + n), 0, 255);
+                table.Threshold_Row(&actual[0], (int)input.size(), (unsigned char)(127 + n), 0, 255);
+                bMatch = bMatch && Same_Output(table, "Threshold_Row", n, expected, actual);
+
+                for (int f = 0; f < c_numFilters && bMatch; f++)
+                    bMatch = Same_Separable(table, c_asFilters[f], n, plane, state, pass != 0);
+
+                for (int f = 0; f < c_numFixedFilters && bMatch; f++)
+                    bMatch = Same_Fixed(table, c_asFixedFilters[f], n, plane, state, pass != 0);
+            }// for
+        }// for
+
+        if (bMatch)
+            cout << "Kernels " << table.name << ":  all match scalar" << endl;
+        bAllMatch = bAllMatch && bMatch;
+    }// for
+
+    return bAllMatch;
+}// Verify
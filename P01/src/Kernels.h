@@ -0,0 +1,74 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Kernels.h
+//
+//      Row kernels for the per-pixel loops of TargaImage, one table per
+//  instruction set.  The scalar table is the reference; the SSE2, AVX2 and
+//  AVX-512 tables must give exactly the same bytes.  Active picks the best
+//  table the processor supports the first time it is called.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef _KERNELS_H_
+#define _KERNELS_H_
+
+#include <stddef.h>
+
+struct SKernels
+{
+    const char  *name;      // "scalar", "sse2", "avx2" or "avx512"
+
+    // Gray value of n RGBA pixels, weighted 0.3, 0.59 and 0.11.
+    void (*Gray_Row)(const unsigned char* rgba, unsigned char* gray, int n);
+
+    // Divide the alpha out of n premultiplied RGBA pixels, giving n RGB
+    // pixels composited over black.
+    void (*RGBA_To_RGB_Row)(const unsigned char* rgba, unsigned char* rgb, int n);
+
+    // And every byte of n RGBA pixels with the matching byte of mask.
+    void (*Mask_Row)(unsigned char* rgba, int n, const unsigned char mask[4]);
+
+    // Replace each of n bytes with bright if it is at least threshold and
+    // dark otherwise.
+    void (*Threshold_Row)(unsigned char* row, int n, unsigned char threshold, unsigned char dark, unsigned char bright);
+
+    // Vertical pass of a separable filter with 2 * radius + 1 taps: the
+    // weighted sum down each of n columns of a plane whose rows are stride
+    // bytes apart, centered on the row src is in.  Every tap must be inside
+    // the plane.
+    void (*Convolve_V_Row)(const unsigned char* src, ptrdiff_t stride, const float* taps, int radius, float* dst, int n);
+
+    // Horizontal pass: the weighted sum across n sums from Convolve_V_Row,
+    // divided by base and truncated to a byte.  src is the first center, 
+    // and radius sums either side of the row must be there too.
+    void (*Convolve_H_Row)(const float* src, const float* taps, int radius, float base, unsigned char* dst, int n);
+
+    // Fixed point vertical pass: the weighted sum down each of n columns
+    // of count rows, starting with the row src is in, in 16 bits.  The 
+    // taps times 255 must add up to less than 65536.
+    void (*Fixed_V_Row)(const unsigned char* src, ptrdiff_t stride, const unsigned short* taps, int count, unsigned short* dst, 
+                        int n);
+
+    // Fixed point horizontal pass: the weighted sum across the count sums
+    // from Fixed_V_Row starting at each of n, which must be less than 
+    // 65536, times multiplier over 2^(16 + shift) and truncated to a byte.
+    void (*Fixed_H_Row)(const unsigned short* src, const unsigned short* taps, int count, unsigned short multiplier, int shift,
+                        unsigned char* dst, int n);
+
+    // The table in use.
+    static const SKernels& Active(void);
+
+    // The reference table.
+    static const SKernels& Scalar(void);
+
+    // Use the named table from now on.  Returns false, leaving the table
+    // alone, if there is no such table or the processor can't run it.
+    static bool Select(const char* sName);
+
+    // Run every table the processor supports against the scalar one on
+    // generated rows, reporting any difference to standard out.  Returns
+    // true if they all match bit for bit.
+    static bool Verify(void);
+};// SKernels
+
+#endif // _KERNELS_H_
@@ -16,12 +16,21 @@
 
 #include <Fl/Fl.h>
 #include <Fl/Fl_Window.h>
+#include <stdio.h>
 #include <string.h>
+#include <stdlib.h>
 #include <iostream>
 #include <vector>
+#include <chrono>
+#include <thread>
+#include <math.h>
 #include "TargaImage.h"
 #include "ImageWidget.h"
 #include "ScriptHandler.h"
+#include "Kernels.h"
+#include "ThreadPool.h"
+#include "ScratchArena.h"
+#include "libtarga.h"
 
 
 using namespace std;
@@ -29,6 +38,14 @@ using namespace std;
 // constants
 const char      c_sNames[]          = "-names";             // display student names command line switch
 const char      c_sHeadless[]       = "-headless";          // headless command line switch
+const char      c_sKernels[]        = "-kernels";           // kernel table switch, followed by scalar, sse2, avx2 or avx512
+const char      c_sVerifyKernels[]  = "-verify-kernels";    // check the SIMD kernels against scalar and exit
+const char      c_sThreads[]        = "-threads";           // thread count switch, followed by the count
+const char      c_sBenchThreads[]   = "-bench-threads";     // time operations on 1 thread up to the -threads count and exit
+const char      c_sBenchGaussian[]  = "-bench-gaussian";    // time and check Filter_Gaussian_N across N and exit
+const char      c_sBenchLoad[]      = "-bench-load";        // time loading a targa, followed by the file, and exit
+const char      c_sStressStride[]   = "-stress-stride";     // save and load rows over 2^31 bytes apart and exit
+const char      c_sCheckCopy[]      = "-check-copy";        // check copies and shares taken between filters and exit
 
 // globals
 std::vector<char*>  vsStudentNames;
@@ -60,6 +77,353 @@ void DisplayNames()
 }// DisplayNames
 
 
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Fill pixels with a size x size RGBA test card: smooth gradients, hard
+//  edged squares and a little noise.
+//
+///////////////////////////////////////////////////////////////////////////////
+static void Fill_Test_Card(vector<unsigned char>& pixels, int size)
+{
+    unsigned int state = 2463534242u;
+
+    pixels.resize((size_t)size * size * 4);
+    for (int y = 0; y < size; y++)
+        for (int x = 0; x < size; x++)
+        {
+            unsigned char*  p = &pixels[((size_t)y * size + x) * 4];
+            bool            bSquare = (x / 64 + y / 64) % 2 == 0;
+
+            state ^= state << 13;
+            state ^= state >> 17;
+            state ^= state << 5;
+            p[0] = (unsigned char)(x * 256 / size);
+            p[1] = bSquare ? 220 : 30;
+            p[2] = (unsigned char)(128 + (int)(state % 64) - 32);
+            p[3] = 255;
+        }// for
+}// Fill_Test_Card
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Time Filter_Gaussian_N on a 1024 x 1024 test card for a range of N,
+//  and compare it with the exact binomial kernel, which it uses up to
+//  N = 61 and approximates recursively beyond.  The errors are in levels
+//  of the 0 to 255 color channels.
+//
+///////////////////////////////////////////////////////////////////////////////
+static void Benchmark_Gaussian_N()
+{
+    const int               c_size = 1024;
+    const int               anN[] = { 3, 5, 9, 15, 25, 51, 61, 63, 101, 151, 201 };
+    vector<unsigned char>   pixels;
+
+    Fill_Test_Card(pixels, c_size);
+    TargaImage  card(c_size, c_size, &pixels[0]);
+
+    cout << "    N   sigma   fast ms  binomial ms   max error  mean error" << endl;
+    for (size_t i = 0; i < sizeof(anN) / sizeof(anN[0]); i++)
+    {
+        TargaImage  fast(card), exact(card);
+        double      total = 0;
+        int         maxError = 0;
+
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        fast.Filter_Gaussian_N(anN[i]);
+        chrono::steady_clock::time_point middle = chrono::steady_clock::now();
+        exact.Filter_Gaussian_N(anN[i], true);
+        chrono::steady_clock::time_point end = chrono::steady_clock::now();
+
+        for (int y = 0; y < c_size; y++)
+            for (int x = 0; x < c_size * 4; x++)
+            {
+                int error = abs(fast.Row(y)[x] - exact.Row(y)[x]);
+
+                total += error;
+                maxError = max(maxError, error);
+            }// for
+
+        printf("%5d %7.2f %9.1f %12.1f %11d %11.4f\n", anN[i], sqrt(anN[i] - 1.0) / 2,
+               chrono::duration<double, milli>(middle - start).count(), chrono::duration<double, milli>(end - middle).count(),
+               maxError, total / ((double)c_size * c_size * 3));
+    }// for
+}// Benchmark_Gaussian_N
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Time a few operations on a 4096 x 4096 test card with the shared 
+//  pool at 1, 2, 4 ... threads up to nMax, or one per hardware thread if
+//  nMax is 0, and report the speedup of their total over one thread.  
+//  Each time is the best of three, on a copy made before the clock starts.
+//
+///////////////////////////////////////////////////////////////////////////////
+static void Benchmark_Threads(int nMax)
+{
+    const int               c_size = 4096;
+    const int               c_runs = 3;
+    const char*             asOps[] = { "gray", "filter-gauss", "filter-box-r 8", "filter-gauss-n 101", "half", "double" };
+    const int               c_nOps = sizeof(asOps) / sizeof(asOps[0]);
+    vector<unsigned char>   pixels;
+    vector<int>             anCounts;
+    double                  single = 0;
+
+    if (nMax <= 0)
+        nMax = max(1, (int)thread::hardware_concurrency());
+    for (int n = 1; n < nMax; n *= 2)
+        anCounts.push_back(n);
+    anCounts.push_back(nMax);
+
+    Fill_Test_Card(pixels, c_size);
+    TargaImage  card(c_size, c_size, &pixels[0]);
+
+    printf("threads");
+    for (int k = 0; k < c_nOps; k++)
+        printf(" %*s", max(9, (int)strlen(asOps[k])), asOps[k]);
+    printf("  total ms  speedup\n");
+
+    for (size_t i = 0; i < anCounts.size(); i++)
+    {
+        double total = 0;
+
+        CThreadPool::Set_Thread_Count(anCounts[i]);
+        printf("%7d", anCounts[i]);
+        for (int k = 0; k < c_nOps; k++)
+        {
+            double best = 0;
+
+            for (int r = 0; r < c_runs; r++)
+            {
+                TargaImage  image(card);
+
+                image.Unshare();
+                chrono::steady_clock::time_point start = chrono::steady_clock::now();
+                switch (k)
+                {
+                    case 0: image.To_Grayscale(); break;
+                    case 1: image.Filter_Gaussian(); break;
+                    case 2: image.Filter_Box_R(8); break;
+                    case 3: image.Filter_Gaussian_N(101); break;
+                    case 4: image.Half_Size(); break;
+                    default: image.Double_Size(); break;
+                }// switch
+                image.Load_Data();
+                chrono::steady_clock::time_point end = chrono::steady_clock::now();
+                double ms = chrono::duration<double, milli>(end - start).count();
+
+                // as the script handler does after every command
+                CScratchArena::Thread().Reset();
+
+                if (r == 0 || ms < best)
+                    best = ms;
+            }// for
+
+            printf(" %*.1f", max(9, (int)strlen(asOps[k])), best);
+            total += best;
+        }// for
+
+        if (i == 0)
+            single = total;
+        printf(" %9.1f %8.2f\n", total, single / total);
+    }// for
+}// Benchmark_Threads
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Time loading a file with Load_Image, best of several runs, and 
+//  report the rate in MB of file and in megapixels decoded per second.
+//  Return success of operation.
+//
+///////////////////////////////////////////////////////////////////////////////
+static bool Benchmark_Load(char* sFile)
+{
+    const int   c_runs = 5;
+    FILE*       pFile = fopen(sFile, "rb");
+    double      bytes, best = 0;
+    int         w = 0, h = 0;
+
+    if (!pFile)
+    {
+        cout << "Couldn't open " << sFile << endl;
+        return false;
+    }// if
+    fseek(pFile, 0, SEEK_END);
+    bytes = (double)ftell(pFile);
+    fclose(pFile);
+
+    for (int i = 0; i < c_runs; i++)
+    {
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        TargaImage *pLoaded = TargaImage::Load_Image(sFile);
+        chrono::steady_clock::time_point end = chrono::steady_clock::now();
+        double      ms = chrono::duration<double, milli>(end - start).count();
+
+        if (!pLoaded)
+        {
+            cout << "Couldn't load " << sFile << endl;
+            return false;
+        }// if
+
+        w = pLoaded->width;
+        h = pLoaded->height;
+        delete pLoaded;
+        if (i == 0 || ms < best)
+            best = ms;
+    }// for
+
+    printf("%d x %d, %.1f MB in %.2f ms: %.1f MB/s, %.1f Mpixels/s\n", w, h, bytes / 1e6, best, 
+           bytes / 1e3 / best, (double)w * h / 1e3 / best);
+    return true;
+}// Benchmark_Load
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Save a few rows that are more than 2^31 bytes apart, in a buffer 
+//  spanning over 4 GB, then load them back the same way, raw and rle, and
+//  check nothing moved.  Only the rows are touched, so little of the 
+//  buffer needs real memory.  Return success of operation.
+//
+///////////////////////////////////////////////////////////////////////////////
+static bool Stress_Large_Stride()
+{
+    const int       c_width = 4096;
+    const int       c_height = 3;
+    const size_t    c_stride = ((size_t)1 << 31) + c_width * 4 + 64;
+    const size_t    c_span = c_stride * (c_height - 1) + c_width * 4;
+    const char      c_sFile[] = "stress_stride.tga";
+    const unsigned  anFlags[] = { TGA_TOP_DOWN, TGA_TOP_DOWN | TGA_RLE };
+    unsigned char*  pBuffer = (unsigned char*)malloc(c_span);
+    bool            bPassed = true;
+
+    if (!pBuffer)
+    {
+        cout << "Couldn't reserve " << c_span << " bytes" << endl;
+        return false;
+    }// if
+
+    for (size_t f = 0; f < sizeof(anFlags) / sizeof(anFlags[0]); f++)
+    {
+        TGA_READER  *pReader;
+        int         w, h, error, nWrong = 0;
+
+        // opaque, so the round trip through straight alpha is exact
+        for (int y = 0; y < c_height; y++)
+            for (int x = 0; x < c_width * 4; x++)
+                pBuffer[y * c_stride + x] = x % 4 == 3 ? 255 : (unsigned char)(x * 7 + y * 13 + (x >> 9));
+
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        if (!tga_write_rows_r(c_sFile, c_width, c_height, pBuffer, c_stride, TGA_TRUECOLOR_32, anFlags[f], &error))
+        {
+            cout << "Save failed: " << tga_error_string(error) << endl;
+            bPassed = false;
+            break;
+        }// if
+        chrono::steady_clock::time_point middle = chrono::steady_clock::now();
+
+        for (int y = 0; y < c_height; y++)
+            memset(pBuffer + y * c_stride, 0, c_width * 4);
+
+        pReader = tga_open_r(c_sFile, &w, &h, &error);
+        if (!pReader || w != c_width || h != c_height || 
+            !tga_read_rows_r(pReader, pBuffer, c_stride, TGA_TRUECOLOR_32, TGA_TOP_DOWN, &error))
+        {
+            cout << "Load failed: " << tga_error_string(error) << endl;
+            if (pReader)
+                tga_close(pReader);
+            bPassed = false;
+            break;
+        }// if
+        tga_close(pReader);
+        chrono::steady_clock::time_point end = chrono::steady_clock::now();
+
+        for (int y = 0; y < c_height; y++)
+            for (int x = 0; x < c_width * 4; x++)
+                if (pBuffer[y * c_stride + x] != (x % 4 == 3 ? 255 : (unsigned char)(x * 7 + y * 13 + (x >> 9))))
+                    nWrong++;
+
+        printf("%s: %d x %d, rows %zu bytes apart over %.2f GB, save %.2f ms, load %.2f ms, %d bytes wrong\n", 
+               anFlags[f] & TGA_RLE ? "rle" : "raw", c_width, c_height, c_stride, c_span / 1e9, 
+               chrono::duration<double, milli>(middle - start).count(), chrono::duration<double, milli>(end - middle).count(), 
+               nWrong);
+        bPassed = bPassed && !nWrong;
+    }// for
+
+    remove(c_sFile);
+    free(pBuffer);
+
+    return bPassed;
+}// Stress_Large_Stride
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Are the pixels of two images of the same size the same?
+//
+///////////////////////////////////////////////////////////////////////////////
+static bool Same_Pixels(TargaImage& a, TargaImage& b)
+{
+    if (!a.Load_Data() || !b.Load_Data())
+        return false;
+
+    for (int y = 0; y < a.height; y++)
+        if (memcmp(a.Row(y), b.Row(y), (size_t)a.width * 4))
+            return false;
+
+    return true;
+}// Same_Pixels
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Copy and share a test card between two filters in uint16 and float,
+//  and check that neither the original nor the copy is quantized to bytes
+//  in between: the original must match an image that was never copied, 
+//  and the copy one filtered twice in a row.  Return success of operation.
+//
+///////////////////////////////////////////////////////////////////////////////
+static bool Check_Copy_Planes()
+{
+    const int               c_size = 256;
+    const EPixelType        aeTypes[] = { PIXEL_UINT16, PIXEL_FLOAT };
+    vector<unsigned char>   pixels;
+    bool                    bPassed = true;
+
+    Fill_Test_Card(pixels, c_size);
+
+    for (size_t t = 0; t < sizeof(aeTypes) / sizeof(aeTypes[0]); t++)
+        for (int bShare = 0; bShare < 2; bShare++)
+        {
+            TargaImage  original(c_size, c_size, &pixels[0]), twin(original), twice(original);
+
+            original.Set_Pixel_Type(aeTypes[t]);
+            twin.Set_Pixel_Type(aeTypes[t]);
+            twice.Set_Pixel_Type(aeTypes[t]);
+            original.Filter_Gaussian();
+            twin.Filter_Gaussian();
+            twice.Filter_Gaussian();
+
+            TargaImage  copy = bShare ? original.Share() : TargaImage(original);
+
+            copy.Filter_Gaussian();
+            twice.Filter_Gaussian();
+            original.Filter_Bartlett();
+            twin.Filter_Bartlett();
+
+            bool    bOriginal = Same_Pixels(original, twin);
+            bool    bCopy = Same_Pixels(copy, twice);
+
+            printf("%s %s: original %s, %s %s\n", aeTypes[t] == PIXEL_FLOAT ? "float" : "uint16", bShare ? "share" : "copy",
+                   bOriginal ? "unchanged" : "CHANGED", bShare ? "share" : "copy", bCopy ? "matches" : "DIFFERS");
+            bPassed = bPassed && bOriginal && bCopy;
+        }// for
+
+    return bPassed;
+}// Check_Copy_Planes
+
+
 ///////////////////////////////////////////////////////////////////////////////
 //
 //      Argument processing callback. Does nothing at this point.
@@ -99,18 +463,47 @@ int main(int argc, char *argv[])
     // check command line arguments
     TargaImage* pImage = NULL;
     bool bHeadless = false;
+    int nThreads = 0;
 
     for (int i = script_arg; i < argc; ++i)
     {
         if (!strcmp(argv[i], c_sNames))                                 // display names
             DisplayNames();
+        else if (!strcmp(argv[i], c_sKernels) && i + 1 < argc)          // choose kernels
+        {
+            if (!SKernels::Select(argv[++i]))
+                return 1;
+        }// else if
+        else if (!strcmp(argv[i], c_sVerifyKernels))                    // test kernels
+            return SKernels::Verify() ? 0 : 1;
+        else if (!strcmp(argv[i], c_sThreads) && i + 1 < argc)          // size the thread pool
+        {
+            nThreads = atoi(argv[++i]);
+            CThreadPool::Set_Thread_Count(nThreads);
+        }// else if
+        else if (!strcmp(argv[i], c_sBenchThreads))                     // measure scaling with threads
+        {
+            Benchmark_Threads(nThreads);
+            return 0;
+        }// else if
+        else if (!strcmp(argv[i], c_sBenchGaussian))                    // measure Filter_Gaussian_N
+        {
+            Benchmark_Gaussian_N();
+            return 0;
+        }// else if
+        else if (!strcmp(argv[i], c_sBenchLoad) && i + 1 < argc)        // measure Load_Image
+            return Benchmark_Load(argv[++i]) ? 0 : 1;
+        else if (!strcmp(argv[i], c_sStressStride))                     // check strides past 2^31
+            return Stress_Large_Stride() ? 0 : 1;
+        else if (!strcmp(argv[i], c_sCheckCopy))                        // check copies between filters
+            return Check_Copy_Planes() ? 0 : 1;
         else if (!bHeadless && !strcmp(argv[i], c_sHeadless))           // go headless
             bHeadless = true;
         else if (bHeadless && strcmp(argv[i], c_sHeadless))             // run script file
             CScriptHandler::HandleScriptFile(argv[i], pImage);
         else
         {
-            cerr << "Usage:" << endl << "Project1 [-names] [-headless scriptFilenames . . .]" << endl;
+            cerr << "Usage:" << endl << "Project1 [-names] [-kernels scalar|sse2|avx2|avx512] [-verify-kernels] [-threads N] [-bench-threads] [-bench-gaussian] [-bench-load file] [-stress-stride] [-check-copy] [-headless scriptFilenames . . .]" << endl;
             return 0;
         }// else
     }// for
@@ -0,0 +1,304 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+//      PlanarBuffer.cpp
+//
+//      Implementation of CPlanarBuffer.  Buffers of unsigned char, 
+//  unsigned short, int and float are instantiated at the bottom of this
+//  file.  unsigned short planes hold 8.8 fixed point, so bytes are shifted
+//  up by 8 going in and back down coming out.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#include "PlanarBuffer.h"
+#include "ScratchArena.h"
+#include <string.h>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define PLANAR_USE_SSE2
+#include <emmintrin.h>
+#endif
+
+// constants
+const size_t    c_rowAlignment  = 64;       // bytes, one cache line
+
+
+// per type conversion of a channel byte to a plane element and back
+template<class T> static inline T From_Byte(unsigned char v)    { return (T)v; }
+template<class T> static inline int To_Byte(T v)                { return (int)v; }
+template<> inline unsigned short From_Byte(unsigned char v)     { return (unsigned short)(v << 8); }
+template<> inline int To_Byte(unsigned short v)                 { return v >> 8; }
+
+
+#ifdef PLANAR_USE_SSE2
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Split four RGBA pixels into 32 bit red, green and blue lanes.
+//
+///////////////////////////////////////////////////////////////////////////////
+static inline void Split_Pixels(const unsigned char* rgba, __m128i& r, __m128i& g, __m128i& b)
+{
+    const __m128i   low = _mm_set1_epi32(0xFF);
+    __m128i         v = _mm_loadu_si128((const __m128i*)rgba);
+
+    r = _mm_and_si128(v, low);
+    g = _mm_and_si128(_mm_srli_epi32(v, 8), low);
+    b = _mm_and_si128(_mm_srli_epi32(v, 16), low);
+}// Split_Pixels
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Merge the low bytes of 32 bit red, green and blue lanes into four
+//  RGBA pixels, keeping their alpha.
+//
+///////////////////////////////////////////////////////////////////////////////
+static inline void Merge_Pixels(unsigned char* rgba, __m128i r, __m128i g, __m128i b)
+{
+    const __m128i   low = _mm_set1_epi32(0xFF);
+    const __m128i   alpha = _mm_set1_epi32((int)0xFF000000);
+    __m128i         v = _mm_and_si128(_mm_loadu_si128((const __m128i*)rgba), alpha);
+
+    v = _mm_or_si128(v, _mm_and_si128(r, low));
+    v = _mm_or_si128(v, _mm_slli_epi32(_mm_and_si128(g, low), 8));
+    v = _mm_or_si128(v, _mm_slli_epi32(_mm_and_si128(b, low), 16));
+    _mm_storeu_si128((__m128i*)rgba, v);
+}// Merge_Pixels
+
+
+// per type loads and stores of four lanes, the planes are 16 byte aligned
+// wherever x is a multiple of four
+static inline void Store_Lanes(int* p, __m128i v)          { _mm_store_si128((__m128i*)p, v); }
+static inline void Store_Lanes(float* p, __m128i v)        { _mm_store_ps(p, _mm_cvtepi32_ps(v)); }
+static inline __m128i Load_Lanes(const int* p)             { return _mm_load_si128((const __m128i*)p); }
+static inline __m128i Load_Lanes(const float* p)           { return _mm_cvttps_epi32(_mm_load_ps(p)); }
+
+// 8.8 fixed point, the lanes are always bytes so the pack can't saturate
+static inline void Store_Lanes(unsigned short* p, __m128i v)
+{
+    _mm_storel_epi64((__m128i*)p, _mm_slli_epi16(_mm_packs_epi32(v, v), 8));
+}// Store_Lanes
+
+static inline __m128i Load_Lanes(const unsigned short* p)
+{
+    return _mm_unpacklo_epi16(_mm_srli_epi16(_mm_loadl_epi64((const __m128i*)p), 8), _mm_setzero_si128());
+}// Load_Lanes
+
+// bytes are only four aligned, so they go through an int
+static inline void Store_Lanes(unsigned char* p, __m128i v)
+{
+    int bytes;
+
+    v = _mm_packs_epi32(v, v);
+    bytes = _mm_cvtsi128_si32(_mm_packus_epi16(v, v));
+    memcpy(p, &bytes, 4);
+}// Store_Lanes
+
+static inline __m128i Load_Lanes(const unsigned char* p)
+{
+    const __m128i   zero = _mm_setzero_si128();
+    int             bytes;
+
+    memcpy(&bytes, p, 4);
+    return _mm_unpacklo_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128(bytes), zero), zero);
+}// Load_Lanes
+#endif
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Constructor.  The buffer starts out empty.
+//
+///////////////////////////////////////////////////////////////////////////////
+template<class T> CPlanarBuffer<T>::CPlanarBuffer()
+    : m_pArena(NULL), m_pStorage(NULL), m_capacity(0), m_pPlanes(NULL), m_planeSize(0), m_width(0), m_height(0), m_stride(0),
+      m_channels(0), m_border(0)
+{}// CPlanarBuffer
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Constructor.  The buffer starts out empty and any storage it needs 
+//  is taken from arena, so it must not outlive the arena's next reset.
+//
+///////////////////////////////////////////////////////////////////////////////
+template<class T> CPlanarBuffer<T>::CPlanarBuffer(CScratchArena& arena)
+    : m_pArena(&arena), m_pStorage(NULL), m_capacity(0), m_pPlanes(NULL), m_planeSize(0), m_width(0), m_height(0), m_stride(0),
+      m_channels(0), m_border(0)
+{}// CPlanarBuffer
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Destructor.  Free the planes, unless the arena owns them.
+//
+///////////////////////////////////////////////////////////////////////////////
+template<class T> CPlanarBuffer<T>::~CPlanarBuffer()
+{
+    if (!m_pArena)
+        delete[] m_pStorage;
+}// ~CPlanarBuffer
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Lay out channels planes of w x h with a border, growing the storage
+//  if needed.  The left border is padded out to a whole cache line so 
+//  pixel 0 of every row stays aligned.  The contents are undefined 
+//  afterwards.
+//
+///////////////////////////////////////////////////////////////////////////////
+template<class T> void CPlanarBuffer<T>::Resize(int w, int h, int channels, int border)
+{
+    const size_t    perLine = c_rowAlignment / sizeof(T);
+    size_t          lead = (border + perLine - 1) / perLine * perLine;
+    size_t          needed;
+
+    m_width = w;
+    m_height = h;
+    m_channels = channels;
+    m_border = border;
+    m_stride = (int)((lead + w + border + perLine - 1) / perLine * perLine);
+    m_planeSize = (size_t)m_stride * (h + 2 * border);
+    needed = m_planeSize * channels * sizeof(T);
+
+    if (needed > m_capacity)
+    {
+        if (m_pArena)
+            m_pStorage = (unsigned char*)m_pArena->Allocate(needed + c_rowAlignment - 1);
+        else
+        {
+            delete[] m_pStorage;
+            m_pStorage = new unsigned char[needed + c_rowAlignment - 1];
+        }// else
+        m_capacity = needed;
+    }// if
+
+    m_pPlanes = (T*)(((size_t)m_pStorage + c_rowAlignment - 1) & ~(c_rowAlignment - 1));
+    m_pPlanes += (size_t)border * m_stride + lead;
+}// Resize
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Copy the color channels of RGBA data into the first three planes.
+//
+///////////////////////////////////////////////////////////////////////////////
+template<class T> void CPlanarBuffer<T>::Deinterleave(const unsigned char* rgba, size_t rgbaStride, int w, int h, int border)
+{
+    Resize(w, h, 3, border);
+
+    for (int y = 0; y < h; y++)
+    {
+        const unsigned char*    src = rgba + y * rgbaStride;
+        T*                      r = Row(0, y);
+        T*                      g = Row(1, y);
+        T*                      b = Row(2, y);
+        int                     x = 0;
+
+#ifdef PLANAR_USE_SSE2
+        for (; x + 4 <= w; x += 4, src += 16)
+        {
+            __m128i vr, vg, vb;
+            Split_Pixels(src, vr, vg, vb);
+            Store_Lanes(r + x, vr);
+            Store_Lanes(g + x, vg);
+            Store_Lanes(b + x, vb);
+        }// for
+#endif
+
+        for (; x < w; x++, src += 4)
+        {
+            r[x] = From_Byte<T>(src[0]);
+            g[x] = From_Byte<T>(src[1]);
+            b[x] = From_Byte<T>(src[2]);
+        }// for
+    }// for
+}// Deinterleave
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Copy the first three planes back into the color channels of RGBA
+//  data, keeping its alpha.
+//
+///////////////////////////////////////////////////////////////////////////////
+template<class T> void CPlanarBuffer<T>::Interleave(unsigned char* rgba, size_t rgbaStride) const
+{
+    for (int y = 0; y < m_height; y++)
+    {
+        unsigned char*  dst = rgba + y * rgbaStride;
+        const T*        r = Row(0, y);
+        const T*        g = Row(1, y);
+        const T*        b = Row(2, y);
+        int             x = 0;
+
+#ifdef PLANAR_USE_SSE2
+        for (; x + 4 <= m_width; x += 4, dst += 16)
+            Merge_Pixels(dst, Load_Lanes(r + x), Load_Lanes(g + x), Load_Lanes(b + x));
+#endif
+
+        for (; x < m_width; x++, dst += 4)
+        {
+            dst[0] = To_Byte(r[x]);
+            dst[1] = To_Byte(g[x]);
+            dst[2] = To_Byte(b[x]);
+        }// for
+    }// for
+}// Interleave
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Fill the border of every plane: the sides of each row first, then
+//  whole rows, sides included, above and below.
+//
+///////////////////////////////////////////////////////////////////////////////
+template<class T> void CPlanarBuffer<T>::Fill_Border(EBorderMode mode)
+{
+    const int   span = m_width + 2 * m_border;
+
+    if (!m_border)
+        return;
+
+    for (int c = 0; c < m_channels; c++)
+    {
+        for (int y = 0; y < m_height; y++)
+        {
+            T* row = Row(c, y);
+
+            for (int x = 1; x <= m_border; x++)
+            {
+                row[-x] = row[Border_Source(-x, m_width, mode)];
+                row[m_width - 1 + x] = row[Border_Source(m_width - 1 + x, m_width, mode)];
+            }// for
+        }// for
+
+        for (int y = 1; y <= m_border; y++)
+        {
+            memcpy(Row(c, -y) - m_border, Row(c, Border_Source(-y, m_height, mode)) - m_border, span * sizeof(T));
+            memcpy(Row(c, m_height - 1 + y) - m_border, Row(c, Border_Source(m_height - 1 + y, m_height, mode)) - m_border, 
+                   span * sizeof(T));
+        }// for
+    }// for
+}// Fill_Border
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Copy the planes of another buffer, giving them a new border.
+//
+///////////////////////////////////////////////////////////////////////////////
+template<class T> void CPlanarBuffer<T>::Copy(const CPlanarBuffer& src, int border)
+{
+    Resize(src.m_width, src.m_height, src.m_channels, border);
+
+    for (int c = 0; c < m_channels; c++)
+        for (int y = 0; y < m_height; y++)
+            memcpy(Row(c, y), src.Row(c, y), m_width * sizeof(T));
+}// Copy
+
+
+template class CPlanarBuffer<unsigned char>;
+template class CPlanarBuffer<unsigned short>;
+template class CPlanarBuffer<int>;
+template class CPlanarBuffer<float>;
@@ -0,0 +1,122 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+//      PlanarBuffer.h
+//
+//      Planar (one array per channel) working storage for image operations.
+//  Each channel is a width x height plane whose rows start on a 64 byte
+//  boundary, Stride() elements apart.  Deinterleave and Interleave move the
+//  color channels between a plane set and TargaImage's RGBA data.  Planes
+//  may have a border of made up pixels around them, so that filters can
+//  read past the edges without checking.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef _PLANAR_BUFFER_H_
+#define _PLANAR_BUFFER_H_
+
+#include <stddef.h>
+
+class CScratchArena;
+
+// how pixels past the edge of an image are made up
+enum EBorderMode
+{
+    BORDER_CLAMP,       // copies of the nearest edge pixel
+    BORDER_MIRROR,      // the image reflected about its edge pixels
+    BORDER_WRAP         // the image repeated
+};
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      The index in [0, n) that index i, which may be past either end, 
+//  takes its value from.
+//
+///////////////////////////////////////////////////////////////////////////////
+inline int Border_Source(int i, int n, EBorderMode mode)
+{
+    int period;
+
+    if (i >= 0 && i < n)
+        return i;
+
+    switch (mode)
+    {
+        case BORDER_MIRROR:
+            if (n == 1)
+                return 0;
+            period = 2 * (n - 1);
+            i %= period;
+            if (i < 0)
+                i += period;
+            return i < n ? i : period - i;
+        case BORDER_WRAP:
+            i %= n;
+            return i < 0 ? i + n : i;
+        default:
+            return i < 0 ? 0 : n - 1;
+    }// switch
+}// Border_Source
+
+template<class T> class CPlanarBuffer
+{
+    // methods
+    public:
+        CPlanarBuffer(void);
+        explicit CPlanarBuffer(CScratchArena& arena);  // take storage from the arena instead of the heap
+        ~CPlanarBuffer(void);
+
+        // Make room for channels planes of w x h, with border pixels 
+        // beyond every edge.  Storage only ever grows, so a buffer that is
+        // reused costs nothing after the first time.
+        void Resize(int w, int h, int channels = 3, int border = 0);
+
+        int Width(void) const       { return m_width; }
+        int Height(void) const      { return m_height; }
+        int Stride(void) const      { return m_stride; }
+        int Border(void) const      { return m_border; }
+
+        // Pixel (0, 0) of a plane and of a row, which stays 64 byte aligned
+        // whatever the border.  x and y may go Border() past either edge.
+        T*          Plane(int c)                { return m_pPlanes + (size_t)c * m_planeSize; }
+        const T*    Plane(int c) const          { return m_pPlanes + (size_t)c * m_planeSize; }
+        T*          Row(int c, int y)           { return Plane(c) + (ptrdiff_t)y * m_stride; }
+        const T*    Row(int c, int y) const     { return Plane(c) + (ptrdiff_t)y * m_stride; }
+
+        // Copy the red, green and blue bytes of w x h RGBA pixels, whose
+        // rows are rgbaStride bytes apart, into planes 0, 1 and 2, resizing
+        // to fit with the given border.  The border is left for Fill_Border.
+        void Deinterleave(const unsigned char* rgba, size_t rgbaStride, int w, int h, int border = 0);
+
+        // Make up the border of every plane from its pixels.
+        void Fill_Border(EBorderMode mode);
+
+        // Lay out like src but with the given border, and copy src's pixels,
+        // not its border, across.
+        void Copy(const CPlanarBuffer& src, int border);
+
+        // Store planes 0, 1 and 2 back into the red, green and blue bytes of
+        // RGBA pixels the size of this buffer, leaving alpha alone.  Values
+        // are converted as an assignment from int would, after unsigned 
+        // short's are shifted down by 8.
+        void Interleave(unsigned char* rgba, size_t rgbaStride) const;
+
+    private:
+        CPlanarBuffer(const CPlanarBuffer&);
+        CPlanarBuffer& operator=(const CPlanarBuffer&);
+
+    // members
+    private:
+        CScratchArena*  m_pArena;       // where storage comes from, NULL for the heap
+        unsigned char*  m_pStorage;     // allocation the planes live in
+        size_t          m_capacity;     // bytes usable after aligning m_pStorage
+        T*              m_pPlanes;      // first plane, 64 byte aligned
+        size_t          m_planeSize;    // elements from one plane to the next
+        int             m_width;
+        int             m_height;
+        int             m_stride;       // elements from one row to the next
+        int             m_channels;     // planes laid out by the last Resize
+        int             m_border;       // pixels beyond every edge
+};// CPlanarBuffer
+
+#endif // _PLANAR_BUFFER_H_
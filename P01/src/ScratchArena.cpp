@@ -0,0 +1,119 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+//      ScratchArena.cpp
+//
+//      Implementation of CScratchArena.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#include "ScratchArena.h"
+
+// constants
+const size_t    c_arenaAlignment    = 64;               // bytes, one cache line
+const size_t    c_minBlockSize      = 1 << 20;          // smallest block taken from the heap
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Constructor.  The arena takes no memory until it is first used.
+//
+///////////////////////////////////////////////////////////////////////////////
+CScratchArena::CScratchArena() : m_used(0), m_inUse(0), m_peak(0), m_total(0), m_reserved(0)
+{}// CScratchArena
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Destructor.  Give the blocks back to the heap.
+//
+///////////////////////////////////////////////////////////////////////////////
+CScratchArena::~CScratchArena()
+{
+    for (size_t i = 0; i < m_blocks.size(); ++i)
+        delete[] m_blocks[i].pStorage;
+}// ~CScratchArena
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Return the arena of the calling thread.
+//
+///////////////////////////////////////////////////////////////////////////////
+CScratchArena& CScratchArena::Thread()
+{
+    static thread_local CScratchArena arena;
+    return arena;
+}// Thread
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Hand out bytes of aligned storage, starting a new block when the
+//  current one is full.
+//
+///////////////////////////////////////////////////////////////////////////////
+void* CScratchArena::Allocate(size_t bytes)
+{
+    bytes = (bytes + c_arenaAlignment - 1) & ~(c_arenaAlignment - 1);
+
+    if (m_blocks.empty() || m_used + bytes > m_blocks.back().size)
+    {
+        size_t size = m_blocks.empty() ? c_minBlockSize : m_blocks.back().size * 2;
+        Add_Block(size < bytes ? bytes : size);
+    }// if
+
+    void* result = m_blocks.back().pBase + m_used;
+    m_used += bytes;
+    m_inUse += bytes;
+    m_total += bytes;
+    if (m_inUse > m_peak)
+        m_peak = m_inUse;
+
+    return result;
+}// Allocate
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Release everything handed out.  If more than one block was needed
+//  they are replaced by a single block as large as all of them together,
+//  so the same work fits without growing next time.
+//
+///////////////////////////////////////////////////////////////////////////////
+void CScratchArena::Reset()
+{
+    if (m_blocks.size() > 1)
+    {
+        size_t size = m_reserved;
+
+        for (size_t i = 0; i < m_blocks.size(); ++i)
+            delete[] m_blocks[i].pStorage;
+        m_blocks.clear();
+        m_reserved = 0;
+
+        Add_Block(size);
+    }// if
+
+    m_used = 0;
+    m_inUse = 0;
+}// Reset
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Take a block of at least size usable bytes from the heap and make it
+//  the one being carved.
+//
+///////////////////////////////////////////////////////////////////////////////
+void CScratchArena::Add_Block(size_t size)
+{
+    SBlock block;
+
+    block.pStorage = new unsigned char[size + c_arenaAlignment - 1];
+    block.pBase = (unsigned char*)(((size_t)block.pStorage + c_arenaAlignment - 1) & ~(c_arenaAlignment - 1));
+    block.size = size;
+
+    m_blocks.push_back(block);
+    m_used = 0;
+    m_reserved += size;
+}// Add_Block
@@ -0,0 +1,67 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+//      ScratchArena.h
+//
+//      Per-thread scratch memory for the temporaries of image operations.
+//  Allocations are carved out of large blocks and are all released at once
+//  by Reset, which the script handler calls after every command.  After a
+//  reset the blocks are kept, merged into one if the last command needed
+//  several, so a script that repeats its commands stops touching the heap.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef _SCRATCH_ARENA_H_
+#define _SCRATCH_ARENA_H_
+
+#include <stddef.h>
+#include <vector>
+
+class CScratchArena
+{
+    // methods
+    public:
+        ~CScratchArena(void);
+
+        // The calling thread's arena.
+        static CScratchArena& Thread(void);
+
+        // Uninitialized, 64 byte aligned storage that stays valid until the
+        // next Reset.  Only use it for types that need no destructor.
+        void* Allocate(size_t bytes);
+        template<class T> T* Allocate_Array(size_t count)
+        {
+            return static_cast<T*>(Allocate(count * sizeof(T)));
+        }// Allocate_Array
+
+        // Release everything handed out since the last reset.
+        void Reset(void);
+
+        size_t Peak_Bytes(void) const       { return m_peak; }      // most bytes in use between two resets
+        size_t Total_Bytes(void) const      { return m_total; }     // bytes handed out over the arena's life
+        size_t Reserved_Bytes(void) const   { return m_reserved; }  // bytes currently held from the heap
+
+    private:
+        CScratchArena(void);
+        CScratchArena(const CScratchArena&);
+        CScratchArena& operator=(const CScratchArena&);
+
+        void Add_Block(size_t size);
+
+    // members
+    private:
+        struct SBlock
+        {
+            unsigned char*  pStorage;   // as returned by new
+            unsigned char*  pBase;      // pStorage rounded up to the alignment
+            size_t          size;       // usable bytes from pBase
+        };// SBlock
+
+        std::vector<SBlock>     m_blocks;       // the last block is the one being carved
+        size_t                  m_used;         // bytes carved from the last block
+        size_t                  m_inUse;        // bytes handed out since the last reset
+        size_t                  m_peak;
+        size_t                  m_total;
+        size_t                  m_reserved;
+};// CScratchArena
+
+#endif // _SCRATCH_ARENA_H_
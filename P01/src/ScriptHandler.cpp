@@ -14,7 +14,11 @@
 #include <iostream>
 #include <fstream>
 #include <string.h>
+#include <stdlib.h>
+#include <limits.h>
 #include "TargaImage.h"
+#include "ImageCache.h"
+#include "ScratchArena.h"
 
 using namespace std;
 
@@ -35,6 +39,7 @@ const char      c_asCommands[][32]      = { "load",                     // valid
                                             "dither-pattern",
                                             "dither-color",
                                             "filter-box",
+                                            "filter-box-r",
                                             "filter-bartlett",
                                             "filter-gauss",
                                             "filter-gauss-n",
@@ -50,7 +55,9 @@ const char      c_asCommands[][32]      = { "load",                     // valid
                                             "comp-atop",
                                             "comp-xor",
                                             "diff",
-                                            "rotate"
+                                            "rotate",
+                                            "cache",
+                                            "pixel-type"
                                           };
 
 enum ECommands          // command ids
@@ -69,6 +76,7 @@ enum ECommands          // command ids
     DITHER_PATTERN,
     DITHER_COLOR,
     FILTER_BOX,
+    FILTER_BOX_R,
     FILTER_BARTLETT,
     FILTER_GAUSS,
     FILTER_GAUSS_N,
@@ -85,9 +93,47 @@ enum ECommands          // command ids
     COMP_XOR,
     DIFF,
     ROTATE,
+    CACHE,
+    PIXEL_TYPE,
     NUM_COMMANDS
 };// ECommands
 
+const char      c_asBorderModes[][8]    = { "clamp", "mirror", "wrap" };  // EBorderMode names
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Read the optional border mode that may end a filter or resampling
+//  command and give it to the image for that command alone: a command 
+//  without one runs clamped, whatever an earlier command named.  If the 
+//  word isn't a mode, print usage and return false.
+//
+///////////////////////////////////////////////////////////////////////////////
+static bool Parse_Border_Mode(TargaImage* pImage, const char* sUsage)
+{
+    char*   sMode = strtok(NULL, c_sWhiteSpace);
+    int     mode;
+
+    if (!sMode)
+    {
+        pImage->Set_Border_Mode(BORDER_CLAMP);
+        return true;
+    }// if
+
+    for (mode = BORDER_CLAMP; mode <= BORDER_WRAP; ++mode)
+        if (!strcmp(sMode, c_asBorderModes[mode]))
+            break;
+
+    if (mode > BORDER_WRAP)
+    {
+        cout << "Usage:  " << sUsage << " [clamp|mirror|wrap]" << endl;
+        return false;
+    }// if
+
+    pImage->Set_Border_Mode((EBorderMode)mode);
+    return true;
+}// Parse_Border_Mode
+
 
 ///////////////////////////////////////////////////////////////////////////////
 //
@@ -112,7 +158,7 @@ bool CScriptHandler::HandleCommand(const char* sCommand, TargaImage*& pImage)
             break;
 
     // if there's no image only a subset of commands are valid
-    if (!pImage && command != LOAD && command != RUN && command != NUM_COMMANDS)
+    if (!pImage && command != LOAD && command != RUN && command != CACHE && command != NUM_COMMANDS)
     {
         cout << "No image to operate on.  Use \"load\" command to load image." << endl;
         return false;
@@ -149,8 +195,14 @@ bool CScriptHandler::HandleCommand(const char* sCommand, TargaImage*& pImage)
             if (!sFilename)
                 cout << "No filename given." << endl;
 
-            bParsed = sFilename != NULL;
-            bResult =  bParsed && pImage->Save_Image(sFilename);
+            // optional "rle" after the filename selects run-length encoding
+            char* sEncoding = sFilename ? strtok(NULL, c_sWhiteSpace) : NULL;
+            bool bRLE = sEncoding && !strcmp(sEncoding, "rle");
+            if (sEncoding && !bRLE)
+                cout << "Unknown encoding:  " << sEncoding << endl;
+
+            bParsed = sFilename != NULL && (!sEncoding || bRLE);
+            bResult =  bParsed && pImage->Save_Image(sFilename, bRLE);
             break;
         }// SAVE
 
@@ -216,18 +268,58 @@ bool CScriptHandler::HandleCommand(const char* sCommand, TargaImage*& pImage)
 
         case FILTER_BOX:
         {
+            if (!Parse_Border_Mode(pImage, "filter-box"))
+            {
+                bResult = bParsed = false;
+                break;
+            }// if
+
             bResult = pImage->Filter_Box();
             break;
         }// DITHER_BOX
 
+        case FILTER_BOX_R:
+        {
+            char    *sRadius = strtok(NULL, c_sWhiteSpace);
+            long    radius = sRadius ? strtol(sRadius, NULL, 10) : -1;
+
+            // Filter_Box_R says if a radius that fits is too big
+            if (radius < 0 || radius > INT_MAX)
+            {
+                cout << "Usage:  filter-box-r <radius> [clamp|mirror|wrap]" << endl;
+                bResult = bParsed = false;
+                break;
+            }// if
+            if (!Parse_Border_Mode(pImage, "filter-box-r <radius>"))
+            {
+                bResult = bParsed = false;
+                break;
+            }// if
+
+            bResult = pImage->Filter_Box_R((int)radius);
+            break;
+        }// FILTER_BOX_R
+
         case FILTER_BARTLETT:
         {
+            if (!Parse_Border_Mode(pImage, "filter-bartlett"))
+            {
+                bResult = bParsed = false;
+                break;
+            }// if
+
             bResult = pImage->Filter_Bartlett();
             break;
         }// DITHER_BARTLETT
 
         case FILTER_GAUSS:
         {
+            if (!Parse_Border_Mode(pImage, "filter-gauss"))
+            {
+                bResult = bParsed = false;
+                break;
+            }// if
+
             bResult = pImage->Filter_Gaussian();
             break;
         }// FILTER_GUASS
@@ -240,6 +332,12 @@ bool CScriptHandler::HandleCommand(const char* sCommand, TargaImage*& pImage)
                cout << "N \"" << N << "\" is not allowed; N must be an odd number." << endl;
                break;
             }
+            if (!Parse_Border_Mode(pImage, "filter-gauss-n N"))
+            {
+                bResult = bParsed = false;
+                break;
+            }// if
+
             bResult = pImage->Filter_Gaussian_N(N);
             break;
         }// FILTER_GUASS_N
@@ -265,12 +363,24 @@ bool CScriptHandler::HandleCommand(const char* sCommand, TargaImage*& pImage)
 
         case HALF:
         {
+            if (!Parse_Border_Mode(pImage, "half"))
+            {
+                bResult = bParsed = false;
+                break;
+            }// if
+
             bResult = pImage->Half_Size();
             break;
         }// HALF
 
         case DOUBLE:
         {
+            if (!Parse_Border_Mode(pImage, "double"))
+            {
+                bResult = bParsed = false;
+                break;
+            }// if
+
             bResult = pImage->Double_Size();
             break;
         }// DOUBLE
@@ -293,7 +403,7 @@ bool CScriptHandler::HandleCommand(const char* sCommand, TargaImage*& pImage)
         case COMP_OVER:
         {
             char* sFilename = strtok(NULL, c_sWhiteSpace);
-            TargaImage* pNewImage = TargaImage::Load_Image(sFilename);
+            TargaImage* pNewImage = TargaImage::Open_Image(sFilename);
             if (!pNewImage)
             {
                 if (sFilename)
@@ -310,7 +420,7 @@ bool CScriptHandler::HandleCommand(const char* sCommand, TargaImage*& pImage)
         case COMP_IN:
         {
             char* sFilename = strtok(NULL, c_sWhiteSpace);
-            TargaImage* pNewImage = TargaImage::Load_Image(sFilename);
+            TargaImage* pNewImage = TargaImage::Open_Image(sFilename);
             if (!pNewImage)
             {
                 if (sFilename)
@@ -328,7 +438,7 @@ bool CScriptHandler::HandleCommand(const char* sCommand, TargaImage*& pImage)
         case COMP_OUT:
         {
             char* sFilename = strtok(NULL, c_sWhiteSpace);
-            TargaImage* pNewImage = TargaImage::Load_Image(sFilename);
+            TargaImage* pNewImage = TargaImage::Open_Image(sFilename);
             if (!pNewImage)
             {
                 if (sFilename)
@@ -346,7 +456,7 @@ bool CScriptHandler::HandleCommand(const char* sCommand, TargaImage*& pImage)
         case COMP_ATOP:
         {
             char* sFilename = strtok(NULL, c_sWhiteSpace);
-            TargaImage* pNewImage = TargaImage::Load_Image(sFilename);
+            TargaImage* pNewImage = TargaImage::Open_Image(sFilename);
             if (!pNewImage)
             {
                 if (sFilename)
@@ -364,7 +474,7 @@ bool CScriptHandler::HandleCommand(const char* sCommand, TargaImage*& pImage)
         case COMP_XOR:
         {
             char* sFilename = strtok(NULL, c_sWhiteSpace);
-            TargaImage* pNewImage = TargaImage::Load_Image(sFilename);
+            TargaImage* pNewImage = TargaImage::Open_Image(sFilename);
             if (!pNewImage)
             {
                 if (sFilename)
@@ -382,7 +492,7 @@ bool CScriptHandler::HandleCommand(const char* sCommand, TargaImage*& pImage)
         case DIFF:
         {
             char* sFilename = strtok(NULL, c_sWhiteSpace);
-            TargaImage* pNewImage = TargaImage::Load_Image(sFilename);
+            TargaImage* pNewImage = TargaImage::Open_Image(sFilename);
             if (!pNewImage)
             {
                 if (sFilename)
@@ -414,6 +524,52 @@ bool CScriptHandler::HandleCommand(const char* sCommand, TargaImage*& pImage)
             break;
         }// ROTATE
 
+        case CACHE:
+        {
+            // convert a targa to a cache file without touching the current image
+            char* sSource = strtok(NULL, c_sWhiteSpace);
+            char* sCache = sSource ? strtok(NULL, c_sWhiteSpace) : NULL;
+            if (!sCache || !CImageCache::Is_Cache_File(sCache))
+            {
+                cout << "Usage:  cache <targa file> <cache file ending in " << c_sCacheExtension << ">" << endl;
+                bResult = bParsed = false;
+                break;
+            }// if
+
+            TargaImage* pNewImage = TargaImage::Load_Image(sSource);
+            if (!pNewImage)
+            {
+                cout << "Unable to load image:  " << sSource << endl;
+                bParsed = false;
+            }// if
+            bResult = pNewImage && pNewImage->Save_Image(sCache);
+            delete pNewImage;
+            break;
+        }// CACHE
+
+        case PIXEL_TYPE:
+        {
+            // what the filters that follow keep their results in
+            const char  asTypes[][8] = { "uint8", "uint16", "float" };
+            char*       sType = strtok(NULL, c_sWhiteSpace);
+            int         type;
+
+            for (type = PIXEL_UINT8; type <= PIXEL_FLOAT; ++type)
+                if (sType && !strcmp(sType, asTypes[type]))
+                    break;
+
+            if (type > PIXEL_FLOAT)
+            {
+                cout << "Usage:  pixel-type <uint8|uint16|float>" << endl;
+                bResult = bParsed = false;
+                break;
+            }// if
+
+            pImage->Set_Pixel_Type((EPixelType)type);
+            bResult = true;
+            break;
+        }// PIXEL_TYPE
+
         default:
         {
             cout << "Unable to parse command:  " << sCommand << endl;
@@ -424,6 +580,9 @@ bool CScriptHandler::HandleCommand(const char* sCommand, TargaImage*& pImage)
 
     delete[] sCommandLine;
 
+    // nothing an operation took from the scratch arena outlives the command
+    CScratchArena::Thread().Reset();
+
     return bParsed;
 }// HandleCommand
 
@@ -11,15 +11,26 @@
 
 #include "Globals.h"
 #include "TargaImage.h"
+#include "ImageCache.h"
+#include "PlanarBuffer.h"
+#include "ScratchArena.h"
+#include "Kernels.h"
+#include "FilterKernel.h"
+#include "ThreadPool.h"
 #include "libtarga.h"
 #include <stdlib.h>
 #include <assert.h>
 #include <memory.h>
+#include <string.h>
 #include <math.h>
 #include <iostream>
 #include <sstream>
 #include <vector>
 #include <algorithm>
+#include <limits>
+#include <complex>
+#include <atomic>
+#include <utility>
 
 using namespace std;
 
@@ -28,6 +39,260 @@ const int           RED             = 0;                // red channel
 const int           GREEN           = 1;                // green channel
 const int           BLUE            = 2;                // blue channel
 const unsigned char BACKGROUND[3]   = { 0, 0, 0 };      // background color
+const size_t        c_rowAlignment  = 64;               // bytes, one cache line
+const int           c_bandPixels    = 16384;            // pixels in a band of rows handed to one thread at a time
+const int           c_filterBorder  = 2;                // pixels filter planes have past every edge, enough for a 5x5 kernel
+const int           c_binomialMaxN  = 61;               // largest N Filter_Gaussian_N uses the binomial kernel for
+const int           c_maxBoxRadius  = 1 << 22;          // largest Filter_Box_R radius, whose box of full 8.8 channels still sums in 64 bits
+const int           c_rowGroup      = 16;               // rows the horizontal pass of the recursive Gaussian does at once
+const int           c_stripColumns  = 64;               // columns its vertical pass does at once
+
+
+// pixels shared by images made with Share.  data of every sharing image
+// points at them, and the last image to let go frees them.
+struct TargaImage::SSharedPixels
+{
+    std::atomic<int>    refs;       // number of images sharing the pixels
+    CImageCache         *cache;     // the cache file the pixels are in, or NULL if they were allocated
+    unsigned char       *storage;   // what new[] returned for the pixels, or NULL if they are in a cache file
+};// SSharedPixels
+
+
+// how filter results are stored in each pixel type.  Max is the value of
+// a full channel.
+template<class T> struct SPixelTraits;
+
+template<> struct SPixelTraits<unsigned char>
+{
+    typedef long long   TSum;       // exact sums of many pixels
+
+    // as the filters always have, through int, so out of range values wrap
+    static unsigned char From_Float(float v)                { return (unsigned char)(int)v; }
+
+    // sum times inverse, the reciprocal of a count, truncated.  Adding a 
+    // half keeps exact multiples from landing a hair low and can't carry
+    // anything else over the next integer.
+    static unsigned char From_Sum(TSum sum, double inverse) { return (unsigned char)(int)((sum + 0.5) * inverse); }
+    static float Max()                                      { return 255.0f; }
+};// SPixelTraits
+
+template<> struct SPixelTraits<unsigned short>
+{
+    typedef long long   TSum;
+
+    // 8.8 fixed point, see CPlanarBuffer
+    static unsigned short From_Float(float v)               { return v <= 0 ? 0 : v >= 65535.0f ? 65535 : (unsigned short)v; }
+    static unsigned short From_Sum(TSum sum, double inverse){ return (unsigned short)(int)((sum + 0.5) * inverse); }
+    static float Max()                                      { return 255.0f * 256.0f; }
+};// SPixelTraits
+
+template<> struct SPixelTraits<float>
+{
+    typedef double      TSum;
+
+    static float From_Float(float v)                        { return v; }
+    static float From_Sum(TSum sum, double inverse)         { return (float)(sum * inverse); }
+    static float Max()                                      { return 255.0f; }
+};// SPixelTraits
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Runner for libtarga's row jobs.  The rows go to the thread pool in 
+//  a few chunks per thread.
+//
+///////////////////////////////////////////////////////////////////////////////
+static void Run_Tga_Jobs(tga_job_fn job, void* arg, int count)
+{
+    CThreadPool&    pool = CThreadPool::Shared();
+    int             grain = count / (pool.Thread_Count() * 4);
+
+    pool.Parallel_For(0, count, grain, [=](int first, int last) { job(arg, first, last); });
+}// Run_Tga_Jobs
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Rows per band when a loop over rows of width pixels is split across
+//  the thread pool, enough for each band to be worth handing out.
+//
+///////////////////////////////////////////////////////////////////////////////
+static int Band_Rows(int width)
+{
+    int rows = c_bandPixels / (width > 0 ? width : 1);
+    return rows > 0 ? rows : 1;
+}// Band_Rows
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Hand Run_Tga_Jobs to libtarga.  The runner is shared library state,
+//  so it is set exactly once, before the first load or save, and never
+//  while another thread may be reading it.
+//
+///////////////////////////////////////////////////////////////////////////////
+static void Install_Tga_Runner()
+{
+    static const bool bInstalled = (tga_set_runner(Run_Tga_Jobs), true);
+    (void)bInstalled;
+}// Install_Tga_Runner
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Filter row y of plane c of src into dst with the fixed point form of
+//  the separable kernel K, using sums, which must have room for the width
+//  plus the taps across, between the passes.  src's border must cover the 
+//  kernel.
+//
+///////////////////////////////////////////////////////////////////////////////
+template<class K> static void Fixed_Row(const CPlanarBuffer<unsigned char>& src, int c, int y, unsigned short* sums, 
+                                        unsigned char* dst)
+{
+    typedef typename K::TDown   TDown;
+    typedef typename K::TAcross TAcross;
+
+    const SKernels& kernels = SKernels::Active();
+
+    kernels.Fixed_V_Row(src.Row(c, y + TDown::first) + TAcross::first, src.Stride(), TDown::fixed, TDown::count, sums, 
+                        src.Width() + TAcross::count - 1);
+    kernels.Fixed_H_Row(sums, TAcross::fixed, TAcross::count, K::multiplier, K::shift, dst, src.Width());
+}// Fixed_Row
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Filter the color planes of src into dst with the fixed point form of
+//  the separable kernel K.
+//
+///////////////////////////////////////////////////////////////////////////////
+template<class K> static void Filter_Fixed(const CPlanarBuffer<unsigned char>& src, CPlanarBuffer<unsigned char>& dst)
+{
+    const int   width = src.Width();
+    const int   height = src.Height();
+
+    CThreadPool::Shared().Parallel_For(0, height * 3, Band_Rows(width), [&](int first, int last)
+    {
+        unsigned short *sums = CScratchArena::Thread().Allocate_Array<unsigned short>(width + K::TAcross::count - 1);
+
+        for (int i = first; i < last; i++)
+            Fixed_Row<K>(src, i / height, i % height, sums, dst.Row(i / height, i % height));
+    });
+}// Filter_Fixed
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Filter the color planes of src into dst with the separable kernel K,
+//  a pass down the columns and one across, every tap of which STaps_Sum 
+//  unrolls.  src's border must cover the kernel.
+//
+///////////////////////////////////////////////////////////////////////////////
+template<class K, class T> static void Filter_Separable_Unrolled(const CPlanarBuffer<T>& src, CPlanarBuffer<T>& dst)
+{
+    typedef typename K::TDown   TDown;
+    typedef typename K::TAcross TAcross;
+
+    const int   width = src.Width();
+    const int   height = src.Height();
+    const int   columns = width + TAcross::count - 1;
+
+    CThreadPool::Shared().Parallel_For(0, height * 3, Band_Rows(width), [&](int first, int last)
+    {
+        float *sums = CScratchArena::Thread().Allocate_Array<float>(columns);
+
+        for (int i = first; i < last; i++)
+        {
+            const T*    top = src.Row(i / height, i % height + TDown::first) + TAcross::first;
+            T*          row = dst.Row(i / height, i % height);
+
+            // down each column the across pass will read
+            for (int x = 0; x < columns; x++)
+                sums[x] = STaps_Sum<TDown>::Add(0.0f, top + x, src.Stride());
+
+            for (int x = 0; x < width; x++)
+                row[x] = SPixelTraits<T>::From_Float(STaps_Sum<TAcross>::Add(0.0f, sums + x, 1) / (float)K::base);
+        }// for
+    });
+}// Filter_Separable_Unrolled
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Filter the color planes of src into dst with a kernel known at 
+//  compile time, every tap of which SKernel_Sum unrolls.  src's border 
+//  must cover the kernel.
+//
+///////////////////////////////////////////////////////////////////////////////
+template<class K, class T> static void Filter_Unrolled(const CPlanarBuffer<T>& src, CPlanarBuffer<T>& dst)
+{
+    const int   width = src.Width();
+    const int   height = src.Height();
+    const float max = SPixelTraits<T>::Max();
+
+    // bands of rows of all three planes are handed out together
+    CThreadPool::Shared().Parallel_For(0, height * 3, Band_Rows(width), [&](int first, int last)
+    {
+        for (int i = first; i < last; i++)
+        {
+            const T*    center = src.Row(i / height, i % height);
+            T*          row = dst.Row(i / height, i % height);
+
+            for (int x = 0; x < width; x++)
+            {
+                float avg = SKernel_Sum<K>::Add(0.0f, center + x, src.Stride());
+
+                row[x] = SPixelTraits<T>::From_Float(avg > max ? max : avg);
+            }// for
+        }// for
+    });
+}// Filter_Unrolled
+
+
+// The kernels Apply_Filter runs as KERNEL_REGISTERED, indexed by 
+// ERegisteredKernel, as instances for each pixel type of their compile
+// time descriptions in FilterKernel.h.  Bytes run the fixed point form;
+// other pixel types run separable kernels a pass at a time and others by
+// Filter_Unrolled.
+enum ERegisteredKernel { REGISTERED_BARTLETT, REGISTERED_GAUSSIAN, REGISTERED_HALF, REGISTERED_COUNT };
+
+struct SRegisteredKernel
+{
+    void    (*pBytes)(const CPlanarBuffer<unsigned char>&, CPlanarBuffer<unsigned char>&);
+    void    (*pShorts)(const CPlanarBuffer<unsigned short>&, CPlanarBuffer<unsigned short>&);
+    void    (*pFloats)(const CPlanarBuffer<float>&, CPlanarBuffer<float>&);
+};// SRegisteredKernel
+
+const SRegisteredKernel c_asRegisteredKernels[] = 
+{
+    { Filter_Fixed<TBartlettKernel>, Filter_Separable_Unrolled<TBartlettKernel, unsigned short>, 
+      Filter_Separable_Unrolled<TBartlettKernel, float> },
+    { Filter_Fixed<TGaussianKernel>, Filter_Separable_Unrolled<TGaussianKernel, unsigned short>, 
+      Filter_Separable_Unrolled<TGaussianKernel, float> },
+    { Filter_Fixed<THalfFixedKernel>, Filter_Unrolled<THalfKernel, unsigned short>, Filter_Unrolled<THalfKernel, float> },
+};
+static_assert(sizeof(c_asRegisteredKernels) / sizeof(c_asRegisteredKernels[0]) == REGISTERED_COUNT, 
+              "c_asRegisteredKernels needs an entry for every ERegisteredKernel");
+
+// the instance of a registered kernel for a pixel type
+static inline void Run_Registered(const SRegisteredKernel& kernel, const CPlanarBuffer<unsigned char>& src, 
+                                  CPlanarBuffer<unsigned char>& dst)
+{
+    kernel.pBytes(src, dst);
+}// Run_Registered
+
+static inline void Run_Registered(const SRegisteredKernel& kernel, const CPlanarBuffer<unsigned short>& src, 
+                                  CPlanarBuffer<unsigned short>& dst)
+{
+    kernel.pShorts(src, dst);
+}// Run_Registered
+
+static inline void Run_Registered(const SRegisteredKernel& kernel, const CPlanarBuffer<float>& src, CPlanarBuffer<float>& dst)
+{
+    kernel.pFloats(src, dst);
+}// Run_Registered
+
+
 
 
 // Computes n choose s, efficiently
@@ -43,12 +308,205 @@ double Binomial(int n, int s)
 }// Binomial
 
 
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Standard deviation of the N tap binomial kernel, which the Gaussian
+//  used for large N matches.
+//
+///////////////////////////////////////////////////////////////////////////////
+static float Gaussian_N_Sigma(int N)
+{
+    return sqrtf((float)(N - 1)) / 2;
+}// Gaussian_N_Sigma
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Pixels of padding the recursive Gaussian runs through either side of
+//  the image, enough for its response to the padding's ends to die out.
+//
+///////////////////////////////////////////////////////////////////////////////
+static int Recursive_Pad(float sigma)
+{
+    return (int)ceilf(4 * sigma) + 3;
+}// Recursive_Pad
+
+
+// Deriche's fourth order recursive Gaussian, "Recursively implementing the
+// Gaussian and its derivatives", 1993.  A line is the sum of a causal pass,
+//      y[j] = n[0] x[j] + ... + n[3] x[j - 3] - d[0] y[j - 1] - ... - d[3] y[j - 4]
+// and an anticausal one,
+//      z[j] = m[0] x[j + 1] + ... + m[3] x[j + 4] - d[0] z[j + 1] - ... - d[3] z[j + 4]
+struct SDeriche
+{
+    float   n[4];
+    float   m[4];
+    float   d[4];
+    float   causalGain;         // what a pass settles to on a flat line of ones
+    float   anticausalGain;
+};// SDeriche
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Work out Deriche's coefficients for sigma.  His fit of the Gaussian
+//  is two damped cosines, which become four complex exponentials; the
+//  causal pass is their sum, multiplied out over a common denominator, and
+//  the anticausal one is its mirror image.  The two gains are scaled to add
+//  up to exactly one.
+//
+///////////////////////////////////////////////////////////////////////////////
+static SDeriche Deriche_Coefficients(float sigma)
+{
+    typedef std::complex<double>    TComplex;
+
+    const double    a0 = 1.680, a1 = 3.735, b0 = 1.783, b1 = 1.723;
+    const double    c0 = -0.6803, c1 = -0.2598, w0 = 0.6318, w1 = 1.997;
+    TComplex        alpha[4], lambda[4];
+    TComplex        denominator[5] = { 1.0, 0.0, 0.0, 0.0, 0.0 };
+    double          n[4] = { 0, 0, 0, 0 }, m[4], d[4];
+    double          sumN = 0, sumM = 0, sumD = 1, scale;
+    SDeriche        k;
+
+    alpha[0] = TComplex(a0, -a1) / 2.0;
+    alpha[1] = conj(alpha[0]);
+    alpha[2] = TComplex(c0, -c1) / 2.0;
+    alpha[3] = conj(alpha[2]);
+    lambda[0] = polar(exp(-b0 / sigma), w0 / sigma);
+    lambda[1] = conj(lambda[0]);
+    lambda[2] = polar(exp(-b1 / sigma), w1 / sigma);
+    lambda[3] = conj(lambda[2]);
+
+    // the product of (1 - lambda z^-1), and for each exponential, alpha 
+    // times the product over the others
+    for (int i = 0; i < 4; i++)
+        for (int j = i + 1; j > 0; j--)
+            denominator[j] -= lambda[i] * denominator[j - 1];
+
+    for (int i = 0; i < 4; i++)
+    {
+        TComplex    numerator[4] = { alpha[i], 0.0, 0.0, 0.0 };
+        int         terms = 1;
+
+        for (int j = 0; j < 4; j++)
+        {
+            if (j == i)
+                continue;
+            for (int t = terms; t > 0; t--)
+                numerator[t] -= lambda[j] * numerator[t - 1];
+            terms++;
+        }// for
+
+        for (int t = 0; t < 4; t++)
+            n[t] += numerator[t].real();
+    }// for
+
+    for (int t = 0; t < 4; t++)
+        d[t] = denominator[t + 1].real();
+    for (int t = 0; t < 3; t++)
+        m[t] = n[t + 1] - d[t] * n[0];
+    m[3] = -d[3] * n[0];
+
+    for (int t = 0; t < 4; t++)
+    {
+        sumN += n[t];
+        sumM += m[t];
+        sumD += d[t];
+    }// for
+    scale = sumD / (sumN + sumM);
+
+    for (int t = 0; t < 4; t++)
+    {
+        k.n[t] = (float)(n[t] * scale);
+        k.m[t] = (float)(m[t] * scale);
+        k.d[t] = (float)d[t];
+    }// for
+    k.causalGain = (float)(sumN * scale / sumD);
+    k.anticausalGain = (float)(sumM * scale / sumD);
+
+    return k;
+}// Deriche_Coefficients
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Run Deriche's filter along LANES lines side by side.  Sample j of the
+//  lines is the LANES floats at x + j * xStep, and the filtered ones go to
+//  y + j * yStep.  The lines are treated as flat beyond either end.  Lanes
+//  are the inner loop, a fixed count summed into a local, so the compiler
+//  vectorizes it without checks.
+//
+///////////////////////////////////////////////////////////////////////////////
+template<int LANES> static void Deriche_Lines(const SDeriche& k, const float* x, ptrdiff_t xStep, float* y, ptrdiff_t yStep,
+                                              int count)
+{
+    const float *first = x, *last = x + (count - 1) * xStep;
+    float       before[LANES], after[LANES], sum[LANES];
+    float       lines[4][LANES], *z[4];
+
+    for (int l = 0; l < LANES; l++)
+    {
+        before[l] = first[l] * k.causalGain;
+        after[l] = last[l] * k.anticausalGain;
+    }// for
+
+    for (int j = 0; j < count; j++)
+    {
+        const float *x0 = x + j * xStep;
+        const float *x1 = j > 0 ? x0 - xStep : first;
+        const float *x2 = j > 1 ? x0 - 2 * xStep : first;
+        const float *x3 = j > 2 ? x0 - 3 * xStep : first;
+        const float *y1 = j > 0 ? y + (j - 1) * yStep : before;
+        const float *y2 = j > 1 ? y + (j - 2) * yStep : before;
+        const float *y3 = j > 2 ? y + (j - 3) * yStep : before;
+        const float *y4 = j > 3 ? y + (j - 4) * yStep : before;
+
+        for (int l = 0; l < LANES; l++)
+            sum[l] = k.n[0] * x0[l] + k.n[1] * x1[l] + k.n[2] * x2[l] + k.n[3] * x3[l]
+                   - k.d[0] * y1[l] - k.d[1] * y2[l] - k.d[2] * y3[l] - k.d[3] * y4[l];
+
+        memcpy(y + j * yStep, sum, sizeof(sum));
+    }// for
+
+    // z[0] is the anticausal line after j, z[1] the one after that and so
+    // on, rotated as j moves back
+    for (int t = 0; t < 4; t++)
+    {
+        z[t] = lines[t];
+        memcpy(z[t], after, sizeof(after));
+    }// for
+
+    for (int j = count - 1; j >= 0; j--)
+    {
+        const float *x1 = j + 1 < count ? x + (j + 1) * xStep : last;
+        const float *x2 = j + 2 < count ? x + (j + 2) * xStep : last;
+        const float *x3 = j + 3 < count ? x + (j + 3) * xStep : last;
+        const float *x4 = j + 4 < count ? x + (j + 4) * xStep : last;
+        float       *y0 = y + j * yStep;
+        float       *z0 = z[3];
+
+        for (int l = 0; l < LANES; l++)
+            sum[l] = k.m[0] * x1[l] + k.m[1] * x2[l] + k.m[2] * x3[l] + k.m[3] * x4[l]
+                   - k.d[0] * z[0][l] - k.d[1] * z[1][l] - k.d[2] * z[2][l] - k.d[3] * z[3][l];
+
+        memcpy(z0, sum, sizeof(sum));
+        for (int l = 0; l < LANES; l++)
+            y0[l] += sum[l];
+
+        z[3] = z[2];
+        z[2] = z[1];
+        z[1] = z[0];
+        z[0] = z0;
+    }// for
+}// Deriche_Lines
+
+
 ///////////////////////////////////////////////////////////////////////////////
 //
 //      Constructor.  Initialize member variables.
 //
 ///////////////////////////////////////////////////////////////////////////////
-TargaImage::TargaImage() : width(0), height(0), data(NULL)
+TargaImage::TargaImage() : width(0), height(0), data_array_size(0), img_size(0), stride(0), data(NULL)
 {}// TargaImage
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -56,9 +514,9 @@ TargaImage::TargaImage() : width(0), height(0), data(NULL)
 //      Constructor.  Initialize member variables.
 //
 ///////////////////////////////////////////////////////////////////////////////
-TargaImage::TargaImage(int w, int h) : width(w), height(h)
+TargaImage::TargaImage(int w, int h) : data(NULL)
 {
-   data = new unsigned char[width * height * 4];
+   Allocate_Data(w, h);
    ClearToBlack();
 }// TargaImage
 
@@ -68,18 +526,15 @@ TargaImage::TargaImage(int w, int h) : width(w), height(h)
 //      Constructor.  Initialize member variables to values given.
 //
 ///////////////////////////////////////////////////////////////////////////////
-TargaImage::TargaImage(int w, int h, unsigned char *d)
+TargaImage::TargaImage(int w, int h, unsigned char *d) : data(NULL)
 {
     int i;
 
-    width = w;
-    height = h;
-    data_array_size = width * height * 4;
-    img_size = data_array_size / 4;
-    data = new unsigned char[width * height * 4];
+    Allocate_Data(w, h);
 
-    for (i = 0; i < width * height * 4; i++)
-	    data[i] = d[i];
+    // d is packed, our rows are padded
+    for (i = 0; i < height; i++)
+	    memcpy(Row(i), d + (size_t)i * width * 4, (size_t)width * 4);
 }// TargaImage
 
 
@@ -92,16 +547,115 @@ TargaImage::TargaImage(const TargaImage& image)
 {
    width = image.width;
    height = image.height;
-   data_array_size = width * height * 4;
-   img_size = data_array_size / 4;
+   img_size = (size_t)width * height;
+   data_array_size = 0;
+   stride = 0;
    data = NULL; 
+   Copy_Settings(image);
    if (image.data != NULL) {
-      data = new unsigned char[width * height * 4];
-      memcpy(data, image.data, sizeof(unsigned char) * width * height * 4);
+      Copy_Data(image);
    }
+   // image is left alone: a copy of one from Open_Image decodes the file
+   // itself, and a copy of one between filters gets its planes
+   if (image.source != NULL) {
+      source = new char[strlen(image.source) + 1];
+      strcpy(source, image.source);
+   }
+   Copy_Planes(image);
 }
 
 
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Move Constructor.  Take over the pixels of image, leaving it empty.
+//
+///////////////////////////////////////////////////////////////////////////////
+TargaImage::TargaImage(TargaImage&& image) : data(NULL)
+{
+    Take_Data(image);
+}// TargaImage
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Copy Assignment.  Replace this image with a copy of image.
+//
+///////////////////////////////////////////////////////////////////////////////
+TargaImage& TargaImage::operator=(const TargaImage& image)
+{
+    if (this != &image)
+    {
+        TargaImage copy(image);
+        Release_Data();
+        Take_Data(copy);
+    }// if
+
+    return *this;
+}// operator=
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Move Assignment.  Replace this image with the pixels of image, 
+//  leaving it empty.
+//
+///////////////////////////////////////////////////////////////////////////////
+TargaImage& TargaImage::operator=(TargaImage&& image)
+{
+    if (this != &image)
+    {
+        Release_Data();
+        Take_Data(image);
+    }// if
+
+    return *this;
+}// operator=
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Return an image that shares this image's pixels instead of copying
+//  them.  Whichever image is changed first makes its own copy, so the 
+//  other never sees the change.  Gray or filter planes are never shared;
+//  both images keep a copy, so neither is quantized to bytes.
+//
+///////////////////////////////////////////////////////////////////////////////
+TargaImage TargaImage::Share()
+{
+    TargaImage result;
+
+    // decode an image from Open_Image, which has no planes
+    if (source && !Load_Data())
+        return result;
+    if (!data)
+        return result;
+
+    if (!shared)
+    {
+        shared = new SSharedPixels;
+        shared->refs = 1;
+        shared->cache = cache;
+        shared->storage = storage;
+        cache = NULL;
+        storage = NULL;
+    }// if
+    ++shared->refs;
+
+    result.width = width;
+    result.height = height;
+    result.img_size = img_size;
+    result.data_array_size = data_array_size;
+    result.stride = stride;
+    result.data = data;
+    result.apron = apron;
+    result.shared = shared;
+    result.Copy_Settings(*this);
+    result.Copy_Planes(*this);
+
+    return result;
+}// Share
+
+
 ///////////////////////////////////////////////////////////////////////////////
 //
 //      Destructor.  Free image memory.
@@ -109,8 +663,7 @@ TargaImage::TargaImage(const TargaImage& image)
 ///////////////////////////////////////////////////////////////////////////////
 TargaImage::~TargaImage()
 {
-    if (data)
-        delete[] data;
+    Release_Data();
 }// ~TargaImage
 
 
@@ -123,23 +676,15 @@ TargaImage::~TargaImage()
 ///////////////////////////////////////////////////////////////////////////////
 unsigned char* TargaImage::To_RGB(void)
 {
-    unsigned char   *rgb = new unsigned char[width * height * 3];
-    int		    i, j;
+    unsigned char   *rgb = new unsigned char[img_size * 3];
+    int		    i;
 
-    if (! data)
+    if (! Load_Data())
 	    return NULL;
 
     // Divide out the alpha
     for (i = 0 ; i < height ; i++)
-    {
-	    int in_offset = i * width * 4;
-	    int out_offset = i * width * 3;
-
-	    for (j = 0 ; j < width ; j++)
-        {
-	        RGBA_To_RGB(data + (in_offset + j*4), rgb + (out_offset + j*3));
-	    }
-    }
+	    SKernels::Active().RGBA_To_RGB_Row(Row(i), rgb + (size_t)i * width * 3, width);
 
     return rgb;
 }// TargaImage
@@ -147,24 +692,33 @@ unsigned char* TargaImage::To_RGB(void)
 
 ///////////////////////////////////////////////////////////////////////////////
 //
-//      Save the image to a targa file. Returns 1 on success, 0 on failure.
+//      Save the image to a targa file, run-length encoded if bRLE is set.
+//  Returns 1 on success, 0 on failure.
 //
 ///////////////////////////////////////////////////////////////////////////////
-bool TargaImage::Save_Image(const char *filename)
+bool TargaImage::Save_Image(const char *filename, bool bRLE)
 {
-    TargaImage	*out_image = Reverse_Rows();
+    unsigned int flags = TGA_TOP_DOWN;
+    int          error;
 
-    if (! out_image)
+    if (! Load_Data())
 	    return false;
 
-    if (!tga_write_raw(filename, width, height, out_image->data, TGA_TRUECOLOR_32))
+    if (CImageCache::Is_Cache_File(filename))
+        return CImageCache::Write(filename, width, height, data, stride);
+
+    if (bRLE)
+        flags |= TGA_RLE;
+
+    // the writer walks our top-down rows from the bottom itself, and
+    // encodes rle rows on our threads
+    Install_Tga_Runner();
+    if (!tga_write_rows_r(filename, width, height, data, stride, TGA_TRUECOLOR_32, flags, &error))
     {
-	    cout << "TGA Save Error: %s\n", tga_error_string(tga_get_last_error());
+	    cout << "TGA Save Error: " << tga_error_string(error) << endl;
 	    return false;
     }
 
-    delete out_image;
-
     return true;
 }// Save_Image
 
@@ -177,10 +731,31 @@ bool TargaImage::Save_Image(const char *filename)
 ///////////////////////////////////////////////////////////////////////////////
 TargaImage* TargaImage::Load_Image(char *filename)
 {
-    unsigned char   *temp_data;
-    TargaImage	    *temp_image;
+    TargaImage  *result = Open_Image(filename);
+
+    if (result && !result->Load_Data())
+    {
+        delete result;
+        result = NULL;
+    }// if
+
+    return result;
+}// Load_Image
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Open an image file, reading only its header.  Return a new TargaImage 
+//  object of the right size which must be deleted by caller, or NULL on 
+//  failure.  The pixels are decoded by Load_Data, so size checks against 
+//  the image cost almost nothing.
+//
+///////////////////////////////////////////////////////////////////////////////
+TargaImage* TargaImage::Open_Image(char *filename)
+{
     TargaImage	    *result;
-    int		        width, height;
+    TGA_INFO        info;
+    int             error;
 
     if (!filename)
     {
@@ -188,58 +763,105 @@ TargaImage* TargaImage::Load_Image(char *filename)
         return NULL;
     }// if
 
-    temp_data = (unsigned char*)tga_load(filename, &width, &height, TGA_TRUECOLOR_32);
-    if (!temp_data)
+    // cache files already hold our rows, so just point data at them
+    if (CImageCache::Is_Cache_File(filename))
     {
-        cout << "TGA Error: %s\n", tga_error_string(tga_get_last_error());
-	    width = height = 0;
-	    return NULL;
-    }
-    temp_image = new TargaImage(width, height, temp_data);
-    free(temp_data);
+        CImageCache *pCache = CImageCache::Map(filename);
+        if (!pCache)
+            return NULL;
+
+        result = new TargaImage();
+        result->width = pCache->Width();
+        result->height = pCache->Height();
+        result->img_size = (size_t)result->width * result->height;
+        result->stride = pCache->Stride();
+        result->data_array_size = result->stride * result->height;
+        result->data = pCache->Pixels();
+        result->cache = pCache;
+        return result;
+    }// if
 
-    result = temp_image->Reverse_Rows();
+    if (!tga_probe_r(filename, &info, &error))
+    {
+        cout << "TGA Error: " << tga_error_string(error) << endl;
+	    return NULL;
+    }// if
 
-    delete temp_image;
+    result = new TargaImage();
+    result->width = info.width;
+    result->height = info.height;
+    result->img_size = (size_t)result->width * result->height;
+    result->source = new char[strlen(filename) + 1];
+    strcpy(result->source, filename);
 
     return result;
-}// Load_Image
+}// Open_Image
 
 
 ///////////////////////////////////////////////////////////////////////////////
 //
-//      Determine the position visited if is a valid region to move
-//          return True if the position is in valid position
-// 
+//      Make data hold the pixels: decode the pixels of an image from 
+//  Open_Image, if that hasn't been done yet, or store the planes left by
+//  To_Grayscale or a filter.  Return true if the image has pixels.
+//
 ///////////////////////////////////////////////////////////////////////////////
-bool TargaImage::Is_Valid_Img_Pos(int x, int y)
+bool TargaImage::Load_Data()
 {
-    return x >= 0 && x < width && y >= 0 && y < height;
-}
+    TGA_READER      *reader;
+    char            *filename = source;
+    int		        w, h;
+    int             error;
+
+    if (gray || planes16 || planes_float)
+        Unshare();
+
+    if (!filename)
+        return data != NULL;
+    source = NULL;
+
+    // read the header again so the pixels can be decoded straight into
+    // the image, top row first.  rle rows are expanded on our threads.
+    // errors come back per call, so images can be loaded from several
+    // threads at once.
+    Install_Tga_Runner();
+    reader = tga_open_r(filename, &w, &h, &error);
+    delete[] filename;
+    if (!reader)
+    {
+        cout << "TGA Error: " << tga_error_string(error) << endl;
+	    return false;
+    }// if
+
+    if (w != width || h != height)
+    {
+        cout << "TGA Error: file changed size since it was opened" << endl;
+        tga_close(reader);
+        return false;
+    }// if
+
+    Allocate_Data(w, h);
+
+    if (!tga_read_rows_r(reader, data, stride, TGA_TRUECOLOR_32, TGA_TOP_DOWN, &error))
+    {
+        cout << "TGA Error: " << tga_error_string(error) << endl;
+        Release_Data();
+    }// if
+
+    tga_close(reader);
+
+    return data != NULL;
+}// Load_Data
 
 
 ///////////////////////////////////////////////////////////////////////////////
 //
-//      Determine the position visited if is a valid region to move:
-// 
-//          return -1 : x and y are not both in range
-//          return 0  : x is not in range
-//          return 1  : y is not in range
-//          retrun 2  : x and y are both in range
+//      Determine the position visited if is a valid region to move
+//          return True if the position is in valid position
 // 
 ///////////////////////////////////////////////////////////////////////////////
-int TargaImage::Mask_Pos_In_Range(int x, int y)
+bool TargaImage::Is_Valid_Img_Pos(int x, int y)
 {
-    bool x_in = x >= 0 && x < width;
-    bool y_in = y >= 0 && y < height;
-    if (!x_in && !y_in)
-        return -1;
-    else if (x_in && !y_in)
-        return 0;
-    else if (!x_in && y_in)
-        return 1;
-    else
-        return 2;
+    return x >= 0 && x < width && y >= 0 && y < height;
 }
 
 
@@ -302,150 +924,6 @@ int TargaImage::Find_Proper_Dither_Color(int type, int val)
     }
 }
 
-///////////////////////////////////////////////////////////////////////////////
-//
-//      Calculate the average value of color in 5 * 5 area
-//      
-///////////////////////////////////////////////////////////////////////////////
-int TargaImage::Box_Filter_Fetch_Value(int x, int y , int *swatches)
-{
-    float avg = 0;
-    int first_index;
-    int range;
-
-    for (int dy = -2; dy <= 2; dy++)
-    {
-        first_index = (y + dy) * width;
-        for (int dx = -2; dx <= 2; dx++)
-        {
-            range = Mask_Pos_In_Range(x + dx, y + dy);
-            
-            if (range == -1) // x and y are not both in range
-            {
-                avg += swatches[y * width + x] * 0.04;
-            }
-
-            else if (range == 0) // x is not in range
-            {
-                if (y + dy < 0)
-                {
-                    if(y)
-                        avg += swatches[(y - 1) * width + (x + dx)] * 0.04;
-                    else
-                        avg += swatches[y * width + (x + dx)] * 0.04;
-                }
-                    
-                else
-                {
-                    if (y == height - 2)
-                        avg += swatches[(y + 1) * width + (x + dx)] * 0.04;
-                    else
-                        avg += swatches[y * width + (x + dx)] * 0.04;
-                }
-            }
-
-            else if (range == 1) // y is not in range
-            {
-                if (x + dx < 0)
-                {
-                    if (x)
-                        avg += swatches[(y + dy) * width + (x - 1)] * 0.04;
-                    else
-                        avg += swatches[(y + dy) * width + x] * 0.04;
-                }
-
-                else
-                {
-                    if (x == width - 2)
-                        avg += swatches[(y + dy) * width + (x + 1)] * 0.04;
-                    else
-                        avg += swatches[(y + dy) * width + x] * 0.04;
-                }
-            }
-
-            else // x and y are both in range
-            {
-                avg += swatches[first_index + x + dx] * 0.04;
-            }
-        }
-    }
-
-    return (int)avg;
-}
-
-///////////////////////////////////////////////////////////////////////////////
-//
-//      Calculate the value of color in 5 * 5 area 
-// with specific rate(Gaussian Filter)
-//      
-///////////////////////////////////////////////////////////////////////////////
-int TargaImage::Gaussian_Filter_Fetch_Value(int x, int y, int* swatches)
-{
-    float avg = 0;
-    int first_index;
-    int range;
-
-    for (int dy = -2, i = 0; dy <= 2; dy++, i++)
-    {
-        first_index = (y + dy) * width;
-
-        for (int dx = -2, j = 0; dx <= 2; dx++, j++)
-        {
-            range = Mask_Pos_In_Range(x + dx, y + dy);
-
-            if (range == -1) // x and y are not both in range
-            {
-                avg += (float)swatches[y * width + x] * (float)gaussian_filter_matrix[i][j] / 256.0f;
-            }
-
-            else if (range == 0) // x is not in range
-            {
-                if (y + dy < 0)
-                {
-                    if (y)
-                        avg += (float)swatches[(y - 1) * width + (x + dx)] * (float)gaussian_filter_matrix[i][j] / 256.0f;
-                    else
-                        avg += (float)swatches[y * width + (x + dx)] * (float)gaussian_filter_matrix[i][j] / 256.0f;
-                }
-
-                else
-                {
-                    if (y == height - 2)
-                        avg += (float)swatches[(y + 1) * width + (x + dx)] * (float)gaussian_filter_matrix[i][j] / 256.0f;
-                    else
-                        avg += (float)swatches[y * width + (x + dx)] * (float)gaussian_filter_matrix[i][j] / 256.0f;
-                }
-            }
-
-            else if (range == 1) // y is not in range
-            {
-                if (x + dx < 0)
-                {
-                    if (x)
-                        avg += (float)swatches[(y + dy) * width + (x - 1)] * (float)gaussian_filter_matrix[i][j] / 256.0f;
-                    else
-                        avg += (float)swatches[(y + dy) * width + x] * (float)gaussian_filter_matrix[i][j] / 256.0f;
-                }
-
-                else
-                {
-                    if (x == width - 2)
-                        avg += (float)swatches[(y + dy) * width + (x + 1)] * (float)gaussian_filter_matrix[i][j] / 256.0f;
-                    else
-                        avg += (float)swatches[(y + dy) * width + x] * (float)gaussian_filter_matrix[i][j] / 256.0f;
-                }
-            }
-
-            else // x and y are both in range
-            {
-                avg += (float)swatches[first_index + x + dx] * (float)gaussian_filter_matrix[i][j] / 256.0f;
-            }
-        }
-    }
-
-    return (int)avg;
-}
-
 ///////////////////////////////////////////////////////////////////////////////
 //
 //      Define the rule to sort pair<int, int> container, the bigger
@@ -466,12 +944,41 @@ bool comp(pair<int, int> a, pair<int, int> b)
 ///////////////////////////////////////////////////////////////////////////////
 bool TargaImage::To_Grayscale()
 {
-    float Y;
-    for (int i = 0; i < data_array_size; i += 4)
+    // already gray, but the weights don't quite sum to one, so apply them 
+    // to the plane just as they would be to equal channels
+    if (gray)
     {
-        Y = 0.3 * (float)data[i] + 0.59 * (float)data[i + 1] + 0.11 * (float)data[i + 2];
-        data[i] = data[i + 1] = data[i + 2] = Y;
+        CThreadPool::Shared().Parallel_For(0, height, Band_Rows(width), [&](int first, int last)
+        {
+            float Y;
+
+            for (int y = first; y < last; y++)
+            {
+                unsigned char* row = gray->Row(0, y);
+                for (int x = 0; x < width; x++)
+                {
+                    Y = 0.3 * (float)row[x] + 0.59 * (float)row[x] + 0.11 * (float)row[x];
+                    row[x] = Y;
+                }
+            }
+        });
+        return true;
     }
+
+    // the gray values go into a plane of their own, so the dithers that
+    // follow touch one byte per pixel.  data is left alone until 
+    // Load_Data or Unshare expands the plane back into it.
+    if (!Load_Data())
+        return false;
+
+    gray = new CPlanarBuffer<unsigned char>();
+    gray->Resize(width, height, 1);
+
+    CThreadPool::Shared().Parallel_For(0, height, Band_Rows(width), [&](int first, int last)
+    {
+        for (int y = first; y < last; y++)
+            SKernels::Active().Gray_Row(Row(y), gray->Row(0, y), width);
+    });
     return true;
 }// To_Grayscale
 
@@ -484,12 +991,14 @@ bool TargaImage::To_Grayscale()
 ///////////////////////////////////////////////////////////////////////////////
 bool TargaImage::Quant_Uniform()
 {
-    for (int i = 0; i < data_array_size; i+=4)
+    const unsigned char mask[4] = { 224, 224, 192, 255 };
+
+    Unshare();
+    CThreadPool::Shared().Parallel_For(0, height, Band_Rows(width), [&](int first, int last)
     {
-        data[i]      =  (data[i] & 224);
-        data[i + 1]  =  (data[i + 1] & 224);
-        data[i + 2]  =  (data[i + 2] & 192);
-    }
+        for (int y = first; y < last; y++)
+            SKernels::Active().Mask_Row(Row(y), width, mask);
+    });
     return true;
 }// Quant_Uniform
 
@@ -502,8 +1011,10 @@ bool TargaImage::Quant_Uniform()
 ///////////////////////////////////////////////////////////////////////////////
 bool TargaImage::Quant_Populosity()
 {
-    pair<int, int>* color_number  =  new pair<int, int>[32769];
-    Color* pop_color              =  new Color[256];
+    Unshare();
+    CScratchArena& arena          =  CScratchArena::Thread();
+    pair<int, int>* color_number  =  arena.Allocate_Array<pair<int, int> >(32769);
+    Color* pop_color              =  arena.Allocate_Array<Color>(256);
     int index;
 
     for (int i = 0; i < 32768; i++)
@@ -511,11 +1022,17 @@ bool TargaImage::Quant_Populosity()
         color_number[i].first   =  i;
         color_number[i].second  =  0;
     }
+    color_number[32768].first   =  0;
+    color_number[32768].second  =  0;
 
-    for (int i = 0; i < data_array_size; i += 4)
+    for (int y = 0; y < height; y++)
     {
-        int index = (int)((data[i] >> 3) << 10) + (int)((data[i + 1] >> 3) << 5) + (int)(data[i + 2] >> 3);
-        color_number[index].second++;
+        unsigned char* row = Row(y);
+        for (int i = 0; i < width * 4; i += 4)
+        {
+            int index = (int)((row[i] >> 3) << 10) + (int)((row[i + 1] >> 3) << 5) + (int)(row[i + 2] >> 3);
+            color_number[index].second++;
+        }
     }
 
     sort(color_number, color_number + 32769, comp);
@@ -527,37 +1044,43 @@ bool TargaImage::Quant_Populosity()
         pop_color[i].blue   =  (color_number[i].first % 32) << 3;
     }
 
-    int distance;
-    int d_r, d_g, d_b;
-    int dis_min;
-    int min_index;
-
-
-    for (int i = 0; i < data_array_size; i += 4)
+    // each pixel is mapped on its own, so rows are split across the pool
+    CThreadPool::Shared().Parallel_For(0, height, Band_Rows(width), [&](int first, int last)
     {
-        dis_min    =  200000;
-        min_index  =  1000;
-        for (int j = 0; j < 256; j++)
+        int distance;
+        int d_r, d_g, d_b;
+        int dis_min;
+        int min_index;
+
+        for (int y = first; y < last; y++)
         {
-            d_r  =  pop_color[j].red - data[i];
-            d_g  =  pop_color[j].green - data[i + 1];
-            d_b  =  pop_color[j].blue - data[i + 2];
+            unsigned char* row = Row(y);
+            for (int i = 0; i < width * 4; i += 4)
+            {
+                dis_min    =  200000;
+                min_index  =  1000;
+                for (int j = 0; j < 256; j++)
+                {
+                    d_r  =  pop_color[j].red - row[i];
+                    d_g  =  pop_color[j].green - row[i + 1];
+                    d_b  =  pop_color[j].blue - row[i + 2];
 
-            distance = d_r * d_r + d_g * d_g + d_b * d_b;
+                    distance = d_r * d_r + d_g * d_g + d_b * d_b;
 
-            if (dis_min > distance)
-            {
-                dis_min = distance;
-                min_index = j;
+                    if (dis_min > distance)
+                    {
+                        dis_min = distance;
+                        min_index = j;
+                    }
+                }
+
+                row[i]      =  pop_color[min_index].red;
+                row[i + 1]  =  pop_color[min_index].green;
+                row[i + 2]  =  pop_color[min_index].blue;
             }
         }
+    });
 
-        data[i]      =  pop_color[min_index].red;
-        data[i + 1]  =  pop_color[min_index].green;
-        data[i + 2]  =  pop_color[min_index].blue;
-    }
-
-    delete [] color_number;
     return true;
 }// Quant_Populosity
 
@@ -569,14 +1092,13 @@ bool TargaImage::Quant_Populosity()
 ///////////////////////////////////////////////////////////////////////////////
 bool TargaImage::Dither_Threshold()
 {
-    To_Grayscale();
-    for (int i = 0; i < data_array_size; i += 4)
+    if (!To_Grayscale())
+        return false;
+    CThreadPool::Shared().Parallel_For(0, height, Band_Rows(width), [&](int first, int last)
     {
-        if (data[i] >= 127)
-            data[i] = data[i + 1] = data[i + 2] = BRIGHT;
-        else
-            data[i] = data[i + 1] = data[i + 2] = DARK;
-    }
+        for (int y = first; y < last; y++)
+            SKernels::Active().Threshold_Row(gray->Row(0, y), width, 127, DARK, BRIGHT);
+    });
     return true;
 }// Dither_Threshold
 
@@ -589,17 +1111,22 @@ bool TargaImage::Dither_Threshold()
 bool TargaImage::Dither_Random()
 {
     srand(time(NULL));
-    To_Grayscale();
+    if (!To_Grayscale())
+        return false;
     float rand_num;
 
-    for (int i = 0; i < data_array_size; i += 4)
+    for (int y = 0; y < height; y++)
     {
-        rand_num = (float)(rand() % 401 - 200)/1000.0;
-        data[i] = data[i] + 255.0f * rand_num;
-        if (data[i] >= 127)
-            data[i] = data[i + 1] = data[i + 2] = BRIGHT;
-        else
-            data[i] = data[i + 1] = data[i + 2] = DARK;
+        unsigned char* row = gray->Row(0, y);
+        for (int x = 0; x < width; x++)
+        {
+            rand_num = (float)(rand() % 401 - 200)/1000.0;
+            row[x] = row[x] + 255.0f * rand_num;
+            if (row[x] >= 127)
+                row[x] = BRIGHT;
+            else
+                row[x] = DARK;
+        }
     }
     return true;
 }// Dither_Random
@@ -613,19 +1140,24 @@ bool TargaImage::Dither_Random()
 ///////////////////////////////////////////////////////////////////////////////
 bool TargaImage::Dither_FS()
 {
-    To_Grayscale();
-    int prev_row = 0;
-    int index = 0;
-    int move_index = 0;
+    if (!To_Grayscale())
+        return false;
+    size_t prev_row = 0;
+    size_t index = 0;
+    size_t move_index = 0;
     float error = 0;
-    float* temp_img = new float[img_size];
+    float* temp_img = CScratchArena::Thread().Allocate_Array<float>(img_size);
 
-    for (int i = 0, j = 0; i < data_array_size; i += 4, j++)
-        temp_img[j] = data[i];
+    for (int y = 0; y < height; y++)
+    {
+        unsigned char* row = gray->Row(0, y);
+        for (int x = 0; x < width; x++)
+            temp_img[(size_t)y * width + x] = row[x];
+    }
 
     for (int y = 0; y < height; y++)
     {
-        prev_row = y * width;
+        prev_row = (size_t)y * width;
         // Odd row must move from right to left side
         if (y % 2)
         {
@@ -647,7 +1179,7 @@ bool TargaImage::Dither_FS()
                 {
                     if (Is_Valid_Img_Pos(x + dither_fs_move_odd[i][0], y + dither_fs_move_odd[i][1]))
                     {
-                        move_index = index + width * dither_fs_move_odd[i][1] + dither_fs_move_odd[i][0];
+                        move_index = index + (ptrdiff_t)width * dither_fs_move_odd[i][1] + dither_fs_move_odd[i][0];
                         temp_img[move_index] += (error * dither_fs_error_rate[i]);
                     }
                 }
@@ -675,7 +1207,7 @@ bool TargaImage::Dither_FS()
                 {
                     if (Is_Valid_Img_Pos(x + dither_fs_move_even[i][0], y + dither_fs_move_even[i][1]))
                     {
-                        move_index = index + width * dither_fs_move_even[i][1] + dither_fs_move_even[i][0];
+                        move_index = index + (ptrdiff_t)width * dither_fs_move_even[i][1] + dither_fs_move_even[i][0];
                         temp_img[move_index] += (error * dither_fs_error_rate[i]);
                     }
                 }
@@ -683,11 +1215,12 @@ bool TargaImage::Dither_FS()
         }
     }
     
-    for (int i = 0; i < data_array_size; i += 4)
+    for (int y = 0; y < height; y++)
     {
-        data[i] = data[i + 1] = data[i + 2] = (temp_img[i/4] >= 127 ? 255: 0);
+        unsigned char* row = gray->Row(0, y);
+        for (int x = 0; x < width; x++)
+            row[x] = (temp_img[(size_t)y * width + x] >= 127 ? 255: 0);
     }
-    delete[]temp_img;
     return true;
 }// Dither_FS
 
@@ -698,16 +1231,16 @@ bool TargaImage::Dither_FS()
 //  operation.
 //
 ///////////////////////////////////////////////////////////////////////////////
-bool TargaImage::Dither_FS_Swatches(float *swatches, int type)
+bool TargaImage::Dither_FS_Swatches(float *swatches, ptrdiff_t stride, int type)
 {
-    int prev_row = 0;
-    int index = 0;
-    int move_index = 0;
+    ptrdiff_t prev_row = 0;
+    ptrdiff_t index = 0;
+    ptrdiff_t move_index = 0;
     float error = 0;
     
     for (int y = 0; y < height; y++)
     {
-        prev_row = y * width;
+        prev_row = y * stride;
         // Odd row must move from right to left side
         if (y % 2)
         {
@@ -722,7 +1255,7 @@ bool TargaImage::Dither_FS_Swatches(float *swatches, int type)
                 {
                     if (Is_Valid_Img_Pos(x + dither_fs_move_odd[i][0], y + dither_fs_move_odd[i][1]))
                     {
-                        move_index = index + width * dither_fs_move_odd[i][1] + dither_fs_move_odd[i][0];
+                        move_index = index + stride * dither_fs_move_odd[i][1] + dither_fs_move_odd[i][0];
                         swatches[move_index] += (error * dither_fs_error_rate[i]);
                         if (swatches[move_index] <= 0)
                             swatches[move_index] = 0;
@@ -747,7 +1280,7 @@ bool TargaImage::Dither_FS_Swatches(float *swatches, int type)
                 {
                     if (Is_Valid_Img_Pos(x + dither_fs_move_even[i][0], y + dither_fs_move_even[i][1]))
                     {
-                        move_index = index + width * dither_fs_move_even[i][1] + dither_fs_move_even[i][0];
+                        move_index = index + stride * dither_fs_move_even[i][1] + dither_fs_move_even[i][0];
                         swatches[move_index] += (error * dither_fs_error_rate[i]);
                         if (swatches[move_index] <= 0)
                             swatches[move_index] = 0;
@@ -770,28 +1303,30 @@ bool TargaImage::Dither_FS_Swatches(float *swatches, int type)
 ///////////////////////////////////////////////////////////////////////////////
 bool TargaImage::Dither_Bright()
 {
-    To_Grayscale();
-    int sum = 0;
-    int bright_number;
+    if (!To_Grayscale())
+        return false;
+    unsigned long long sum = 0;
     int turning_point;
     float britness;
     float threshold;
-    int pixel_intensity[256] = {};
+    size_t pixel_intensity[256] = {};
 
-    for (int i = 0; i < data_array_size; i+=4)
-        sum += data[i];
+    for (int y = 0; y < height; y++)
+        for (int x = 0; x < width; x++)
+            sum += gray->Row(0, y)[x];
        
     britness = (float)sum / img_size / 255.0f;
     
-    for (int i = 0; i < data_array_size; i += 4)
-        pixel_intensity[data[i]]++;
+    for (int y = 0; y < height; y++)
+        for (int x = 0; x < width; x++)
+            pixel_intensity[gray->Row(0, y)[x]]++;
 
-    int dark_number = (1-britness) * img_size;
+    ptrdiff_t dark_number = (ptrdiff_t)((1-britness) * img_size);
 
     turning_point = 0;
     while (turning_point < 256)
     {
-        dark_number -= pixel_intensity[turning_point];
+        dark_number -= (ptrdiff_t)pixel_intensity[turning_point];
         if (dark_number <= 0)
             break;
         turning_point++;
@@ -804,13 +1339,20 @@ bool TargaImage::Dither_Bright()
 
     threshold *= 255.0f;
 
-    for (int i = 0; i < data_array_size; i += 4)
+    CThreadPool::Shared().Parallel_For(0, height, Band_Rows(width), [&](int first, int last)
     {
-        if (data[i] >= threshold)
-            data[i] = data[i + 1] = data[i + 2] = BRIGHT;
-        else
-            data[i] = data[i + 1] = data[i + 2] = DARK;
-    }
+        for (int y = first; y < last; y++)
+        {
+            unsigned char* row = gray->Row(0, y);
+            for (int x = 0; x < width; x++)
+            {
+                if (row[x] >= threshold)
+                    row[x] = BRIGHT;
+                else
+                    row[x] = DARK;
+            }
+        }
+    });
 
     return true;
 }// Dither_Bright
@@ -823,19 +1365,22 @@ bool TargaImage::Dither_Bright()
 ///////////////////////////////////////////////////////////////////////////////
 bool TargaImage::Dither_Cluster()
 {
-    int first;
-    To_Grayscale();
-    for (int y = 0; y < height; y++)
+    if (!To_Grayscale())
+        return false;
+    CThreadPool::Shared().Parallel_For(0, height, Band_Rows(width), [&](int first, int last)
     {
-        first = y * width * 4;
-        for (int x = 0; x < width * 4; x += 4)
+        for (int y = first; y < last; y++)
         {
-            if ((float)data[first + x] / 255.0 >= cluster_matrix[y % 4][(x/4) % 4])
-                data[first + x] = data[first + x + 1] = data[first + x + 2] = BRIGHT;
-            else
-                data[first + x] = data[first + x + 1] = data[first + x + 2] = DARK;
+            unsigned char* row = gray->Row(0, y);
+            for (int x = 0; x < width; x++)
+            {
+                if ((float)row[x] / 255.0 >= cluster_matrix[y % 4][x % 4])
+                    row[x] = BRIGHT;
+                else
+                    row[x] = DARK;
+            }
         }
-    }
+    });
     return true;
 }// Dither_Cluster
 
@@ -849,29 +1394,19 @@ bool TargaImage::Dither_Cluster()
 ///////////////////////////////////////////////////////////////////////////////
 bool TargaImage::Dither_Color()
 {
-    float* r_swatches  =  new float[img_size];
-    float* g_swatches  =  new float[img_size];
-    float* b_swatches  =  new float[img_size];
-    
+    Unshare();
+    CPlanarBuffer<float> planes(CScratchArena::Thread());
 
-    for (int i = 0; i < data_array_size; i += 4)
-    {
-        r_swatches[i / 4]  =  data[i];
-        g_swatches[i / 4]  =  data[i + 1];
-        b_swatches[i / 4]  =  data[i + 2];
-    }
+    planes.Deinterleave(data, stride, width, height);
 
-    Dither_FS_Swatches(r_swatches, 0);
-    Dither_FS_Swatches(g_swatches, 1);
-    Dither_FS_Swatches(b_swatches, 2);
-    
-    for (int i = 0; i < data_array_size; i += 4)
+    // the error only spreads within a channel, so the channels run at once
+    CThreadPool::Shared().Parallel_For(0, 3, 1, [&](int first, int last)
     {
-        data[i]      =  (int)r_swatches[i / 4];
-        data[i + 1]  =  (int)g_swatches[i / 4];
-        data[i + 2]  =  (int)b_swatches[i / 4];
-    }
-    delete [] r_swatches, delete [] b_swatches, delete [] g_swatches;
+        for (int c = first; c < last; c++)
+            Dither_FS_Swatches(planes.Plane(c), planes.Stride(), c);
+    });
+    
+    planes.Interleave(data, stride);
     return true;
 }// Dither_Color
 
@@ -988,19 +1523,32 @@ bool TargaImage::Difference(TargaImage* pImage)
         return false;
     }// if
 
-    for (int i = 0 ; i < width * height * 4 ; i += 4)
+    if (!pImage->Load_Data())
+        return false;
+
+    Unshare();
+
+    CThreadPool::Shared().Parallel_For(0, height, Band_Rows(width), [&](int first, int last)
     {
-        unsigned char        rgb1[3];
-        unsigned char        rgb2[3];
+        unsigned char   *rgb1 = CScratchArena::Thread().Allocate_Array<unsigned char>((size_t)width * 3);
+        unsigned char   *rgb2 = CScratchArena::Thread().Allocate_Array<unsigned char>((size_t)width * 3);
 
-        RGBA_To_RGB(data + i, rgb1);
-        RGBA_To_RGB(pImage->data + i, rgb2);
+        for (int y = first ; y < last ; y++)
+        {
+            unsigned char   *row1 = Row(y);
 
-        data[i] = abs(rgb1[0] - rgb2[0]);
-        data[i+1] = abs(rgb1[1] - rgb2[1]);
-        data[i+2] = abs(rgb1[2] - rgb2[2]);
-        data[i+3] = 255;
-    }
+            SKernels::Active().RGBA_To_RGB_Row(row1, rgb1, width);
+            SKernels::Active().RGBA_To_RGB_Row(pImage->Row(y), rgb2, width);
+
+            for (int x = 0 ; x < width ; x++)
+            {
+                row1[x*4] = abs(rgb1[x*3] - rgb2[x*3]);
+                row1[x*4+1] = abs(rgb1[x*3+1] - rgb2[x*3+1]);
+                row1[x*4+2] = abs(rgb1[x*3+2] - rgb2[x*3+2]);
+                row1[x*4+3] = 255;
+            }
+        }
+    });
 
     return true;
 }// Difference
@@ -1013,330 +1561,551 @@ bool TargaImage::Difference(TargaImage* pImage)
 ///////////////////////////////////////////////////////////////////////////////
 bool TargaImage::Filter_Box()
 {
-    int* r_swatches         =  new int[img_size];
-    int* g_swatches         =  new int[img_size];
-    int* b_swatches         =  new int[img_size];
-    int** fetch_near_color  =  new int* [5];
-    int fir_index;
+    return Filter_Box_R(2);
+}// Filter_Box
 
-    for (int i = 0; i < 5; i++)
-        fetch_near_color[i] = new int[5];
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Perform (2 * radius + 1) square box filter on this image, at the 
+//  same cost for any radius up to c_maxBoxRadius.  Return success of 
+//  operation.
+//
+///////////////////////////////////////////////////////////////////////////////
+bool TargaImage::Filter_Box_R(int radius)
+{
+    if (radius < 0 || radius > c_maxBoxRadius)
+    {
+        cout << "Box radius " << radius << " is out of range; it must be 0 to " << c_maxBoxRadius << "." << endl;
+        return false;
+    }// if
+
+    return Apply_Filter(KERNEL_BOX, radius);
+}// Filter_Box_R
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Perform 5x5 Bartlett filter on this image.  Return success of 
+//  operation.
+//
+///////////////////////////////////////////////////////////////////////////////
+bool TargaImage::Filter_Bartlett()
+{
+    return Apply_Filter(KERNEL_REGISTERED, REGISTERED_BARTLETT);
+}// Filter_Bartlett
 
-    for (int i = 0; i < data_array_size; i += 4)
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Filter the color planes of src, whose borders must be filled, into
+//  dst, which must already be the image's size.  The box is running sums
+//  and registered kernels run their entry in c_asRegisteredKernels for 
+//  the pixel type.
+//
+///////////////////////////////////////////////////////////////////////////////
+template<class T> void TargaImage::Filter_Planes(const CPlanarBuffer<T>& src, CPlanarBuffer<T>& dst, int kernel, int n)
+{
+    switch (kernel)
     {
-        r_swatches[i / 4] =  data[i];
-        g_swatches[i / 4] =  data[i + 1];
-        b_swatches[i / 4] =  data[i + 2];
-    }
+        case KERNEL_BOX:
+            Filter_Box_Sums(src, dst, n);
+            return;
+        case KERNEL_REGISTERED:
+            Run_Registered(c_asRegisteredKernels[n], src, dst);
+            return;
+        case KERNEL_GAUSSIAN_N:
+            if (n > c_binomialMaxN)
+            {
+                Filter_Recursive_Gaussian(src, dst, Gaussian_N_Sigma(n));
+                return;
+            }// if
+            // fall through
+        case KERNEL_BINOMIAL_N:
+        {
+            // binomial taps over 2^(n - 1), which are exact in float
+            // while the binomials fit in its mantissa
+            float *taps = CScratchArena::Thread().Allocate_Array<float>(n);
+
+            for (int k = 0; k < n; k++)
+                taps[k] = (float)ldexp(Binomial(n - 1, k), 1 - n);
+            Filter_Separable(src, dst, taps, n / 2, 1.0f);
+            return;
+        }// KERNEL_BINOMIAL_N
+        default:
+            break;
+    }// switch
+}// Filter_Planes
 
-    for (int y = 0; y < height; y++)
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Filter the color planes of src into dst with the kernel that is the
+//  outer product of the 2 * radius + 1 taps with themselves, divided by 
+//  base.  src's border must be at least radius and filled.  
+//
+//      Each row is done in two passes of 2 * radius + 1 taps, down the 
+//  columns into a row of sums and then across them, rather than one of
+//  (2 * radius + 1)^2.  Going down first means the sums are a single row,
+//  which stays in the first level cache, and a band of rows walks down the
+//  plane so the source rows the next row needs are mostly in cache already.
+//  Sums of bytes or 8.8 fixed point with the integer taps here are exact 
+//  in float, so the result is the true weighted sum truncated.
+//
+///////////////////////////////////////////////////////////////////////////////
+template<class T> void TargaImage::Filter_Separable(const CPlanarBuffer<T>& src, CPlanarBuffer<T>& dst, const float* taps,
+                                                    int radius, float base)
+{
+    CThreadPool::Shared().Parallel_For(0, height * 3, Band_Rows(width), [&](int first, int last)
     {
-        fir_index = y * width * 4;
-        for (int x = 0; x < width; x++)
+        float *sums = CScratchArena::Thread().Allocate_Array<float>(width + 2 * radius);
+
+        for (int i = first; i < last; i++)
         {
-            data[fir_index + x * 4]      =  Box_Filter_Fetch_Value(x, y, r_swatches);
-            data[fir_index + x * 4 + 1]  =  Box_Filter_Fetch_Value(x, y, g_swatches);
-            data[fir_index + x * 4 + 2]  =  Box_Filter_Fetch_Value(x, y, b_swatches);
+            int c = i / height;
+            int y = i % height;
+
+            Filter_Separable_Row(src.Row(c, y), src.Stride(), taps, radius, base, sums, dst.Row(c, y));
         }
-    }
+    });
+}// Filter_Separable
 
-    for (int i = 0; i < 5; i++)
-        delete fetch_near_color[i];
-    delete [] fetch_near_color;
-    
-    delete [] r_swatches, delete [] b_swatches, delete [] g_swatches;
-    return true;
-}// Filter_Box
 
 ///////////////////////////////////////////////////////////////////////////////
 //
-//      Calculate the value of color in 5 * 5 area 
-// with specific rate(Bartlett Filter)
-//      
+//      Filter one row of a plane separably, using sums, which must have
+//  room for width + 2 * radius, between the passes.  Bytes go through the
+//  kernel table.
+//
 ///////////////////////////////////////////////////////////////////////////////
-int TargaImage::Bartlett_Filter_Fetch_Value(int x, int y, int* swatches)
+template<class T> void TargaImage::Filter_Separable_Row(const T* src, ptrdiff_t stride, const float* taps, int radius,
+                                                        float base, float* sums, T* dst)
 {
-    float avg = 0;
-    int first_index;
-    int range;
+    // down each column the across pass will read
+    for (int x = -radius; x < width + radius; x++)
+    {
+        float sum = 0;
 
-    for (int dy = -2, i = 0; dy <= 2; dy++, i++)
+        for (int k = 0; k <= 2 * radius; k++)
+            sum += taps[k] * (float)src[(k - radius) * stride + x];
+
+        sums[x + radius] = sum;
+    }// for
+
+    for (int x = 0; x < width; x++)
     {
-        first_index = (y + dy) * width;
+        float sum = 0;
 
-        for (int dx = -2, j = 0; dx <= 2; dx++, j++)
-        {
-            range = Mask_Pos_In_Range(x + dx, y + dy);
+        for (int k = 0; k <= 2 * radius; k++)
+            sum += taps[k] * sums[x + k];
 
-            if (range == -1) // x and y are not both in range
-            {
-                avg += (float)swatches[y * width + x] * (float)bartlett_filter_matrix[i][j] / 81.0f;
-            }
+        dst[x] = SPixelTraits<T>::From_Float(sum / base);
+    }// for
+}// Filter_Separable_Row
 
-            else if (range == 0) // x is not in range
-            {
-                if (y + dy < 0)
-                {
-                    if (y)
-                        avg += (float)swatches[(y - 1) * width + (x + dx)] * (float)bartlett_filter_matrix[i][j] / 81.0f;
-                    else
-                        avg += (float)swatches[y * width + (x + dx)] * (float)bartlett_filter_matrix[i][j] / 81.0f;
-                }
+template<> void TargaImage::Filter_Separable_Row<unsigned char>(const unsigned char* src, ptrdiff_t stride, const float* taps,
+                                                                int radius, float base, float* sums, unsigned char* dst)
+{
+    SKernels::Active().Convolve_V_Row(src - radius, stride, taps, radius, sums, width + 2 * radius);
+    SKernels::Active().Convolve_H_Row(sums + radius, taps, radius, base, dst, width);
+}// Filter_Separable_Row
+
+
+// How a window of some radius along a line of n pixels, made up past the
+// ends as a border mode says, comes down to one of a radius under 2n.
+// Clamped, a window wider than the line only adds more copies of the 
+// first and last pixels; wrapped or mirrored, the made up line repeats, so
+// whole periods come off both ends.  The window's sum is the reduced 
+// one's plus ends times the first and last pixels plus periods times the 
+// sum of a period.
+struct SBoxReduction
+{
+    int         reduced;    // radius of the window that is summed
+    long long   ends;       // extra copies of the first and of the last pixel
+    long long   periods;    // extra periods of the made up line
+};// SBoxReduction
 
-                else
-                {
-                    if (y == height - 2)
-                        avg += (float)swatches[(y + 1) * width + (x + dx)] * (float)bartlett_filter_matrix[i][j] / 81.0f;
-                    else
-                        avg += (float)swatches[y * width + (x + dx)] * (float)bartlett_filter_matrix[i][j] / 81.0f;
-                }
-            }
 
-            else if (range == 1) // y is not in range
-            {
-                if (x + dx < 0)
-                {
-                    if (x)
-                        avg += (float)swatches[(y + dy) * width + (x - 1)] * (float)bartlett_filter_matrix[i][j] / 81.0f;
-                    else
-                        avg += (float)swatches[(y + dy) * width + x] * (float)bartlett_filter_matrix[i][j] / 81.0f;
-                }
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Reduce a window of the given radius along a line of n pixels made 
+//  up past the ends as mode says.
+//
+///////////////////////////////////////////////////////////////////////////////
+static SBoxReduction Reduce_Box(int radius, int n, EBorderMode mode)
+{
+    SBoxReduction   reduction = { radius, 0, 0 };
+    int             period = mode == BORDER_WRAP ? n : 2 * (n - 1);
 
-                else
-                {
-                    if (x == width - 2)
-                        avg += (float)swatches[(y + dy) * width + (x + 1)] * (float)bartlett_filter_matrix[i][j] / 81.0f;
-                    else
-                        avg += (float)swatches[(y + dy) * width + x] * (float)bartlett_filter_matrix[i][j] / 81.0f;
-                }
-            }
+    if ((mode == BORDER_WRAP || mode == BORDER_MIRROR) && period > 0)
+    {
+        reduction.reduced = radius % period;
+        reduction.periods = 2 * (long long)(radius / period);
+    }// if
+    else if (radius > n - 1)
+    {
+        // clamped, or mirrored along a single pixel, which is the same
+        reduction.reduced = n - 1;
+        reduction.ends = radius - reduction.reduced;
+    }// else if
 
-            else // x and y are both in range
-            {
-                avg += (float)swatches[first_index + x + dx] * (float)bartlett_filter_matrix[i][j] / 81.0f;
-            }
-        }
-    }
+    return reduction;
+}// Reduce_Box
 
-    return (int)avg;
-}
 
 ///////////////////////////////////////////////////////////////////////////////
 //
-//      Perform 5x5 Bartlett filter on this image.  Return success of 
-//  operation.
+//      What a reduced window leaves out of the sum along a line, given the
+//  first and last pixels and the total of the line, which is only needed 
+//  if the reduction took off periods.
+//
+///////////////////////////////////////////////////////////////////////////////
+template<class TSum> static TSum Box_Extra(const SBoxReduction& reduction, TSum first, TSum last, TSum total, EBorderMode mode)
+{
+    TSum period = mode == BORDER_WRAP ? total : 2 * total - first - last;
+
+    return (TSum)reduction.ends * (first + last) + (TSum)reduction.periods * period;
+}// Box_Extra
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Filter the color planes of src into dst with the box of 
+//  2 * radius + 1 pixels a side, making up the pixels past the edges as
+//  the border mode says.  src needs no border: rows and columns past the
+//  edges are read from the ones Border_Source gives, and a radius wider 
+//  than the mode needs is reduced as Reduce_Box says.
+//
+//      A band of rows keeps a sum down each column of the box, which moves
+//  down a row by adding the row entering it and taking away the one 
+//  leaving, and each output pixel is a sum across those that moves along 
+//  the same way.  That is four adds a pixel whatever the radius, plus the
+//  column sums the first row of a band starts with, which reduction keeps
+//  under four times the image's height.  The sums are 64 bit, or double 
+//  for float planes, so for bytes and 8.8 fixed point they are exact and 
+//  the result is the true mean truncated.
 //
 ///////////////////////////////////////////////////////////////////////////////
-bool TargaImage::Filter_Bartlett()
+template<class T> void TargaImage::Filter_Box_Sums(const CPlanarBuffer<T>& src, CPlanarBuffer<T>& dst, int radius)
 {
-    int* r_swatches         =  new int[img_size];
-    int* g_swatches         =  new int[img_size];
-    int* b_swatches         =  new int[img_size];
-    int** fetch_near_color  =  new int* [5];
-    int fir_index;
+    typedef typename SPixelTraits<T>::TSum  TSum;
 
-    for (int i = 0; i < 5; i++)
-        fetch_near_color[i] = new int[5];
+    const EBorderMode   mode = border_mode;
+    const SBoxReduction down = Reduce_Box(radius, height, mode);
+    const SBoxReduction across = Reduce_Box(radius, width, mode);
+    const int           side = 2 * radius + 1;
+    const double        inverse = 1.0 / ((double)side * side);
+    vector<TSum>        totals;
 
-    for (int i = 0; i < data_array_size; i += 4)
+    // the total down every column, if periods come off the columns
+    if (down.periods)
     {
-        r_swatches[i / 4] = data[i];
-        g_swatches[i / 4] = data[i + 1];
-        b_swatches[i / 4] = data[i + 2];
-    }
+        totals.assign((size_t)width * 3, 0);
+        CThreadPool::Shared().Parallel_For(0, 3, 1, [&](int first, int last)
+        {
+            for (int c = first; c < last; c++)
+                for (int y = 0; y < height; y++)
+                    for (int x = 0; x < width; x++)
+                        totals[(size_t)c * width + x] += src.Row(c, y)[x];
+        });
+    }// if
 
-    for (int y = 0; y < height; y++)
+    // bands at least a few boxes tall, so starting the column sums off 
+    // stays a small part of the work
+    CThreadPool::Shared().Parallel_For(0, height * 3, std::max(Band_Rows(width), 4 * (2 * down.reduced + 1)), [&](int first, int last)
     {
-        fir_index = y * width * 4;
+        TSum *columns = CScratchArena::Thread().Allocate_Array<TSum>(width);
 
-        for (int x = 0; x < width; x++)
+        for (int i = first; i < last; i++)
         {
-            data[fir_index + x * 4]      =  Bartlett_Filter_Fetch_Value(x, y, r_swatches);
-            data[fir_index + x * 4 + 1]  =  Bartlett_Filter_Fetch_Value(x, y, g_swatches);
-            data[fir_index + x * 4 + 2]  =  Bartlett_Filter_Fetch_Value(x, y, b_swatches);
-        }
-    }
+            int c = i / height;
+            int y = i % height;
+            T*  row = dst.Row(c, y);
+            TSum sum = 0;
+            TSum extra = 0;
 
-    for (int i = 0; i < 5; i++)
-        delete fetch_near_color[i];
-    delete [] fetch_near_color;
+            if (i == first || y == 0)
+            {
+                for (int x = 0; x < width; x++)
+                    columns[x] = 0;
+                for (int k = -down.reduced; k <= down.reduced; k++)
+                {
+                    const T *line = src.Row(c, Border_Source(y + k, height, mode));
+
+                    for (int x = 0; x < width; x++)
+                        columns[x] += line[x];
+                }// for
+
+                if (down.ends || down.periods)
+                {
+                    const T *top = src.Row(c, 0);
+                    const T *bottom = src.Row(c, height - 1);
+
+                    for (int x = 0; x < width; x++)
+                        columns[x] += Box_Extra<TSum>(down, top[x], bottom[x], down.periods ? totals[(size_t)c * width + x] : 0, mode);
+                }// if
+            }// if
+            else
+            {
+                const T *entering = src.Row(c, Border_Source(y + down.reduced, height, mode));
+                const T *leaving = src.Row(c, Border_Source(y - down.reduced - 1, height, mode));
+
+                for (int x = 0; x < width; x++)
+                    columns[x] += (TSum)entering[x] - (TSum)leaving[x];
+            }// else
+
+            if (across.ends || across.periods)
+            {
+                TSum total = 0;
+
+                if (across.periods)
+                    for (int x = 0; x < width; x++)
+                        total += columns[x];
+                extra = Box_Extra<TSum>(across, columns[0], columns[width - 1], total, mode);
+            }// if
+
+            for (int x = -across.reduced; x < across.reduced; x++)
+                sum += columns[Border_Source(x, width, mode)];
+            for (int x = 0; x < width; x++)
+            {
+                sum += columns[Border_Source(x + across.reduced, width, mode)];
+                row[x] = SPixelTraits<T>::From_Sum(sum + extra, inverse);
+                sum -= columns[Border_Source(x - across.reduced, width, mode)];
+            }// for
+        }
+    });
+}// Filter_Box_Sums
 
-    delete [] r_swatches, delete [] b_swatches, delete [] g_swatches;
-    return true;
-}// Filter_Bartlett
 
 ///////////////////////////////////////////////////////////////////////////////
 //
-//      Calculate the value of color in n * m area 
-// with specific rate(Bartlett Filter)
-//      
+//      Filter the color planes of src into dst with Deriche's recursive 
+//  Gaussian, rows and then columns, at the same few multiply-adds a pixel
+//  whatever sigma is.  src's border must be Recursive_Pad(sigma) and 
+//  filled, and the filter runs through it so the edges come out as the
+//  border mode says.  Both passes run Deriche_Lines over many lines at 
+//  once, so its loops vectorize: the rows a few at a time, transposed into
+//  columns, and the columns in strips.
+//
 ///////////////////////////////////////////////////////////////////////////////
-int TargaImage::Bartlett_Filter_NM_Fetch_Value(int x, int y, int* swatches, int n, int m, int type, float base)
+template<class T> void TargaImage::Filter_Recursive_Gaussian(const CPlanarBuffer<T>& src, CPlanarBuffer<T>& dst, float sigma)
 {
-    float avg = 0;
-    int first_index;
-    int range;
-    int firsty, endy;
-    int firstx, endx;
-    firsty = n % 2 ? -n / 2 : -(n - 1) / 2;
-    endy = n / 2;
-    firstx = m % 2 ? -m / 2 : -(m - 1) / 2;
-    endx = m / 2;
-
-
-    for (int dy = firsty, i = 0; dy <= endy; dy++, i++)
+    const SDeriche      k = Deriche_Coefficients(sigma);
+    const int           pad = Recursive_Pad(sigma);
+    const int           span = height + 2 * pad;
+    const int           length = width + 2 * pad;
+    const int           groups = (span + c_rowGroup - 1) / c_rowGroup;
+    const int           strips = (width + c_stripColumns - 1) / c_stripColumns;
+    CPlanarBuffer<float> across(CScratchArena::Thread());
+
+    // the recursion lands a hair either side of the exact value, so flat
+    // areas would truncate a level low without a little rounding
+    const float         bias = std::numeric_limits<T>::is_integer ? SPixelTraits<T>::Max() / (255.0f * 64) : 0;
+
+    // whole strips wide, so the vertical pass never runs off a row
+    across.Resize(strips * c_stripColumns, height, 3, pad);
+
+    // across every row, the padding rows too
+    CThreadPool::Shared().Parallel_For(0, groups * 3, 1, [&](int first, int last)
     {
-        first_index = (y + dy) * width;
+        float   *in = CScratchArena::Thread().Allocate_Array<float>((size_t)length * c_rowGroup);
+        float   *out = CScratchArena::Thread().Allocate_Array<float>((size_t)length * c_rowGroup);
 
-        for (int dx = firstx, j = 0; dx <= endx; dx++, j++)
+        for (int i = first; i < last; i++)
         {
-            range = Mask_Pos_In_Range(x + dx, y + dy);
+            int c = i / groups;
+            int y0 = i % groups * c_rowGroup - pad;
+            int rows = std::min(c_rowGroup, height + pad - y0);
 
-            if (range == -1) // x and y are not both in range
-            {
-                avg += (float)swatches[y * width + x] * Find_Matrix_Val_With_Type(j, i, type) / base;
-            }
+            if (rows < c_rowGroup)
+                memset(in, 0, (size_t)length * c_rowGroup * sizeof(float));
 
-            else if (range == 0) // x is not in range
+            for (int r = 0; r < rows; r++)
             {
-                if (y + dy < 0)
-                {
-                    if (y)
-                        avg += (float)swatches[(y - 1) * width + (x + dx)] * Find_Matrix_Val_With_Type(j, i, type) / base;
-                    else
-                        avg += (float)swatches[y * width + (x + dx)] * Find_Matrix_Val_With_Type(j, i, type) / base;
-                }
+                const T *row = src.Row(c, y0 + r) - pad;
 
-                else
-                {
-                    if (y == height - 2)
-                        avg += (float)swatches[(y + 1) * width + (x + dx)] * Find_Matrix_Val_With_Type(j, i, type) / base;
-                    else
-                        avg += (float)swatches[y * width + (x + dx)] * Find_Matrix_Val_With_Type(j, i, type) / base;
-                }
-            }
+                for (int j = 0; j < length; j++)
+                    in[j * c_rowGroup + r] = (float)row[j];
+            }// for
+
+            Deriche_Lines<c_rowGroup>(k, in, c_rowGroup, out, c_rowGroup, length);
 
-            else if (range == 1) // y is not in range
+            for (int r = 0; r < rows; r++)
             {
-                if (x + dx < 0)
-                {
-                    if (x)
-                        avg += (float)swatches[(y + dy) * width + (x - 1)] * Find_Matrix_Val_With_Type(j, i, type) / base;
-                    else
-                        avg += (float)swatches[(y + dy) * width + x] * Find_Matrix_Val_With_Type(j, i, type) / base;
-                }
+                float *row = across.Row(c, y0 + r);
 
-                else
-                {
-                    if (x == width - 2)
-                        avg += (float)swatches[(y + dy) * width + (x + 1)] * Find_Matrix_Val_With_Type(j, i, type) / base;
-                    else
-                        avg += (float)swatches[(y + dy) * width + x] * Find_Matrix_Val_With_Type(j, i, type) / base;
-                }
-            }
+                for (int x = 0; x < width; x++)
+                    row[x] = out[(x + pad) * c_rowGroup + r];
+                for (int x = width; x < across.Width(); x++)
+                    row[x] = 0;
+            }// for
+        }
+    });
+
+    // then down strips of columns
+    CThreadPool::Shared().Parallel_For(0, strips * 3, 1, [&](int first, int last)
+    {
+        float *out = CScratchArena::Thread().Allocate_Array<float>((size_t)span * c_stripColumns);
+
+        for (int i = first; i < last; i++)
+        {
+            int c = i / strips;
+            int x0 = i % strips * c_stripColumns;
+            int columns = std::min(c_stripColumns, width - x0);
+
+            Deriche_Lines<c_stripColumns>(k, across.Row(c, -pad) + x0, across.Stride(), out, c_stripColumns, span);
 
-            else // x and y are both in range
+            for (int y = 0; y < height; y++)
             {
-                avg += (float)swatches[first_index + x + dx] * Find_Matrix_Val_With_Type(j, i, type) / base;
-            }
+                const float *line = out + (y + pad) * c_stripColumns;
+                T           *row = dst.Row(c, y) + x0;
+
+                for (int x = 0; x < columns; x++)
+                    row[x] = SPixelTraits<T>::From_Float(line[x] + bias);
+            }// for
         }
-    }
+    });
+}// Filter_Recursive_Gaussian
 
-    return avg > 255 ? 255 : (int)avg;
-}
 
 ///////////////////////////////////////////////////////////////////////////////
 //
-//      Perform n * m Bartlett filter on this image.  Return success of 
-//  operation.
+//      Pixels past every edge the planes must have for a kernel to read.
 //
 ///////////////////////////////////////////////////////////////////////////////
-bool TargaImage::Filter_Bartlett_NM(int type, int n, int m, float base)
+int TargaImage::Filter_Border(int kernel, int n)
 {
-    int* r_swatches = new int[img_size];
-    int* g_swatches = new int[img_size];
-    int* b_swatches = new int[img_size];
-    int fir_index;
+    switch (kernel)
+    {
+        case KERNEL_BOX:
+            return 0;
+        case KERNEL_GAUSSIAN_N:
+            return n > c_binomialMaxN ? Recursive_Pad(Gaussian_N_Sigma(n)) : n / 2;
+        case KERNEL_BINOMIAL_N:
+            return n / 2;
+        default:
+            return c_filterBorder;
+    }// switch
+}// Filter_Border
 
 
-    for (int i = 0; i < data_array_size; i += 4)
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Run one of the filter kernels over the color channels.  Bytes are
+//  filtered straight back into data, other pixel types into planes that are
+//  kept for the next filter.  Return success of operation.
+//
+///////////////////////////////////////////////////////////////////////////////
+bool TargaImage::Apply_Filter(int kernel, int n)
+{
+    switch (pixel_type)
     {
-        r_swatches[i / 4] = data[i];
-        g_swatches[i / 4] = data[i + 1];
-        b_swatches[i / 4] = data[i + 2];
-    }
+        case PIXEL_UINT16:
+            return Apply_Filter_As(planes16, kernel, n);
+        case PIXEL_FLOAT:
+            return Apply_Filter_As(planes_float, kernel, n);
+        default:
+            break;
+    }// switch
 
-    for (int y = 0; y < height; y++)
-    {
-        fir_index = y * width * 4;
+    Unshare();
+    CPlanarBuffer<unsigned char> planes(CScratchArena::Thread());
+    CPlanarBuffer<unsigned char> result(CScratchArena::Thread());
 
-        for (int x = 0; x < width; x++)
-        {
-            data[fir_index + x * 4]     = Bartlett_Filter_NM_Fetch_Value(x, y, r_swatches, n, m, type, base);
-            data[fir_index + x * 4 + 1] = Bartlett_Filter_NM_Fetch_Value(x, y, g_swatches, n, m, type, base);
-            data[fir_index + x * 4 + 2] = Bartlett_Filter_NM_Fetch_Value(x, y, b_swatches, n, m, type, base);
-        }
-    }
+    planes.Deinterleave(data, stride, width, height, Filter_Border(kernel, n));
+    planes.Fill_Border(border_mode);
+    result.Resize(width, height);
+    Filter_Planes(planes, result, kernel, n);
+    result.Interleave(data, stride);
 
-    delete[] r_swatches, delete[] b_swatches, delete[] g_swatches;
     return true;
-}
+}// Apply_Filter
+
 
 ///////////////////////////////////////////////////////////////////////////////
 //
-//      Perform 5x5 Gaussian filter on this image.  Return success of 
+//      Run a filter kernel over the planes in work, starting them from data
+//  if there are none, and leave the result in work.  data is not touched,
+//  so it goes out of date until Load_Data or Unshare.  Return success of
 //  operation.
 //
 ///////////////////////////////////////////////////////////////////////////////
-bool TargaImage::Filter_Gaussian()
+template<class T> bool TargaImage::Apply_Filter_As(CPlanarBuffer<T>*& work, int kernel, int n)
 {
-    int* r_swatches = new int[img_size];
-    int* g_swatches = new int[img_size];
-    int* b_swatches = new int[img_size];
-    int** fetch_near_color = new int* [5];
-    int fir_index;
-
-    for (int i = 0; i < 5; i++)
-        fetch_near_color[i] = new int[5];
+    CPlanarBuffer<T>    *result;
+    int                 border = Filter_Border(kernel, n);
 
-    for (int i = 0; i < data_array_size; i += 4)
+    if (!work)
     {
-        r_swatches[i / 4] = data[i];
-        g_swatches[i / 4] = data[i + 1];
-        b_swatches[i / 4] = data[i + 2];
-    }
+        if (!Load_Data())
+            return false;
 
-    for (int y = 0; y < height; y++)
+        work = new CPlanarBuffer<T>();
+        work->Deinterleave(data, stride, width, height, border);
+    }// if
+    else if (work->Border() < border)
     {
-        fir_index = y * width * 4;
+        CPlanarBuffer<T> *wider = new CPlanarBuffer<T>();
 
-        for (int x = 0; x < width; x++)
-        {
-            data[fir_index + x * 4]     = Gaussian_Filter_Fetch_Value(x, y, r_swatches);
-            data[fir_index + x * 4 + 1] = Gaussian_Filter_Fetch_Value(x, y, g_swatches);
-            data[fir_index + x * 4 + 2] = Gaussian_Filter_Fetch_Value(x, y, b_swatches);
-        }
-    }
+        wider->Copy(*work, border);
+        delete work;
+        work = wider;
+    }// else if
+
+    // the mode may have changed since work was filled
+    work->Fill_Border(border_mode);
 
-    for (int i = 0; i < 5; i++)
-        delete fetch_near_color[i];
-    delete[] fetch_near_color;
+    result = new CPlanarBuffer<T>();
+    result->Resize(width, height, 3, c_filterBorder);
+    Filter_Planes(*work, *result, kernel, n);
+
+    delete work;
+    work = result;
 
-    delete[] r_swatches, delete[] b_swatches, delete[] g_swatches;
     return true;
-}// Filter_Gaussian
+}// Apply_Filter_As
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Choose the type filters keep their results in.  Planes left by the
+//  last filter are stored into data first.
+//
+///////////////////////////////////////////////////////////////////////////////
+void TargaImage::Set_Pixel_Type(EPixelType type)
+{
+    if (type != pixel_type)
+        Load_Data();
+
+    pixel_type = type;
+}// Set_Pixel_Type
 
 ///////////////////////////////////////////////////////////////////////////////
 //
-//      Perform NxN Gaussian filter on this image.  Return success of 
+//      Perform 5x5 Gaussian filter on this image.  Return success of 
 //  operation.
 //
 ///////////////////////////////////////////////////////////////////////////////
+bool TargaImage::Filter_Gaussian()
+{
+    return Apply_Filter(KERNEL_REGISTERED, REGISTERED_GAUSSIAN);
+}// Filter_Gaussian
 
-bool TargaImage::Filter_Gaussian_N( unsigned int N )
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Perform NxN Gaussian filter on this image, N odd.  Up to 
+//  c_binomialMaxN the kernel is the binomial one, which the 5x5 Gaussian
+//  is the N = 5 case of; byte results are exact up to N = 9.  Beyond that
+//  a recursive filter with the binomial's standard deviation, 
+//  sqrt(N - 1) / 2, is used, so the cost stays the same for any N.  
+//  bBinomial forces the binomial kernel, at a cost linear in N.  Return 
+//  success of operation.
+//
+///////////////////////////////////////////////////////////////////////////////
+bool TargaImage::Filter_Gaussian_N(unsigned int N, bool bBinomial)
 {
-    ClearToBlack();
-   return false;
+    if (N % 2 == 0)
+        return false;
+
+    return Apply_Filter(bBinomial ? KERNEL_BINOMIAL_N : KERNEL_GAUSSIAN_N, (int)N);
 }// Filter_Gaussian_N
 
 
@@ -1388,43 +2157,37 @@ bool TargaImage::NPR_Paint()
 ///////////////////////////////////////////////////////////////////////////////
 bool TargaImage::Half_Size()
 {
-    Filter_Bartlett_NM(1, 3, 3, 16);
+    // the filter may leave its result in planes
+    if (!Apply_Filter(KERNEL_REGISTERED, REGISTERED_HALF) || !Load_Data())
+        return false;
 
-    int* half_img = new int[img_size]();
-    int fir_index, tfir_index;
+    // build the result as an image of its own, then move it into this one
+    TargaImage half;
 
-    int new_index = 0;
-    for (int y = 0; y < height; y ++)
-    {
-        fir_index = y * width * 4;
+    half.Copy_Settings(*this);
+    half.Allocate_Data(width / 2, height / 2);
 
-        for (int x = 0; x < width; x ++)
+    // keep the pixels at odd x and odd y
+    CThreadPool::Shared().Parallel_For(0, half.height, Band_Rows(half.width), [&](int first, int last)
+    {
+        for (int y = first * 2 + 1; y < last * 2 + 1; y += 2)
         {
-            if (!(x % 2) || !(y % 2))
-                continue;
+            unsigned char *row = Row(y);
+            unsigned char *half_row = half.Row(y / 2);
 
-            tfir_index = fir_index + x * 4;
-
-            half_img[new_index  ]  =  data[tfir_index    ];
-            half_img[++new_index]  =  data[tfir_index + 1];
-            half_img[++new_index]  =  data[tfir_index + 2];
-            half_img[++new_index]  =  255;
-            new_index++;
+            for (int x = 1; x < width; x += 2)
+            {
+                half_row[0]  =  row[x * 4    ];
+                half_row[1]  =  row[x * 4 + 1];
+                half_row[2]  =  row[x * 4 + 2];
+                half_row[3]  =  255;
+                half_row += 4;
+            }
         }
-    }
+    });
 
-    delete [] data;
-    data = new unsigned char[img_size]();
+    *this = std::move(half);
 
-    for (int i = 0; i < img_size; i++)
-        data[i] = half_img[i];
-
-    width /= 2;
-    height /= 2;
-    img_size = width * height;
-    data_array_size = img_size * 4;
-
-    delete [] half_img;
     return true;
 }// Half_Size
 
@@ -1433,76 +2196,73 @@ bool TargaImage::Half_Size()
 //
 //      Double the dimensions of this image.  Return success of operation.
 //
+//      Pixel (x, y) of the result comes from around pixel (x / 2, y / 2):
+//  the 3x3 kernel where x and y are both odd, the 4x4 one where both are
+//  even and the 4x3 one otherwise.  All three are separable, and the 4x3
+//  and 4x4 ones have the same taps down, so each source row takes two
+//  passes down and three across, in fixed point, for its two result rows.
+//
 ///////////////////////////////////////////////////////////////////////////////
 bool TargaImage::Double_Size()
 { 
-    int* r_swatches = new int[img_size];
-    int* g_swatches = new int[img_size];
-    int* b_swatches = new int[img_size];
+    if (!Load_Data())
+        return false;
 
-    for (int i = 0; i < data_array_size; i += 4)
-    {
-        r_swatches[i / 4] = data[i];
-        g_swatches[i / 4] = data[i + 1];
-        b_swatches[i / 4] = data[i + 2];
-    }
+    CPlanarBuffer<unsigned char> planes(CScratchArena::Thread());
 
-    data_array_size *= 4;
+    planes.Deinterleave(data, stride, width, height, c_filterBorder);
+    planes.Fill_Border(border_mode);
 
-    int* double_img = new int[data_array_size]();
-    int new_img_index, old_img_index;
-    int tnew_img_index, told_img_index;
-    int double_width = width * 2;
-    int double_height = height * 2;
-    int red_val, green_val, blue_val;
+    // build the result as an image of its own, then move it into this one
+    TargaImage doubled;
+    doubled.Copy_Settings(*this);
+    doubled.Allocate_Data(width * 2, height * 2);
 
-    for (int y = 0; y < double_height; y++)
+    CThreadPool::Shared().Parallel_For(0, height, Band_Rows(width * 4), [&](int first, int last)
     {
-        new_img_index = y * double_width * 4;
-        old_img_index = width * (y / 2) * 4;
-
-        for (int x = 0; x < double_width; x++)
+        const SKernels  &kernels = SKernels::Active();
+        const int       left = TCubicTaps::first;                   // column the sums start at
+        const int       columns = width + TCubicTaps::count - 1;
+        CScratchArena   &arena = CScratchArena::Thread();
+        unsigned short  *tentSums = arena.Allocate_Array<unsigned short>(columns);
+        unsigned short  *cubicSums = arena.Allocate_Array<unsigned short>(columns);
+        unsigned char   *center = arena.Allocate_Array<unsigned char>(width);
+        unsigned char   *edge = arena.Allocate_Array<unsigned char>(width);
+        unsigned char   *corner = arena.Allocate_Array<unsigned char>(width);
+
+        for (int y = first; y < last; y++)
         {
-            tnew_img_index = new_img_index + 4 * x;
-            told_img_index = old_img_index + (x / 2) * 4;
-
-            if (y % 2 && x % 2)
-            {
-                red_val = Bartlett_Filter_NM_Fetch_Value(x / 2, y / 2, r_swatches, 3, 3, 2, 16);
-                green_val = Bartlett_Filter_NM_Fetch_Value(x / 2, y / 2, g_swatches, 3, 3, 2, 16);
-                blue_val = Bartlett_Filter_NM_Fetch_Value(x / 2, y / 2, b_swatches, 3, 3, 2, 16);
-            }
-
-            else if (y % 2 || x % 2)
-            {
-                red_val = Bartlett_Filter_NM_Fetch_Value(x / 2, y / 2, r_swatches, 4, 3, 4, 32);
-                green_val = Bartlett_Filter_NM_Fetch_Value(x / 2, y / 2, g_swatches, 4, 3, 4, 32);
-                blue_val = Bartlett_Filter_NM_Fetch_Value(x / 2, y / 2, b_swatches, 4, 3, 4, 32);
-            }
+            unsigned char *even_row = doubled.Row(y * 2);
+            unsigned char *odd_row = doubled.Row(y * 2 + 1);
 
-            else
+            for (int c = 0; c < 3; c++)
             {
-                red_val = Bartlett_Filter_NM_Fetch_Value(x / 2, y / 2, r_swatches, 4, 4, 3, 64);
-                green_val = Bartlett_Filter_NM_Fetch_Value(x / 2, y / 2, g_swatches, 4, 4, 3, 64);
-                blue_val = Bartlett_Filter_NM_Fetch_Value(x / 2, y / 2, b_swatches, 4, 4, 3, 64);
-            }
-
-            double_img[tnew_img_index    ]  =  red_val;
-            double_img[tnew_img_index + 1]  =  green_val;
-            double_img[tnew_img_index + 2]  =  blue_val;
-            double_img[tnew_img_index + 3]  =  255;
+                kernels.Fixed_V_Row(planes.Row(c, y + TTentTaps::first) + left, planes.Stride(), TTentTaps::fixed, TTentTaps::count,
+                                    tentSums, columns);
+                kernels.Fixed_V_Row(planes.Row(c, y + TCubicTaps::first) + left, planes.Stride(), TCubicTaps::fixed, 
+                                    TCubicTaps::count, cubicSums, columns);
+                kernels.Fixed_H_Row(tentSums, TTentTaps::fixed, TTentTaps::count, THalfFixedKernel::multiplier,
+                                    THalfFixedKernel::shift, center, width);
+                kernels.Fixed_H_Row(cubicSums, TTentTaps::fixed, TTentTaps::count, TDoubleEdgeKernel::multiplier,
+                                    TDoubleEdgeKernel::shift, edge, width);
+                kernels.Fixed_H_Row(cubicSums, TCubicTaps::fixed, TCubicTaps::count, TDoubleCornerKernel::multiplier, 
+                                    TDoubleCornerKernel::shift, corner, width);
+
+                for (int x = 0; x < width; x++)
+                {
+                    even_row[8 * x + c] = corner[x];
+                    even_row[8 * x + 4 + c] = edge[x];
+                    odd_row[8 * x + c] = edge[x];
+                    odd_row[8 * x + 4 + c] = center[x];
+                }// for
+            }// for
+
+            for (int x = 0; x < width * 2; x++)
+                even_row[4 * x + 3] = odd_row[4 * x + 3] = 255;
         }
-    }
-
-    width = double_width;
-    height = double_height;
-    img_size *= 4;
-
-    delete [] data;
-    data = new unsigned char[data_array_size];
+    });
 
-    for (int i = 0; i < data_array_size; i++)
-        data[i] = double_img[i];
+    *this = std::move(doubled);
 
     return true;
 }// Double_Size
@@ -1534,77 +2294,339 @@ bool TargaImage::Rotate(float angleDegrees)
 }// Rotate
 
 
-//////////////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Copy this into a new image, reversing the rows as it goes. A pointer
+//  to the new image is returned.
+//
+///////////////////////////////////////////////////////////////////////////////
+TargaImage* TargaImage::Reverse_Rows(void)
+{
+    TargaImage	    *result;
+    int 	        i;
+
+    if (! Load_Data())
+    	return NULL;
+
+    // the rows go straight into the new image's own storage
+    result = new TargaImage();
+    result->Allocate_Data(width, height);
+
+    for (i = 0 ; i < height ; i++)
+	    memcpy(result->Row(i), Row(height - i - 1), (size_t)width * 4);
+
+    return result;
+}// Reverse_Rows
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Replace the pixel storage with an uninitialized w x h buffer, with
+//  border pixels of apron around every edge.  Every row, and the first 
+//  pixel of every row, starts on a 64 byte boundary.
+//
+///////////////////////////////////////////////////////////////////////////////
+void TargaImage::Allocate_Data(int w, int h, int border)
+{
+    size_t  left = ((size_t)border * 4 + c_rowAlignment - 1) & ~(c_rowAlignment - 1);
+    size_t  right = (size_t)(w + border) * 4;
+    size_t  base;
+
+    Release_Data();
+
+    width = w;
+    height = h;
+    apron = border;
+    img_size = (size_t)width * height;
+    stride = (left + right + c_rowAlignment - 1) & ~(c_rowAlignment - 1);
+    data_array_size = stride * height;
+
+    storage = new unsigned char[stride * (height + 2 * apron) + c_rowAlignment - 1];
+    base = ((size_t)storage + c_rowAlignment - 1) & ~(c_rowAlignment - 1);
+    data = (unsigned char*)base + stride * apron + left;
+}// Allocate_Data
+
+
+///////////////////////////////////////////////////////////////////////////////
 //
-//      Given a single RGBA pixel return, via the second argument, the RGB
-//      equivalent composited with a black background.
+//      Replace the pixel storage with a copy of image's, apron included.
 //
 ///////////////////////////////////////////////////////////////////////////////
-void TargaImage::RGBA_To_RGB(unsigned char *rgba, unsigned char *rgb)
+void TargaImage::Copy_Data(const TargaImage& image)
 {
-    const unsigned char	BACKGROUND[3] = { 0, 0, 0 };
+    size_t span = (size_t)(image.width + 2 * image.apron) * 4;
+
+    Allocate_Data(image.width, image.height, image.apron);
+
+    for (int y = -apron; y < height + apron; y++)
+        memcpy(Row(y) - apron * 4, image.Row(y) - apron * 4, span);
+}// Copy_Data
+
 
-    unsigned char  alpha = rgba[3];
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Give the image size pixels of storage beyond every edge and make
+//  them up from the image as mode says, so that neighborhoods reaching past
+//  the edge can be read without bounds checks.  The apron is not kept up to
+//  date as the pixels change; call this again to refresh it.  Return
+//  success of operation.
+//
+///////////////////////////////////////////////////////////////////////////////
+bool TargaImage::Set_Apron(int size, EBorderMode mode)
+{
+    if (size < 0 || !Load_Data())
+        return false;
 
-    if (alpha == 0)
+    if (size != apron)
     {
-        rgb[0] = BACKGROUND[0];
-        rgb[1] = BACKGROUND[1];
-        rgb[2] = BACKGROUND[2];
-    }
+        TargaImage result;
+
+        result.Copy_Settings(*this);
+        result.Allocate_Data(width, height, size);
+        for (int y = 0; y < height; y++)
+            memcpy(result.Row(y), Row(y), (size_t)width * 4);
+
+        *this = std::move(result);
+    }// if
     else
+        Unshare();
+
+    // sides first, then whole rows, apron included, above and below
+    for (int y = 0; y < height; y++)
     {
-	    float	alpha_scale = (float)255 / (float)alpha;
-	    int	val;
-	    int	i;
-
-	    for (i = 0 ; i < 3 ; i++)
-	    {
-	        val = (int)floor(rgba[i] * alpha_scale);
-	        if (val < 0)
-		    rgb[i] = 0;
-	        else if (val > 255)
-		    rgb[i] = 255;
-	        else
-		    rgb[i] = val;
-	    }
-    }
-}// RGA_To_RGB
+        unsigned char *row = Row(y);
+
+        for (int x = 1; x <= apron; x++)
+        {
+            memcpy(row - x * 4, row + Border_Source(-x, width, mode) * 4, 4);
+            memcpy(row + (width - 1 + x) * 4, row + Border_Source(width - 1 + x, width, mode) * 4, 4);
+        }// for
+    }// for
+
+    for (int y = 1; y <= apron; y++)
+    {
+        memcpy(Row(-y) - apron * 4, Row(Border_Source(-y, height, mode)) - apron * 4, (size_t)(width + 2 * apron) * 4);
+        memcpy(Row(height - 1 + y) - apron * 4, Row(Border_Source(height - 1 + y, height, mode)) - apron * 4, (size_t)(width + 2 * apron) * 4);
+    }// for
+
+    return true;
+}// Set_Apron
 
 
 ///////////////////////////////////////////////////////////////////////////////
 //
-//      Copy this into a new image, reversing the rows as it goes. A pointer
-//  to the new image is returned.
+//      Free the pixel storage.  Mapped cache files are unmapped rather than
+//  deleted.
 //
 ///////////////////////////////////////////////////////////////////////////////
-TargaImage* TargaImage::Reverse_Rows(void)
+void TargaImage::Release_Data()
 {
-    unsigned char   *dest = new unsigned char[width * height * 4];
-    TargaImage	    *result;
-    int 	        i, j;
+    if (source)
+    {
+        delete[] source;
+        source = NULL;
+    }// if
 
-    if (! data)
-    	return NULL;
+    if (shared)
+    {
+        // the last image using shared pixels frees them
+        if (--shared->refs == 0)
+        {
+            if (shared->cache)
+                delete shared->cache;
+            else
+                delete[] shared->storage;
+            delete shared;
+        }// if
+        shared = NULL;
+    }// if
+    else if (cache)
+    {
+        delete cache;
+        cache = NULL;
+    }// if
+    else if (storage)
+    {
+        delete[] storage;
+        storage = NULL;
+    }// else if
 
-    for (i = 0 ; i < height ; i++)
+    delete gray;
+    delete planes16;
+    delete planes_float;
+    gray = NULL;
+    planes16 = NULL;
+    planes_float = NULL;
+
+    data = NULL;
+    apron = 0;
+}// Release_Data
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Take over the pixels, size and settings of image, which is left 
+//  empty.  Any pixels this image had must already be released.
+//
+///////////////////////////////////////////////////////////////////////////////
+void TargaImage::Take_Data(TargaImage& image)
+{
+    Copy_Settings(image);
+    width = image.width;
+    height = image.height;
+    img_size = image.img_size;
+    data_array_size = image.data_array_size;
+    stride = image.stride;
+    data = image.data;
+    storage = image.storage;
+    apron = image.apron;
+    cache = image.cache;
+    source = image.source;
+    shared = image.shared;
+    gray = image.gray;
+    planes16 = image.planes16;
+    planes_float = image.planes_float;
+
+    image.width = image.height = image.apron = 0;
+    image.img_size = image.data_array_size = image.stride = 0;
+    image.data = NULL;
+    image.storage = NULL;
+    image.cache = NULL;
+    image.source = NULL;
+    image.shared = NULL;
+    image.gray = NULL;
+    image.planes16 = NULL;
+    image.planes_float = NULL;
+}// Take_Data
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      A heap copy of planes, or NULL if there are none.
+//
+///////////////////////////////////////////////////////////////////////////////
+template<class T> static CPlanarBuffer<T>* Copy_Of(const CPlanarBuffer<T>* planes)
+{
+    CPlanarBuffer<T> *copy = NULL;
+
+    if (planes)
+    {
+        copy = new CPlanarBuffer<T>();
+        copy->Copy(*planes, planes->Border());
+    }// if
+
+    return copy;
+}// Copy_Of
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Replace the gray and filter planes with copies of image's, so this 
+//  image's data is as stale as image's is.  The borders are filled before
+//  they are next read.
+//
+///////////////////////////////////////////////////////////////////////////////
+void TargaImage::Copy_Planes(const TargaImage& image)
+{
+    delete gray;
+    delete planes16;
+    delete planes_float;
+    gray = Copy_Of(image.gray);
+    planes16 = Copy_Of(image.planes16);
+    planes_float = Copy_Of(image.planes_float);
+}// Copy_Planes
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Take the pixel type and border mode of image, which decide how this
+//  image's filters run.
+//
+///////////////////////////////////////////////////////////////////////////////
+void TargaImage::Copy_Settings(const TargaImage& image)
+{
+    pixel_type = image.pixel_type;
+    border_mode = image.border_mode;
+}// Copy_Settings
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Make sure no other image shares the pixels, copying them if another 
+//  does, and store any gray or filter planes into them.  An image from 
+//  Open_Image is decoded first, so data is there to write to.  Everything
+//  that writes to data calls this first.
+//
+///////////////////////////////////////////////////////////////////////////////
+void TargaImage::Unshare()
+{
+    // an image from Open_Image has no planes, so Load_Data won't come back here
+    if (source && !Load_Data())
+        return;
+
+    if (shared && shared->refs == 1)
+    {
+        // everyone else let go, so the pixels are ours again
+        cache = shared->cache;
+        storage = shared->storage;
+        delete shared;
+        shared = NULL;
+    }// if
+    else if (shared)
     {
-	    int in_offset = (height - i - 1) * width * 4;
-	    int out_offset = i * width * 4;
+        TargaImage copy;
+        copy.Copy_Settings(*this);
+        copy.Copy_Data(*this);
+
+        // planes are never shared, keep them
+        std::swap(gray, copy.gray);
+        std::swap(planes16, copy.planes16);
+        std::swap(planes_float, copy.planes_float);
+        Release_Data();
+        Take_Data(copy);
+    }// else if
+
+    if (gray)
+        Expand_Gray();
+
+    if (planes16)
+    {
+        planes16->Interleave(data, stride);
+        delete planes16;
+        planes16 = NULL;
+    }// if
+
+    if (planes_float)
+    {
+        planes_float->Interleave(data, stride);
+        delete planes_float;
+        planes_float = NULL;
+    }// if
+}// Unshare
+
 
-	    for (j = 0 ; j < width ; j++)
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Write the gray plane into the color channels of data and free it.
+//  data must not be shared.
+//
+///////////////////////////////////////////////////////////////////////////////
+void TargaImage::Expand_Gray()
+{
+    CThreadPool::Shared().Parallel_For(0, height, Band_Rows(width), [&](int first, int last)
+    {
+        for (int y = first; y < last; y++)
         {
-	        dest[out_offset + j * 4] = data[in_offset + j * 4];
-	        dest[out_offset + j * 4 + 1] = data[in_offset + j * 4 + 1];
-	        dest[out_offset + j * 4 + 2] = data[in_offset + j * 4 + 2];
-	        dest[out_offset + j * 4 + 3] = data[in_offset + j * 4 + 3];
+            unsigned char* row = Row(y);
+            const unsigned char* g = gray->Row(0, y);
+            for (int x = 0; x < width; x++, row += 4)
+                row[0] = row[1] = row[2] = g[x];
         }
-    }
+    });
 
-    result = new TargaImage(width, height, dest);
-    delete[] dest;
-    return result;
-}// Reverse_Rows
+    delete gray;
+    gray = NULL;
+}// Expand_Gray
 
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -1614,7 +2636,9 @@ TargaImage* TargaImage::Reverse_Rows(void)
 ///////////////////////////////////////////////////////////////////////////////
 void TargaImage::ClearToBlack()
 {
-    memset(data, 0, width * height * 4);
+    Unshare();
+    for (int y = 0; y < height; y++)
+        memset(Row(y), 0, (size_t)width * 4);
 }// ClearToBlack
 
 
@@ -1625,6 +2649,7 @@ void TargaImage::ClearToBlack()
 //
 ///////////////////////////////////////////////////////////////////////////////
 void TargaImage::Paint_Stroke(const Stroke& s) {
+   Unshare();
    int radius_squared = (int)s.radius * (int)s.radius;
    for (int x_off = -((int)s.radius); x_off <= (int)s.radius; x_off++) {
       for (int y_off = -((int)s.radius); y_off <= (int)s.radius; y_off++) {
@@ -1634,19 +2659,19 @@ void TargaImage::Paint_Stroke(const Stroke& s) {
          if ((x_loc >= 0 && x_loc < width && y_loc >= 0 && y_loc < height)) {
             int dist_squared = x_off * x_off + y_off * y_off;
             if (dist_squared <= radius_squared) {
-               data[(y_loc * width + x_loc) * 4 + 0] = s.r;
-               data[(y_loc * width + x_loc) * 4 + 1] = s.g;
-               data[(y_loc * width + x_loc) * 4 + 2] = s.b;
-               data[(y_loc * width + x_loc) * 4 + 3] = s.a;
+               Row(y_loc)[x_loc * 4 + 0] = s.r;
+               Row(y_loc)[x_loc * 4 + 1] = s.g;
+               Row(y_loc)[x_loc * 4 + 2] = s.b;
+               Row(y_loc)[x_loc * 4 + 3] = s.a;
             } else if (dist_squared == radius_squared + 1) {
-               data[(y_loc * width + x_loc) * 4 + 0] = 
-                  (data[(y_loc * width + x_loc) * 4 + 0] + s.r) / 2;
-               data[(y_loc * width + x_loc) * 4 + 1] = 
-                  (data[(y_loc * width + x_loc) * 4 + 1] + s.g) / 2;
-               data[(y_loc * width + x_loc) * 4 + 2] = 
-                  (data[(y_loc * width + x_loc) * 4 + 2] + s.b) / 2;
-               data[(y_loc * width + x_loc) * 4 + 3] = 
-                  (data[(y_loc * width + x_loc) * 4 + 3] + s.a) / 2;
+               Row(y_loc)[x_loc * 4 + 0] = 
+                  (Row(y_loc)[x_loc * 4 + 0] + s.r) / 2;
+               Row(y_loc)[x_loc * 4 + 1] = 
+                  (Row(y_loc)[x_loc * 4 + 1] + s.g) / 2;
+               Row(y_loc)[x_loc * 4 + 2] = 
+                  (Row(y_loc)[x_loc * 4 + 2] + s.b) / 2;
+               Row(y_loc)[x_loc * 4 + 3] = 
+                  (Row(y_loc)[x_loc * 4 + 3] + s.a) / 2;
             }
          }
       }
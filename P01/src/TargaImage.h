@@ -15,10 +15,24 @@
 #include <Fl/Fl.h>
 #include <Fl/Fl_Widget.h>
 #include <stdio.h>
+#include <stddef.h>
 #include <utility>
+#include "PlanarBuffer.h"
 
 class Stroke;
 class DistanceImage;
+class CImageCache;
+
+// what filters keep their results in.  Bytes are stored straight into data
+// after every filter; the others stay in planes, 8.8 fixed point or float
+// on the 0 to 255 scale, until Load_Data so chained filters aren't 
+// quantized in between.
+enum EPixelType
+{
+    PIXEL_UINT8,
+    PIXEL_UINT16,
+    PIXEL_FLOAT
+};
 
 class TargaImage
 {
@@ -28,13 +42,34 @@ class TargaImage
             TargaImage(int w, int h);
 	    TargaImage(int w, int h, unsigned char *d);
             TargaImage(const TargaImage& image);
+            TargaImage(TargaImage&& image);
 	    ~TargaImage(void);
 
+        TargaImage& operator=(const TargaImage& image);
+        TargaImage& operator=(TargaImage&& image);
+
+        TargaImage Share();                         // A copy that shares these pixels until either image is changed
+        void Unshare();                             // Decode pending pixels, stop sharing them, copying them if needed, and store gray or filter planes.  Call before writing to data directly
+
         unsigned char*	To_RGB(void);	            // Convert the image to RGB format,
-        bool Save_Image(const char*);               // save the image to a file
-        static TargaImage* Load_Image(char*);       // Load a file and return a pointer to a new TargaImage object.  Returns NULL on failure
+        bool Save_Image(const char*, bool bRLE = false);    // save the image to a file, optionally run-length encoded.  .tic files are saved as caches
+        static TargaImage* Load_Image(char*);       // Load a file and return a pointer to a new TargaImage object.  Returns NULL on failure.  .tic files are mapped
+        static TargaImage* Open_Image(char*);       // Like Load_Image, but only the header is read until Load_Data is called
+        bool Load_Data();                           // Make data hold the pixels, decoding an image from Open_Image or storing gray or filter planes if needed.  Returns false on failure
+
+        unsigned char*          Row(int y)          { return data + (ptrdiff_t)y * (ptrdiff_t)stride; }    // First pixel of row y
+        const unsigned char*    Row(int y) const    { return data + (ptrdiff_t)y * (ptrdiff_t)stride; }
+        int Apron() const                           { return apron; }   // Pixels of storage beyond every edge.  Rows -Apron() to height + Apron() - 1 are valid, and so are Apron() pixels either side of each
+        bool Set_Apron(int size, EBorderMode mode = BORDER_CLAMP);  // Give the image an apron of size pixels, made up from the image as mode says
+
+        bool To_Grayscale();                        // Leaves the gray values in a plane, see Is_Gray
+        bool Is_Gray() const                        { return gray != NULL; }    // Are the pixels in a gray plane, with data's colors out of date until Load_Data?
+
+        void Set_Pixel_Type(EPixelType type);       // Choose what filters keep their results in, see EPixelType
+        EPixelType Pixel_Type() const               { return pixel_type; }
 
-        bool To_Grayscale();
+        void Set_Border_Mode(EBorderMode mode)      { border_mode = mode; }     // Choose how filters and resampling make up pixels past the edges
+        EBorderMode Border_Mode() const             { return border_mode; }
 
         bool Quant_Uniform();
         bool Quant_Populosity();
@@ -43,7 +78,7 @@ class TargaImage
         bool Dither_Threshold();
         bool Dither_Random();
         bool Dither_FS();
-        bool Dither_FS_Swatches(float* swatch, int type);
+        bool Dither_FS_Swatches(float* swatch, ptrdiff_t stride, int type);
         bool Dither_Bright();
         bool Dither_Cluster();
         bool Dither_Color();
@@ -57,10 +92,10 @@ class TargaImage
         bool Difference(TargaImage* pImage);
 
         bool Filter_Box();
+        bool Filter_Box_R(int radius);
         bool Filter_Bartlett();
-        bool Filter_Bartlett_NM(int type, int n, int m, float base);
         bool Filter_Gaussian();
-        bool Filter_Gaussian_N(unsigned int N);
+        bool Filter_Gaussian_N(unsigned int N, bool bBinomial = false);    // bBinomial forces the exact kernel at any N, see the definition
         bool Filter_Edge();
         bool Filter_Enhance();
 
@@ -117,60 +152,30 @@ class TargaImage
             0, 85, 170, 255
         };
 
-        float  bartlett_filter_matrix[5][5] =
-        {
-            {1, 2, 3, 2, 1},
-            {2, 4, 6, 4, 2},
-            {3, 6, 9, 6, 3},
-            {2, 4, 6, 4, 2},
-            {1, 2, 3, 2, 1}
-        };
+    private:
+        // reverse the rows of the image, some targas are stored bottom to top
+	TargaImage* Reverse_Rows(void);
 
-        float gaussian_filter_matrix[5][5] = 
-        {
-            {1,  4,  6,  4, 1},
-            {4, 16, 24, 16, 4},
-            {6, 24, 36, 24, 6},
-            {4, 16, 24, 16, 4},
-            {1,  4,  6,  4, 1}
-        };
+	// replace the pixel storage with an uninitialized w x h buffer with 64 byte aligned rows, and border pixels of apron
+        void Allocate_Data(int w, int h, int border = 0);
 
-        float half_filter_matrix[3][3] =
-        {
-            {1, 2, 1},
-            {2, 4, 2},
-            {1, 2, 1}
-        };
+	// replace the pixel storage with a copy of image's
+        void Copy_Data(const TargaImage& image);
 
-        float double_filter_matrix1[3][3] =
-        {
-            {1, 2, 1},
-            {2, 4, 2},
-            {1, 2, 1}
-        };
+	// write the gray plane into data's colors and free it
+        void Expand_Gray();
 
-        float double_filter_matrix2[4][4] =
-        {
-            {1, 3, 3, 1},
-            {3, 9, 9, 3},
-            {3, 9, 9, 3},
-            {1, 3, 3, 1}
-        };
+	// free the pixel storage, whether allocated, shared or mapped from a cache file
+        void Release_Data();
 
-        float double_filter_matrix3[4][3] =
-        {
-            {1, 2, 1},
-            {3, 6, 3},
-            {3, 6, 3},
-            {1, 2, 1}
-        };
+	// take over the pixels and settings of another image, leaving it empty
+        void Take_Data(TargaImage& image);
 
-    private:
-	// helper function for format conversion
-        void RGBA_To_RGB(unsigned char *rgba, unsigned char *rgb);
+	// replace the gray and filter planes with copies of another image's
+        void Copy_Planes(const TargaImage& image);
 
-        // reverse the rows of the image, some targas are stored bottom to top
-	TargaImage* Reverse_Rows(void);
+	// take the pixel type and border mode of another image
+        void Copy_Settings(const TargaImage& image);
 
 	// clear image to all black
         void ClearToBlack();
@@ -181,49 +186,56 @@ class TargaImage
     // Determine if the postion is valid on image
         bool Is_Valid_Img_Pos(int x, int y);
     
-    // Determine if the position is in the range
-        int Mask_Pos_In_Range(int x, int y);
-
     // Find the closest palette in dither color algorithm
         int Find_Proper_Dither_Color(int type, int val);
 
-    // Calculate the average value of color in 5 * 5 area
-        int Box_Filter_Fetch_Value(int x, int y, int *swatches);
+    // Kernels Apply_Filter can run.  n is the radius of KERNEL_BOX, the registry index of KERNEL_REGISTERED
+    // and N of the NxN Gaussians.  KERNEL_GAUSSIAN_N goes recursive past c_binomialMaxN, KERNEL_BINOMIAL_N never does
+        enum EKernel { KERNEL_BOX, KERNEL_REGISTERED, KERNEL_GAUSSIAN_N, KERNEL_BINOMIAL_N };
 
-    // Calculate the value of color in 5 * 5 area with specific rate(Bartlett Filter)
-        int Bartlett_Filter_Fetch_Value(int x, int y, int* swatches);
+    // Pixels past the edges the planes need for a kernel
+        int Filter_Border(int kernel, int n);
 
-        int Bartlett_Filter_NM_Fetch_Value(int x, int y, int* swatches, int n, int m, int type, float bases);
+    // Run a kernel over the color channels in the current pixel type
+        bool Apply_Filter(int kernel, int n = 0);
+        template<class T> bool Apply_Filter_As(CPlanarBuffer<T>*& work, int kernel, int n);
+        template<class T> void Filter_Planes(const CPlanarBuffer<T>& src, CPlanarBuffer<T>& dst, int kernel, int n);
 
-   // Calculate the value of color in 5 * 5 area with specific rate(Gaussian Filter)
-        int Gaussian_Filter_Fetch_Value(int x, int y, int* swatches);
+    // Run a separable kernel, the outer product of taps with itself, over the color planes
+        template<class T> void Filter_Separable(const CPlanarBuffer<T>& src, CPlanarBuffer<T>& dst, const float* taps, int radius, float base);
+        template<class T> void Filter_Separable_Row(const T* src, ptrdiff_t stride, const float* taps, int radius, float base, float* sums, T* dst);
+
+    // Run a box of any radius over the color planes with running sums, reading past the edges through Border_Source
+        template<class T> void Filter_Box_Sums(const CPlanarBuffer<T>& src, CPlanarBuffer<T>& dst, int radius);
+
+    // Run a recursive approximation of a Gaussian over the color planes, at the same cost for any sigma
+        template<class T> void Filter_Recursive_Gaussian(const CPlanarBuffer<T>& src, CPlanarBuffer<T>& dst, float sigma);
 
-        float Find_Matrix_Val_With_Type(int x, int y, int type)
-        {
-            switch (type)
-            {
-            case 0:
-                return bartlett_filter_matrix[y][x];
-            case 1:
-                return half_filter_matrix[y][x];
-            case 2:
-                return double_filter_matrix1[y][x];
-            case 3:
-                return double_filter_matrix2[y][x];
-            case 4:
-                return double_filter_matrix3[y][x];
-            }
-        }
     // members
     public:
         int		width;	            // width of the image in pixels
         int		height;             // height of the image in pixels
-        int     data_array_size;    // size of the data array
-        int     img_size;           // size of the image
-        unsigned char	*data;	    // pixel data for the image, assumed to be in pre-multiplied RGBA format.
+        size_t  data_array_size;    // bytes from the first row to the end of the last, padding included
+        size_t  img_size;           // size of the image in pixels
+        size_t  stride;             // bytes from one row to the next, at least width * 4
+        unsigned char	*data;	    // pixel data for the image, assumed to be in pre-multiplied RGBA format.  Use Row to find a row
         int DARK = 0;
         int BRIGHT = 255;
 
+    private:
+        CImageCache     *cache = NULL;      // the cache file data points into, or NULL if data was allocated
+        unsigned char   *storage = NULL;    // what new[] returned for the pixels, or NULL if they weren't allocated
+        int             apron = 0;          // pixels of storage beyond every edge
+        CPlanarBuffer<unsigned char> *gray = NULL;  // after To_Grayscale, the gray value of every pixel.  data's colors are stale while this is set
+        char            *source = NULL;     // file still to be decoded by Load_Data, or NULL
+        EPixelType      pixel_type = PIXEL_UINT8;           // what filters keep their results in
+        EBorderMode     border_mode = BORDER_CLAMP;         // how filters make up pixels past the edges
+        CPlanarBuffer<unsigned short> *planes16 = NULL;     // colors left by the last filter in PIXEL_UINT16, data's are stale while this is set
+        CPlanarBuffer<float> *planes_float = NULL;          // the same for PIXEL_FLOAT
+
+        struct SSharedPixels;
+        SSharedPixels   *shared = NULL;     // the pixels data points to are shared with other images, or NULL
+
 };
 
 class Stroke { // Data structure for holding painterly strokes.
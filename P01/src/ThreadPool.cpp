@@ -0,0 +1,288 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+//      ThreadPool.cpp
+//
+//      Implementation of CThreadPool.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#include "ThreadPool.h"
+#include "ScratchArena.h"
+#include <memory>
+
+using namespace std;
+
+// globals
+static int                  s_nThreadCount = 0;     // threads for the shared pool, 0 for the hardware's
+static unique_ptr<CThreadPool> s_pShared;           // the shared pool, once something has used it, never replaced
+static mutex                s_sharedLock;           // guards the two above
+static thread_local bool    s_bInLoop = false;      // is this thread running a chunk?
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Constructor.  Start nThreads - 1 workers; the thread that calls
+//  Parallel_For is the last one.
+//
+///////////////////////////////////////////////////////////////////////////////
+CThreadPool::CThreadPool(int nThreads)
+    : m_nThreads(1), m_pBody(NULL), m_generation(0), m_finished(0), m_bStop(false)
+{
+    Start(nThreads);
+}// CThreadPool
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Destructor.  Stop the workers and wait for them.
+//
+///////////////////////////////////////////////////////////////////////////////
+CThreadPool::~CThreadPool()
+{
+    Stop();
+}// ~CThreadPool
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Make the queues for nThreads threads and start the workers.  There
+//  must be none running.
+//
+///////////////////////////////////////////////////////////////////////////////
+void CThreadPool::Start(int nThreads)
+{
+    if (nThreads < 1)
+        nThreads = 1;
+
+    for (int i = 0; i < nThreads; ++i)
+        m_queues.push_back(new SQueue);
+    m_nThreads = nThreads;
+
+    for (int i = 1; i < nThreads; ++i)
+        m_workers.push_back(thread(&CThreadPool::Worker, this, i));
+}// Start
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Stop the workers, wait for them and free the queues, leaving the 
+//  pool ready for Start.  No loop may be running.
+//
+///////////////////////////////////////////////////////////////////////////////
+void CThreadPool::Stop()
+{
+    {
+        lock_guard<mutex> lock(m_lock);
+        m_bStop = true;
+    }
+    m_wake.notify_all();
+
+    for (size_t i = 0; i < m_workers.size(); ++i)
+        m_workers[i].join();
+
+    for (size_t i = 0; i < m_queues.size(); ++i)
+        delete m_queues[i];
+
+    // new workers start out having seen no loops
+    m_workers.clear();
+    m_queues.clear();
+    m_nThreads = 1;
+    m_generation = 0;
+    m_bStop = false;
+}// Stop
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Restart the pool with nThreads threads, waiting for the loop in 
+//  progress, if any, and holding off new ones until it is done.
+//
+///////////////////////////////////////////////////////////////////////////////
+void CThreadPool::Resize(int nThreads)
+{
+    lock_guard<mutex> run(m_runLock);
+
+    Stop();
+    Start(nThreads);
+}// Resize
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Return the shared pool, starting it if this is the first use.
+//
+///////////////////////////////////////////////////////////////////////////////
+CThreadPool& CThreadPool::Shared()
+{
+    lock_guard<mutex> lock(s_sharedLock);
+
+    if (!s_pShared)
+        s_pShared.reset(new CThreadPool(s_nThreadCount > 0 ? s_nThreadCount : (int)thread::hardware_concurrency()));
+    return *s_pShared;
+}// Shared
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Set the thread count of the shared pool, resizing it in place if it
+//  is already running.
+//
+///////////////////////////////////////////////////////////////////////////////
+void CThreadPool::Set_Thread_Count(int nThreads)
+{
+    CThreadPool *pPool;
+
+    {
+        lock_guard<mutex> lock(s_sharedLock);
+        s_nThreadCount = nThreads > 0 ? nThreads : 0;
+        nThreads = s_nThreadCount > 0 ? s_nThreadCount : (int)thread::hardware_concurrency();
+        pPool = s_pShared.get();
+    }
+
+    // outside the lock, so the loop Resize waits for can still call Shared
+    if (pPool)
+        pPool->Resize(nThreads);
+}// Set_Thread_Count
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Run body over [begin, end) in chunks of grain.
+//
+///////////////////////////////////////////////////////////////////////////////
+void CThreadPool::Parallel_For(int begin, int end, int grain, const TBody& body)
+{
+    int     nChunks, nThreads;
+
+    if (end <= begin)
+        return;
+    if (grain < 1)
+        grain = 1;
+
+    // not worth waking anyone, or already inside a loop
+    nChunks = (int)(((long long)end - begin + grain - 1) / grain);
+    if (nChunks == 1 || Thread_Count() == 1 || s_bInLoop)
+    {
+        bool bOuter = s_bInLoop;
+
+        s_bInLoop = true;
+        body(begin, end);
+        s_bInLoop = bOuter;
+        return;
+    }// if
+
+    lock_guard<mutex> run(m_runLock);
+
+    // deal each thread a contiguous run, so neighboring rows stay together
+    nThreads = Thread_Count();
+    for (int i = 0; i < nThreads; ++i)
+    {
+        lock_guard<mutex> lock(m_queues[i]->lock);
+        for (int c = (int)((long long)nChunks * i / nThreads); c < (int)((long long)nChunks * (i + 1) / nThreads); ++c)
+        {
+            int first = begin + c * grain;
+            m_queues[i]->chunks.push_back(make_pair(first, end - first > grain ? first + grain : end));
+        }// for
+    }// for
+
+    {
+        lock_guard<mutex> lock(m_lock);
+        m_pBody = &body;
+        m_finished = 0;
+        ++m_generation;
+    }
+    m_wake.notify_all();
+
+    Run_Chunks(0);
+
+    unique_lock<mutex> lock(m_lock);
+    while (m_finished < (int)m_workers.size())
+        m_done.wait(lock);
+    m_pBody = NULL;
+}// Parallel_For
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Body of worker thread index: wait for a loop, help run it, repeat.
+//
+///////////////////////////////////////////////////////////////////////////////
+void CThreadPool::Worker(int index)
+{
+    unsigned int seen = 0;
+
+    for (;;)
+    {
+        {
+            unique_lock<mutex> lock(m_lock);
+            while (!m_bStop && m_generation == seen)
+                m_wake.wait(lock);
+            if (m_bStop)
+                return;
+            seen = m_generation;
+        }
+
+        Run_Chunks(index);
+
+        // nothing a chunk took from the arena outlives it
+        CScratchArena::Thread().Reset();
+
+        {
+            lock_guard<mutex> lock(m_lock);
+            if (++m_finished == (int)m_workers.size())
+                m_done.notify_one();
+        }
+    }// for
+}// Worker
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Run chunks of the current loop on thread index until there are none
+//  left anywhere.
+//
+///////////////////////////////////////////////////////////////////////////////
+void CThreadPool::Run_Chunks(int index)
+{
+    pair<int, int> chunk;
+
+    s_bInLoop = true;
+    while (Take_Chunk(index, chunk))
+        (*m_pBody)(chunk.first, chunk.second);
+    s_bInLoop = false;
+}// Run_Chunks
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Take the next chunk of thread index's own run, or else steal the
+//  last chunk of another thread's.  Returns false if every run is empty.
+//
+///////////////////////////////////////////////////////////////////////////////
+bool CThreadPool::Take_Chunk(int index, pair<int, int>& chunk)
+{
+    int nThreads = Thread_Count();
+
+    for (int i = 0; i < nThreads; ++i)
+    {
+        SQueue&             queue = *m_queues[(index + i) % nThreads];
+        lock_guard<mutex>   lock(queue.lock);
+
+        if (queue.chunks.empty())
+            continue;
+
+        if (i == 0)
+        {
+            chunk = queue.chunks.front();
+            queue.chunks.pop_front();
+        }// if
+        else
+        {
+            chunk = queue.chunks.back();
+            queue.chunks.pop_back();
+        }// else
+        return true;
+    }// for
+
+    return false;
+}// Take_Chunk
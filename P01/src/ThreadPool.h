@@ -0,0 +1,85 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+//      ThreadPool.h
+//
+//      A work-stealing pool of threads for the parallel loops of image
+//  operations.  Parallel_For cuts a range, usually rows, into chunks and
+//  deals each thread a contiguous run of them.  A thread works through its
+//  own run from the front and, once that is empty, steals from the back of
+//  the others' runs, so uneven rows don't leave threads idle.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef _THREAD_POOL_H_
+#define _THREAD_POOL_H_
+
+#include <functional>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <utility>
+
+class CThreadPool
+{
+    // methods
+    public:
+        typedef std::function<void(int, int)>   TBody;      // called with [first, last) of a chunk
+
+        ~CThreadPool(void);
+
+        // The pool every operation shares, created on first use.
+        static CThreadPool& Shared(void);
+
+        // Threads the shared pool will have, counting the caller.  0, the
+        // default, means one per hardware thread.  A pool that is already
+        // running is resized in place once the loop in progress, if any, 
+        // is done, so references to it stay good.  Not from a loop body.
+        static void Set_Thread_Count(int nThreads);
+
+        int Thread_Count(void) const        { return m_nThreads; }
+
+        // Call body over chunks of grain or fewer covering [begin, end)
+        // exactly once, on the pool's threads and the caller's, and return
+        // when all are done.  Chunks run concurrently, so the body may only
+        // write what its own chunk owns.  It may use its thread's scratch
+        // arena for temporaries that die with the chunk.  Loops nested in a
+        // body run serially on that thread.
+        void Parallel_For(int begin, int end, int grain, const TBody& body);
+
+    private:
+        explicit CThreadPool(int nThreads);
+        CThreadPool(const CThreadPool&);
+        CThreadPool& operator=(const CThreadPool&);
+
+        struct SQueue
+        {
+            std::mutex                      lock;
+            std::deque<std::pair<int, int> > chunks;
+        };// SQueue
+
+        void Start(int nThreads);
+        void Stop(void);
+        void Resize(int nThreads);
+        void Worker(int index);
+        void Run_Chunks(int index);
+        bool Take_Chunk(int index, std::pair<int, int>& chunk);
+
+    // members
+    private:
+        std::vector<std::thread>    m_workers;
+        std::vector<SQueue*>        m_queues;       // chunks of each thread, the caller's is 0 and worker i's is i + 1
+        std::atomic<int>            m_nThreads;     // workers plus the caller, read without m_runLock
+        std::mutex                  m_runLock;      // held for a whole Parallel_For or Resize, so callers take turns
+        std::mutex                  m_lock;         // guards the members below
+        std::condition_variable     m_wake;         // a new loop has started, or the pool is stopping
+        std::condition_variable     m_done;         // a worker has finished the loop
+        const TBody*                m_pBody;        // body of the current loop
+        unsigned int                m_generation;   // loops started so far
+        int                         m_finished;     // workers done with the current loop
+        bool                        m_bStop;
+};// CThreadPool
+
+#endif // _THREAD_POOL_H_
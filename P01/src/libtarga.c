@@ -4,6 +4,22 @@
 
 #include <stdio.h>
 #include <malloc.h>
+#include <string.h>
+
+/* platform headers go first, libtarga.h redefines 'byte' */
+#ifdef _WIN32
+#include <windows.h>
+#include <io.h>
+#else
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#endif
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define TGA_USE_SSE2
+#include <emmintrin.h>
+#endif
 
 #include "libtarga.h"
 
@@ -51,22 +67,150 @@
 #define TGA_ERR_READ_FAILS              (9)
 #define TGA_ERR_BAD_IMAGE_TYPE          (10)
 #define TGA_ERR_BAD_DIMENSIONS          (11)
+#define TGA_ERR_WRITE_FAILS             (12)
 
 
 static uint32 TargaError;
 
-
-static int16 ttohs( int16 val );
-static int16 htots( int16 val );
-static int32 ttohl( int32 val );
-static int32 htotl( int32 val );
+static void tga_run_serial( tga_job_fn job, void * arg, int count );
+
+static tga_runner_fn TargaRunner = tga_run_serial;
+
+
+
+
+/* size of the buffer the decoder reads the file through */
+#define TGA_READ_BUFFER_SIZE     (64 * 1024)
+
+/* the writers collect rows until they have about this much to write */
+#define TGA_WRITE_BUFFER_SIZE    (256 * 1024)
+
+/* rows handed to the runner at once when rle encoding */
+#define TGA_RLE_CHUNK_SIZE       (4 * 1024 * 1024)
+
+
+/* buffered input, so pixels are never fetched from the file a byte at a time */
+typedef struct {
+    FILE  * file;
+    ubyte * buf;
+    uint32  pos;                // next unread byte in buf
+    uint32  len;                // number of valid bytes in buf
+} tga_stream;
+
+
+/* everything needed to turn a row of file pixels into output pixels */
+typedef struct {
+    ubyte   bytes_per_pix;      // size of a pixel (or palette index) in the file
+    uint32  bits;               // true bits per pixel of the color values
+    ubyte   alphabits;
+    uint32  format;             // TGA_TRUECOLOR_24 or TGA_TRUECOLOR_32
+    ubyte * colormap;           // NULL unless the image is paletted
+    ubyte   cmap_bytes_entry;
+    uint32  cmap_first;
+    uint32  cmap_length;
+    ubyte * lut;                // premultiplied RGBA for every 1 or 2 byte pixel value, or NULL
+    uint32  lut_mask;           // bits of the file pixel that index lut
+} tga_decoder;
+
+
+/* a targa whose header has been read, waiting for its pixels to be decoded */
+struct tga_reader {
+    tga_stream stream;          // positioned at the first pixel
+    ubyte   image_type;
+    ubyte   pix_depth;          // bits per pixel (or palette index) in the file
+    ubyte   img_desc;
+    uint32  width;
+    uint32  height;
+    ubyte   bytes_per_pix;
+    ubyte   true_bits;          // bits per color value (palette entry size if paletted)
+    ubyte   alphabits;
+    ubyte * colormap;           // NULL unless the image is paletted
+    ubyte   cmap_bytes_entry;
+    uint32  cmap_first;
+    uint32  cmap_length;
+};
+
+
+/* state shared by the row jobs of one read from memory */
+typedef struct {
+    const TGA_READER  * tga;
+    const tga_decoder * decoder;
+    const ubyte * data;         // the pixel data, everything after the colormap
+    size_t   data_len;
+    size_t * row_offset;        // rle only: offset of the packet each file row starts in
+    uint32 * row_skip;          // rle only: pixels of that packet belonging to earlier rows
+    ubyte  * dat;
+    size_t   stride;            // bytes from one row of dat to the next
+    ubyte    img_desc;
+    uint32   format;
+} tga_read_job;
+
+
+/* a read-only view of a whole file */
+typedef struct {
+    const ubyte * base;
+    size_t        size;
+#ifdef _WIN32
+    HANDLE        mapping;
+#endif
+} tga_mapping;
+
+
+static uint32 tga_stream_read( tga_stream * s, ubyte * dst, uint32 count );
+static ubyte * tga_stream_read_all( tga_stream * s, size_t * count );
+static void tga_rle_scan( tga_read_job * job, uint32 w, uint32 h, ubyte bytes_per_pix );
+static void tga_rle_expand_rows( void * arg, int first, int last );
+static void tga_convert_rows( void * arg, int first, int last );
+static int tga_map_file( FILE * file, tga_mapping * map );
+static void tga_unmap_file( tga_mapping * map );
+static int tga_check_header( const ubyte * hdr );
+static void tga_fill_info( TGA_INFO * info, ubyte image_type, ubyte pix_depth, ubyte true_bits, 
+                          ubyte img_desc, uint32 width, uint32 height );
+static void tga_init_decoder( tga_decoder * dec, ubyte bytes_per_pix, uint32 bits, 
+                             ubyte alphabits, uint32 format );
+static void tga_build_lut( tga_decoder * dec );
+static void tga_free_decoder( tga_decoder * dec );
+static void tga_decode_row( const tga_decoder * dec, const ubyte * src, ubyte * dst, uint32 count );
+static ubyte * tga_row_address( ubyte * dat, ubyte img_spec, uint32 row, uint32 h, size_t stride );
+static void tga_orient_row( ubyte * row, ubyte img_spec, uint32 w, uint32 format );
+static uint32 tga_convert_color( uint32 pixel, uint32 bpp_in, ubyte alphabits, uint32 format_out );
+static uint16 tga_get_uint16( const ubyte * p );
+static int tga_write_header( FILE * tga, int width, int height, unsigned int format, ubyte img_type );
+static void tga_init_unpremultiply( uint32 * recip );
+static void tga_encode_row( const uint32 * recip, const ubyte * src, ubyte * dst, 
+                           uint32 count, uint32 format );
+static uint32 tga_rle_row( const ubyte * src, ubyte * dst, uint32 count, uint32 format );
+static void tga_rle_rows( void * arg, int first, int last );
+
+
+/* state shared by the row jobs of one rle write */
+typedef struct {
+    const uint32 * recip;
+    const ubyte  * dat;
+    size_t         stride;      // bytes from one row of dat to the next
+    int            width;
+    int            height;
+    uint32         format;
+    unsigned int   flags;
+    int            first_row;   // file row encoded into slot 0
+    uint32         slot_size;   // room reserved for each encoded row
+    ubyte        * slots;
+    uint32       * lengths;     // bytes actually used in each slot
+} tga_rle_job;
+
+
+/* stores an error code for the caller of a reentrant call, if they want it */
+static void tga_set_error( int * error, int code ) {
+    if( error != NULL ) {
+        *error = code;
+    }
+}
 
 
-static uint32 tga_get_pixel( FILE * tga, ubyte bytes_per_pix, 
-                            ubyte * colormap, ubyte cmap_bytes_entry );
-static uint32 tga_convert_color( uint32 pixel, uint32 bpp_in, ubyte alphabits, uint32 format_out );
-static void tga_write_pixel_to_mem( ubyte * dat, ubyte img_spec, uint32 number, 
-                                   uint32 w, uint32 h, uint32 pixel, uint32 format );
+/* sets who runs libtarga's row jobs -- NULL restores running them in order */
+void tga_set_runner( tga_runner_fn runner ) {
+    TargaRunner = runner ? runner : tga_run_serial;
+}
 
 
 /* returns the last error encountered */
@@ -116,6 +260,9 @@ const char * tga_error_string( int error_code ) {
     case TGA_ERR_BAD_DIMENSIONS:
         return( "image has size 0 width or height (or both)" );
 
+    case TGA_ERR_WRITE_FAILS:
+        return( "cannot write to file" );
+
     default:
         return( "unknown error" );
 
@@ -133,10 +280,10 @@ void * tga_create( int width, int height, unsigned int format ) {
     switch( format ) {
         
     case TGA_TRUECOLOR_32:
-        return( (void *)malloc( width * height * 4 ) );
+        return( (void *)malloc( (size_t)width * height * 4 ) );
         
     case TGA_TRUECOLOR_24:
-        return( (void *)malloc( width * height * 3 ) );
+        return( (void *)malloc( (size_t)width * height * 3 ) );
         
     default:
         TargaError = TGA_ERR_BAD_FORMAT;
@@ -152,6 +299,83 @@ void * tga_create( int width, int height, unsigned int format ) {
 /* loads and converts a targa from disk */
 void * tga_load( const char * filename, 
                 int * width, int * height, unsigned int format ) {
+
+    int error;
+    void * image_data = tga_load_r( filename, width, height, format, &error );
+
+    if( image_data == NULL ) {
+        TargaError = error;
+    }
+
+    return( image_data );
+
+}
+
+
+
+
+/* tga_load, reporting errors through error instead of tga_get_last_error */
+void * tga_load_r( const char * filename, 
+                  int * width, int * height, unsigned int format, int * error ) {
+
+    TGA_READER * tga;
+    void * image_data;
+
+    tga_set_error( error, TGA_ERR_NONE );
+
+    switch( format ) {
+
+    case TGA_TRUECOLOR_24:
+    case TGA_TRUECOLOR_32:
+        break;
+
+    default:
+        tga_set_error( error, TGA_ERR_BAD_FORMAT );
+        return( NULL );
+
+    }
+
+    tga = tga_open_r( filename, width, height, error );
+    if( tga == NULL ) {
+        return( NULL );
+    }
+
+    /* compute how many bytes of storage we need for the image */
+    image_data = malloc( (size_t)(*width) * (*height) * format );
+
+    if( !tga_read_r( tga, image_data, format, 0, error ) ) {
+        free( image_data );
+        image_data = NULL;
+    }
+
+    tga_close( tga );
+
+    return( image_data );
+
+}
+
+
+
+
+/* opens a targa and reads everything up to the pixel data */
+TGA_READER * tga_open( const char * filename, int * width, int * height ) {
+
+    int error;
+    TGA_READER * tga = tga_open_r( filename, width, height, &error );
+
+    if( tga == NULL ) {
+        TargaError = error;
+    }
+
+    return( tga );
+
+}
+
+
+
+
+/* tga_open, reporting errors through error instead of tga_get_last_error */
+TGA_READER * tga_open_r( const char * filename, int * width, int * height, int * error ) {
     
     ubyte  idlen;               // length of the image_id string below.
     ubyte  cmap_type;           // paletted image <=> cmap_type
@@ -168,65 +392,35 @@ void * tga_load( const char * filename,
 
     FILE * targafile;
 
-    ubyte * tga_hdr = NULL;
+    ubyte tga_hdr[HDR_LENGTH];
+
+    TGA_READER * tga;
 
     ubyte * colormap = NULL;
 
     ubyte cmap_bytes_entry = 0; // Prevents spurious debug runtime check in VC2003
     uint32 cmap_bytes;
-    
-    uint32 tmp_col;
-    uint32 tmp_int32;
-    ubyte  tmp_byte;
-
-    ubyte alphabits = 0;
-
-    uint32 num_pixels;
-    
-    uint32 i;
-    uint32 j;
-
-    ubyte * image_data;
-    uint32 img_dat_len;
 
     ubyte bytes_per_pix;
 
-    ubyte true_bits_per_pixel;
+    int code;
 
-    uint32 bytes_total = 0;
 
-    ubyte packet_header;
-    ubyte repcount;
+    tga_set_error( error, TGA_ERR_NONE );
     
 
-    switch( format ) {
-
-    case TGA_TRUECOLOR_24:
-    case TGA_TRUECOLOR_32:
-        break;
-
-    default:
-        TargaError = TGA_ERR_BAD_FORMAT;
-        return( NULL );
-
-    }
-
-    
     /* open binary image file */
     targafile = fopen( filename, "rb" );
     if( targafile == NULL ) {
-        TargaError = TGA_ERR_OPEN_FAILS;
+        tga_set_error( error, TGA_ERR_OPEN_FAILS );
         return( NULL );
     }
 
 
-    /* allocate memory for the header */
-    tga_hdr = (ubyte *)malloc( HDR_LENGTH );
-
     /* read the header in. */
     if( fread( (void *)tga_hdr, 1, HDR_LENGTH, targafile ) != HDR_LENGTH ) {
-        free( tga_hdr );
-        TargaError = TGA_ERR_BAD_HEADER;
+        fclose( targafile );
+        tga_set_error( error, TGA_ERR_BAD_HEADER );
         return( NULL );
     }
 
@@ -237,45 +431,43 @@ void * tga_load( const char * filename,
     image_type         = (ubyte)tga_hdr[HDR_IMAGE_TYPE];
     
     cmap_type          = (ubyte)tga_hdr[HDR_CMAP_TYPE];
-    cmap_first         = ttohs( *(uint16 *)(&tga_hdr[HDR_CMAP_FIRST]) );
-    cmap_length        = ttohs( *(uint16 *)(&tga_hdr[HDR_CMAP_LENGTH]) );
+    cmap_first         = tga_get_uint16( &tga_hdr[HDR_CMAP_FIRST] );
+    cmap_length        = tga_get_uint16( &tga_hdr[HDR_CMAP_LENGTH] );
     cmap_entry_size    = (ubyte)tga_hdr[HDR_CMAP_ENTRY_SIZE];
 
-    img_spec_xorig     = ttohs( *(uint16 *)(&tga_hdr[HDR_IMG_SPEC_XORIGIN]) );
-    img_spec_yorig     = ttohs( *(uint16 *)(&tga_hdr[HDR_IMG_SPEC_YORIGIN]) );
-    img_spec_width     = ttohs( *(uint16 *)(&tga_hdr[HDR_IMG_SPEC_WIDTH]) );
-    img_spec_height    = ttohs( *(uint16 *)(&tga_hdr[HDR_IMG_SPEC_HEIGHT]) );
+    img_spec_xorig     = tga_get_uint16( &tga_hdr[HDR_IMG_SPEC_XORIGIN] );
+    img_spec_yorig     = tga_get_uint16( &tga_hdr[HDR_IMG_SPEC_YORIGIN] );
+    img_spec_width     = tga_get_uint16( &tga_hdr[HDR_IMG_SPEC_WIDTH] );
+    img_spec_height    = tga_get_uint16( &tga_hdr[HDR_IMG_SPEC_HEIGHT] );
     img_spec_pix_depth = (ubyte)tga_hdr[HDR_IMG_SPEC_PIX_DEPTH];
     img_spec_img_desc  = (ubyte)tga_hdr[HDR_IMG_SPEC_IMG_DESC];
 
-    free( tga_hdr );
 
-
-    num_pixels = img_spec_width * img_spec_height;
-
-    if( num_pixels == 0 ) {
-        TargaError = TGA_ERR_BAD_DIMENSIONS;
+    code = tga_check_header( tga_hdr );
+    if( code != TGA_ERR_NONE ) {
+        fclose( targafile );
+        tga_set_error( error, code );
         return( NULL );
     }
 
     
-    alphabits = img_spec_img_desc & 0x0F;
-
-    
     /* seek past the image id, if there is one */
     if( idlen ) {
         if( fseek( targafile, idlen, SEEK_CUR ) ) {
-            TargaError = TGA_ERR_UNEXPECTED_EOF;
+            fclose( targafile );
+            tga_set_error( error, TGA_ERR_UNEXPECTED_EOF );
             return( NULL );
         }
     }
 
 
-    /* if this is a 'nodata' image, just jump out. */
-    if( image_type == TGA_IMG_NODATA ) {
-        TargaError = TGA_ERR_NODATA_IMAGE;
-        return( NULL );
-    }
+    tga = (TGA_READER *)malloc( sizeof( TGA_READER ) );
+
+    /* everything past the header goes through one large buffer. */
+    tga->stream.file = targafile;
+    tga->stream.buf  = (ubyte *)malloc( TGA_READ_BUFFER_SIZE );
+    tga->stream.pos  = 0;
+    tga->stream.len  = 0;
 
 
     /* now we're starting to get into the meat of the matter. */
@@ -299,7 +491,9 @@ void * tga_load( const char * filename,
             
         case TGA_IMG_UNC_GRAYSCALE:
         case TGA_IMG_RLE_GRAYSCALE:
-            TargaError = TGA_ERR_COLORMAP_FOR_GRAY;
+            tga->colormap = NULL;
+            tga_close( tga );
+            tga_set_error( error, TGA_ERR_COLORMAP_FOR_GRAY );
             return( NULL );
         }
         
@@ -308,7 +502,9 @@ void * tga_load( const char * filename,
             cmap_entry_size == 16 ||
             cmap_entry_size == 24 ||
             cmap_entry_size == 32) ) {
-            TargaError = TGA_ERR_BAD_COLORMAP_ENTRY_SIZE;
+            tga->colormap = NULL;
+            tga_close( tga );
+            tga_set_error( error, TGA_ERR_BAD_COLORMAP_ENTRY_SIZE );
             return( NULL );
         }
         
@@ -320,34 +516,15 @@ void * tga_load( const char * filename,
             cmap_bytes_entry = (cmap_entry_size >> 3);
         }
         
+        /* the whole table is stored little-endian, so read it in one go. */
         cmap_bytes = cmap_bytes_entry * cmap_length;
         colormap = (ubyte *)malloc( cmap_bytes );
         
-        
-        for( i = 0; i < cmap_length; i++ ) {
-            
-            /* seek ahead to first entry used */
-            if( cmap_first != 0 ) {
-                fseek( targafile, cmap_first * cmap_bytes_entry, SEEK_CUR );
-            }
-            
-            tmp_int32 = 0;
-            for( j = 0; j < cmap_bytes_entry; j++ ) {
-                if( !fread( &tmp_byte, 1, 1, targafile ) ) {
-                    free( colormap );
-                    TargaError = TGA_ERR_BAD_COLORMAP;
-                    return( NULL );
-                }
-                tmp_int32 += tmp_byte << (j * 8);
-            }
-
-            // byte order correct.
-            tmp_int32 = ttohl( tmp_int32 );
-
-            for( j = 0; j < cmap_bytes_entry; j++ ) {
-                colormap[i * cmap_bytes_entry + j] = (tmp_int32 >> (8 * j)) & 0xFF;
-            }
-            
+        if( tga_stream_read( &tga->stream, colormap, cmap_bytes ) != cmap_bytes ) {
+            tga->colormap = colormap;
+            tga_close( tga );
+            tga_set_error( error, TGA_ERR_BAD_COLORMAP );
+            return( NULL );
         }
 
     }
@@ -367,699 +544,1472 @@ void * tga_load( const char * filename,
     }
 
 
-    /* compute how many bytes of storage we need for the image */
-    bytes_total = img_spec_width * img_spec_height * format;
+    tga->image_type       = image_type;
+    tga->pix_depth        = img_spec_pix_depth;
+    tga->img_desc         = img_spec_img_desc;
+    tga->width            = img_spec_width;
+    tga->height           = img_spec_height;
+    tga->bytes_per_pix    = bytes_per_pix;
+    tga->alphabits        = img_spec_img_desc & 0x0F;
+    tga->colormap         = colormap;
+    tga->cmap_bytes_entry = cmap_bytes_entry;
+    tga->cmap_first       = cmap_first;
+    tga->cmap_length      = colormap ? cmap_length : 0;
 
-    image_data = (ubyte *)malloc( bytes_total );
+    // compute the true number of bits per pixel
+    tga->true_bits = cmap_type ? cmap_entry_size : img_spec_pix_depth;
 
-    img_dat_len = img_spec_width * img_spec_height * bytes_per_pix;
+    *width  = img_spec_width;
+    *height = img_spec_height;
 
-    // compute the true number of bits per pixel
-    true_bits_per_pixel = cmap_type ? cmap_entry_size : img_spec_pix_depth;
+    return( tga );
 
-    switch( image_type ) {
+}
 
-    case TGA_IMG_UNC_TRUECOLOR:
-    case TGA_IMG_UNC_GRAYSCALE:
-    case TGA_IMG_UNC_PALETTED:
 
-        /* FIXME: support grayscale */
 
-        for( i = 0; i < num_pixels; i++ ) {
 
-            // get the color value.
-            tmp_col = tga_get_pixel( targafile, bytes_per_pix, colormap, cmap_bytes_entry );
-            tmp_col = tga_convert_color( tmp_col, true_bits_per_pixel, alphabits, format );
-            
-            // now write the data out.
-            tga_write_pixel_to_mem( image_data, img_spec_img_desc, 
-                i, img_spec_width, img_spec_height, tmp_col, format );
+/* reads just the header of a targa */
+int tga_probe( const char * filename, TGA_INFO * info ) {
 
-        }
-    
-        break;
+    int error;
 
+    if( !tga_probe_r( filename, info, &error ) ) {
+        TargaError = error;
+        return( 0 );
+    }
 
-    case TGA_IMG_RLE_TRUECOLOR:
-    case TGA_IMG_RLE_GRAYSCALE:
-    case TGA_IMG_RLE_PALETTED:
+    return( 1 );
 
-        // FIXME: handle grayscale..
+}
 
-        for( i = 0; i < num_pixels; ) {
 
-            /* a bit of work to do to read the data.. */
-            if( fread( &packet_header, 1, 1, targafile ) < 1 ) {
-                // well, just let them fill the rest with null pixels then...
-                packet_header = 1;
-            }
 
-            if( packet_header & 0x80 ) {
-                /* run length packet */
 
-                tmp_col = tga_get_pixel( targafile, bytes_per_pix, colormap, cmap_bytes_entry );
-                tmp_col = tga_convert_color( tmp_col, true_bits_per_pixel, alphabits, format );
-                
-                repcount = (packet_header & 0x7F) + 1;
-                
-                /* write all the data out */
-                for( j = 0; j < repcount; j++ ) {
-                    tga_write_pixel_to_mem( image_data, img_spec_img_desc, 
-                        i + j, img_spec_width, img_spec_height, tmp_col, format );
-                }
+/* tga_probe, reporting errors through error instead of tga_get_last_error */
+int tga_probe_r( const char * filename, TGA_INFO * info, int * error ) {
 
-                i += repcount;
+    FILE * targafile;
 
-            } else {
-                /* raw packet */
-                /* get pixel from file */
-                
-                repcount = (packet_header & 0x7F) + 1;
-                
-                for( j = 0; j < repcount; j++ ) {
-                    
-                    tmp_col = tga_get_pixel( targafile, bytes_per_pix, colormap, cmap_bytes_entry );
-                    tmp_col = tga_convert_color( tmp_col, true_bits_per_pixel, alphabits, format );
-                    
-                    tga_write_pixel_to_mem( image_data, img_spec_img_desc, 
-                        i + j, img_spec_width, img_spec_height, tmp_col, format );
+    ubyte tga_hdr[HDR_LENGTH];
 
-                }
+    int code;
 
-                i += repcount;
 
-            }
+    tga_set_error( error, TGA_ERR_NONE );
 
-        }
+    targafile = fopen( filename, "rb" );
+    if( targafile == NULL ) {
+        tga_set_error( error, TGA_ERR_OPEN_FAILS );
+        return( 0 );
+    }
 
-        break;
-    
+    if( fread( (void *)tga_hdr, 1, HDR_LENGTH, targafile ) != HDR_LENGTH ) {
+        fclose( targafile );
+        tga_set_error( error, TGA_ERR_BAD_HEADER );
+        return( 0 );
+    }
 
-    default:
+    fclose( targafile );
 
-        TargaError = TGA_ERR_BAD_IMAGE_TYPE;
-        return( NULL );
+    code = tga_check_header( tga_hdr );
+    if( code != TGA_ERR_NONE ) {
+        tga_set_error( error, code );
+        return( 0 );
+    }
+
+    tga_fill_info( info, tga_hdr[HDR_IMAGE_TYPE], tga_hdr[HDR_IMG_SPEC_PIX_DEPTH],
+                   tga_hdr[HDR_CMAP_TYPE] ? tga_hdr[HDR_CMAP_ENTRY_SIZE] : tga_hdr[HDR_IMG_SPEC_PIX_DEPTH],
+                   tga_hdr[HDR_IMG_SPEC_IMG_DESC],
+                   tga_get_uint16( &tga_hdr[HDR_IMG_SPEC_WIDTH] ),
+                   tga_get_uint16( &tga_hdr[HDR_IMG_SPEC_HEIGHT] ) );
+
+    return( 1 );
+
+}
+
+
+
+
+/* describes a targa opened with tga_open */
+void tga_info( TGA_READER * tga, TGA_INFO * info ) {
+
+    tga_fill_info( info, tga->image_type, tga->pix_depth, tga->true_bits, 
+                   tga->img_desc, tga->width, tga->height );
+
+}
 
+
+
+
+/* decodes the pixels of an open targa into dat */
+int tga_read( TGA_READER * tga, void * dat, unsigned int format, unsigned int flags ) {
+
+    int error;
+
+    if( !tga_read_r( tga, dat, format, flags, &error ) ) {
+        TargaError = error;
+        return( 0 );
     }
 
-    fclose( targafile );
+    return( 1 );
+
+}
 
-    *width  = img_spec_width;
-    *height = img_spec_height;
 
-    return( (void *)image_data );
+
+
+/* tga_read, reporting errors through error instead of tga_get_last_error */
+int tga_read_r( TGA_READER * tga, void * dat, unsigned int format, unsigned int flags, int * error ) {
+
+    return( tga_read_rows_r( tga, dat, (size_t)tga->width * format, format, flags, error ) );
 
 }
 
 
 
 
-int tga_write_raw( const char * file, int width, int height, unsigned char * dat, unsigned int format ) {
+/* tga_read_r into rows stride bytes apart */
+int tga_read_rows_r( TGA_READER * tga, void * dat, size_t stride, unsigned int format, 
+                    unsigned int flags, int * error ) {
 
-    FILE * tga;
+    uint32 y;
 
-    uint32 i, j;
+    ubyte  img_desc;
+
+    tga_decoder decoder;        // how to turn file pixels into output pixels
+
+    tga_read_job job;
+    tga_mapping  map;
+    long         offset;
+
+    ubyte * rowbuf;             // one row of undecoded file pixels
+    ubyte * row;
+
+
+    tga_set_error( error, TGA_ERR_NONE );
 
-    uint32 size = width * height;
-
-    float red, green, blue, alpha;
-
-    char id[] = "written with libtarga";
-    ubyte idlen = 21;
-    ubyte zeroes[5] = { 0, 0, 0, 0, 0 };
-    uint32 pixbuf;
-    ubyte one = 1;
-    ubyte cmap_type = 0;
-    ubyte img_type  = 2;  // 2 - uncompressed truecolor  10 - RLE truecolor
-    uint16 xorigin  = 0;
-    uint16 yorigin  = 0;
-    ubyte  pixdepth = format * 8;  // bpp
-    ubyte img_desc;
-    
-    
     switch( format ) {
 
     case TGA_TRUECOLOR_24:
-        img_desc = 0;
-        break;
-
     case TGA_TRUECOLOR_32:
-        img_desc = 8;
         break;
 
     default:
-        TargaError = TGA_ERR_BAD_FORMAT;
+        tga_set_error( error, TGA_ERR_BAD_FORMAT );
         return( 0 );
-        break;
 
     }
 
-    tga = fopen( file, "wb" );
-
-    if( tga == NULL ) {
-        TargaError = TGA_ERR_OPEN_FAILS;
+    if( dat == NULL ) {
+        tga_set_error( error, TGA_ERR_BAD_FORMAT );
         return( 0 );
     }
 
-    // write id length
-    fwrite( &idlen, 1, 1, tga );
+    if( stride < (size_t)tga->width * format ) {
+        tga_set_error( error, TGA_ERR_BAD_DIMENSIONS );
+        return( 0 );
+    }
 
-    // write colormap type
-    fwrite( &cmap_type, 1, 1, tga );
 
-    // write image type
-    fwrite( &img_type, 1, 1, tga );
+    /* top-down storage is bottom-up storage with the vertical origin flipped */
+    img_desc = tga->img_desc;
+    if( flags & TGA_TOP_DOWN ) {
+        img_desc ^= 0x20;
+    }
 
-    // write cmap spec.
-    fwrite( &zeroes, 5, 1, tga );
+    tga_init_decoder( &decoder, tga->bytes_per_pix, tga->true_bits, tga->alphabits, format );
 
-    // write image spec.
-    fwrite( &xorigin, 2, 1, tga );
-    fwrite( &yorigin, 2, 1, tga );
-    fwrite( &width, 2, 1, tga );
-    fwrite( &height, 2, 1, tga );
-    fwrite( &pixdepth, 1, 1, tga );
-    fwrite( &img_desc, 1, 1, tga );
+    switch( tga->image_type ) {
 
+    case TGA_IMG_UNC_PALETTED:
+    case TGA_IMG_RLE_PALETTED:
+        decoder.colormap         = tga->colormap;
+        decoder.cmap_bytes_entry = tga->cmap_bytes_entry;
+        decoder.cmap_first       = tga->cmap_first;
+        decoder.cmap_length      = tga->cmap_length;
+        break;
 
-    // write image id.
-    fwrite( &id, idlen, 1, tga );
+    }
 
-    // color correction -- data is in RGB, need BGR.
-    for( i = 0; i < size; i++ ) {
+    tga_build_lut( &decoder );
 
-        pixbuf = 0;
-        for( j = 0; j < format; j++ ) {
-            pixbuf += dat[i*format+j] << (8 * j);
-        }
+    switch( tga->image_type ) {
 
-        switch( format ) {
+    case TGA_IMG_UNC_TRUECOLOR:
+    case TGA_IMG_UNC_GRAYSCALE:
+    case TGA_IMG_UNC_PALETTED:
 
-        case TGA_TRUECOLOR_24:
+        /* FIXME: support grayscale */
 
-            pixbuf = ((pixbuf & 0xFF) << 16) + 
-                     (pixbuf & 0xFF00) + 
-                     ((pixbuf & 0xFF0000) >> 16);
+        // 32-bit truecolor pixels are converted straight out of a mapping
+        // of the file when the platform allows, skipping stdio entirely.
+        if( tga->image_type == TGA_IMG_UNC_TRUECOLOR && tga->true_bits == 32 && 
+            format == TGA_TRUECOLOR_32 && tga_map_file( tga->stream.file, &map ) ) {
 
-            pixbuf = htotl( pixbuf );
-            
-            fwrite( &pixbuf, 3, 1, tga );
+            // the stream hasn't consumed anything past the colormap yet.
+            offset = ftell( tga->stream.file ) - (long)(tga->stream.len - tga->stream.pos);
+            job.data_len = (size_t)tga->width * tga->height * 4;
 
-            break;
+            if( offset >= 0 && (size_t)offset + job.data_len <= map.size ) {
 
-        case TGA_TRUECOLOR_32:
+                job.tga      = tga;
+                job.decoder  = &decoder;
+                job.data     = map.base + offset;
+                job.dat      = (ubyte *)dat;
+                job.stride   = stride;
+                job.img_desc = img_desc;
+                job.format   = format;
 
-            /* need to un-premultiply alpha.. */
+                TargaRunner( tga_convert_rows, &job, tga->height );
 
-            red     = (pixbuf & 0xFF) / 255.0f;
-            green   = ((pixbuf & 0xFF00) >> 8) / 255.0f;
-            blue    = ((pixbuf & 0xFF0000) >> 16) / 255.0f;
-            alpha   = ((pixbuf & 0xFF000000) >> 24) / 255.0f;
+                tga_unmap_file( &map );
+                break;
 
-            if( alpha > 0.0001 ) {
-                red /= alpha;
-                green /= alpha;
-                blue /= alpha;
             }
 
-            /* clamp to 1.0f */
-
-            red = red > 1.0f ? 255.0f : red * 255.0f;
-            green = green > 1.0f ? 255.0f : green * 255.0f;
-            blue = blue > 1.0f ? 255.0f : blue * 255.0f;
-            alpha = alpha > 1.0f ? 255.0f : alpha * 255.0f;
-
-            pixbuf = (ubyte)blue + (((ubyte)green) << 8) + 
-                (((ubyte)red) << 16) + (((ubyte)alpha) << 24);
-                
-            pixbuf = htotl( pixbuf );
-           
-            fwrite( &pixbuf, 4, 1, tga );
-
-            break;
+            /* truncated file, let the stream zero-fill what's missing */
+            tga_unmap_file( &map );
 
         }
 
-    }
+        rowbuf = (ubyte *)malloc( tga->width * tga->bytes_per_pix );
 
-    fclose( tga );
+        for( y = 0; y < tga->height; y++ ) {
 
-    return( 1 );
+            tga_stream_read( &tga->stream, rowbuf, tga->width * tga->bytes_per_pix );
 
-}
+            row = tga_row_address( (ubyte *)dat, img_desc, y, tga->height, stride );
+            tga_decode_row( &decoder, rowbuf, row, tga->width );
+            tga_orient_row( row, img_desc, tga->width, format );
 
+        }
 
+        free( rowbuf );
+    
+        break;
 
 
-int tga_write_rle( const char * file, int width, int height, unsigned char * dat, unsigned int format ) {
+    case TGA_IMG_RLE_TRUECOLOR:
+    case TGA_IMG_RLE_GRAYSCALE:
+    case TGA_IMG_RLE_PALETTED:
 
-    FILE * tga;
+        // FIXME: handle grayscale..
 
-    uint32 i, j;
-    uint32 oc, nc;
+        // packets may straddle rows, so rows can't be found without walking
+        // the packets.  the packed data is read in whole and scanned once,
+        // noting where every row starts, then the rows are expanded and
+        // converted independently through the runner.
 
-    enum RLE_STATE { INIT, NONE, RLP, RAWP };
+        job.data = tga_stream_read_all( &tga->stream, &job.data_len );
+        job.row_offset = (size_t *)malloc( tga->height * sizeof( size_t ) );
+        job.row_skip   = (uint32 *)malloc( tga->height * sizeof( uint32 ) );
 
-    int state = INIT;
+        tga_rle_scan( &job, tga->width, tga->height, tga->bytes_per_pix );
 
-    uint32 size = width * height;
+        job.tga      = tga;
+        job.decoder  = &decoder;
+        job.dat      = (ubyte *)dat;
+        job.stride   = stride;
+        job.img_desc = img_desc;
+        job.format   = format;
 
-    uint16 shortwidth = (uint16)width;
-    uint16 shortheight = (uint16)height;
+        TargaRunner( tga_rle_expand_rows, &job, tga->height );
 
-    ubyte repcount;
+        free( job.row_offset );
+        free( job.row_skip );
+        free( (void *)job.data );
 
-    float red, green, blue, alpha;
+        break;
 
-    int idx, row, column;
+    }
 
-    // have to buffer a whole line for raw packets.
-    unsigned char * rawbuf = (unsigned char *)malloc( width * format );  
+    tga_free_decoder( &decoder );
 
-    char id[] = "written with libtarga";
-    ubyte idlen = 21;
-    ubyte zeroes[5] = { 0, 0, 0, 0, 0 };
-    uint32 pixbuf;
-    ubyte one = 1;
-    ubyte cmap_type = 0;
-    ubyte img_type  = 10;  // 2 - uncompressed truecolor  10 - RLE truecolor
-    uint16 xorigin  = 0;
-    uint16 yorigin  = 0;
-    ubyte  pixdepth = format * 8;  // bpp
-    ubyte img_desc  = format == TGA_TRUECOLOR_32 ? 8 : 0;
-  
+    return( 1 );
 
-    switch( format ) {
-    case TGA_TRUECOLOR_24:
-    case TGA_TRUECOLOR_32:
-        break;
+}
 
-    default:
-        TargaError = TGA_ERR_BAD_FORMAT;
-        return( 0 );
-    }
 
 
-    tga = fopen( file, "wb" );
+
+/* closes a targa opened with tga_open */
+void tga_close( TGA_READER * tga ) {
 
     if( tga == NULL ) {
-        TargaError = TGA_ERR_OPEN_FAILS;
-        return( 0 );
+        return;
     }
 
-    // write id length
-    fwrite( &idlen, 1, 1, tga );
+    if( tga->colormap != NULL ) {
+        free( tga->colormap );
+    }
 
-    // write colormap type
-    fwrite( &cmap_type, 1, 1, tga );
+    free( tga->stream.buf );
+    fclose( tga->stream.file );
+    free( tga );
 
-    // write image type
-    fwrite( &img_type, 1, 1, tga );
+}
 
-    // write cmap spec.
-    fwrite( &zeroes, 5, 1, tga );
 
-    // write image spec.
-    fwrite( &xorigin, 2, 1, tga );
-    fwrite( &yorigin, 2, 1, tga );
-    fwrite( &shortwidth, 2, 1, tga );
-    fwrite( &shortheight, 2, 1, tga );
-    fwrite( &pixdepth, 1, 1, tga );
-    fwrite( &img_desc, 1, 1, tga );
 
 
-    // write image id.
-    fwrite( &id, idlen, 1, tga );
+int tga_write_raw( const char * file, int width, int height, unsigned char * dat, unsigned int format ) {
 
-    // initial color values -- just to shut up the compiler.
-    nc = 0;
+    return( tga_write( file, width, height, dat, format, 0 ) );
 
-    // color correction -- data is in RGB, need BGR.
-    // also run-length-encoding.
-    for( i = 0; i < size; i++ ) {
+}
 
-        idx = i * format;
 
-        row = i / width;
-        column = i % width;
 
-        //printf( "row: %d, col: %d\n", row, column );
-        pixbuf = 0;
-        for( j = 0; j < format; j++ ) {
-            pixbuf += dat[idx+j] << (8 * j);
-        }
 
-        switch( format ) {
+/* writes a targa, uncompressed or rle, from premultiplied data */
+int tga_write( const char * file, int width, int height, unsigned char * dat, 
+              unsigned int format, unsigned int flags ) {
 
-        case TGA_TRUECOLOR_24:
+    int error;
 
-            pixbuf = ((pixbuf & 0xFF) << 16) + 
-                     (pixbuf & 0xFF00) + 
-                     ((pixbuf & 0xFF0000) >> 16);
+    if( !tga_write_r( file, width, height, dat, format, flags, &error ) ) {
+        TargaError = error;
+        return( 0 );
+    }
 
-            pixbuf = htotl( pixbuf );
-            break;
+    return( 1 );
 
-        case TGA_TRUECOLOR_32:
+}
 
-            /* need to un-premultiply alpha.. */
 
-            red     = (pixbuf & 0xFF) / 255.0f;
-            green   = ((pixbuf & 0xFF00) >> 8) / 255.0f;
-            blue    = ((pixbuf & 0xFF0000) >> 16) / 255.0f;
-            alpha   = ((pixbuf & 0xFF000000) >> 24) / 255.0f;
 
-            if( alpha > 0.0001 ) {
-                red /= alpha;
-                green /= alpha;
-                blue /= alpha;
-            }
 
-            /* clamp to 1.0f */
+/* tga_write, reporting errors through error instead of tga_get_last_error */
+int tga_write_r( const char * file, int width, int height, unsigned char * dat, 
+                unsigned int format, unsigned int flags, int * error ) {
 
-            red = red > 1.0f ? 255.0f : red * 255.0f;
-            green = green > 1.0f ? 255.0f : green * 255.0f;
-            blue = blue > 1.0f ? 255.0f : blue * 255.0f;
-            alpha = alpha > 1.0f ? 255.0f : alpha * 255.0f;
+    return( tga_write_rows_r( file, width, height, dat, (size_t)width * format, format, flags, error ) );
 
-            pixbuf = (ubyte)blue + (((ubyte)green) << 8) + 
-                (((ubyte)red) << 16) + (((ubyte)alpha) << 24);
-                
-            pixbuf = htotl( pixbuf );
-            break;
+}
 
-        }
 
 
-        oc = nc;
 
-        nc = pixbuf;
+/* tga_write_r from rows stride bytes apart */
+int tga_write_rows_r( const char * file, int width, int height, unsigned char * dat, size_t stride, 
+                     unsigned int format, unsigned int flags, int * error ) {
 
+    FILE * tga;
 
-        switch( state ) {
+    int y;
+    int row;
+    int i;
 
-        case INIT:
-            // this is just used to make sure we have 2 pixel values to consider.
-            state = NONE;
-            break;
+    uint32 recip[256];          // un-premultiply reciprocals, see tga_init_unpremultiply
 
+    uint32 row_bytes = width * format;
+    uint32 rows_per_block;
+    uint32 block_rows = 0;
+    ubyte * block;
+    ubyte * out;
 
-        case NONE:
+    tga_rle_job job;
 
-            if( column == 0 ) {
-                // write a 1 pixel raw packet for the old pixel, then go thru again.
-                repcount = 0;
-                fwrite( &repcount, 1, 1, tga );
-#ifdef WORDS_BIGENDIAN
-                fwrite( (&oc)+4, format, 1, tga );  // byte order..
-#else
-                fwrite( &oc, format, 1, tga );
-#endif
-                state = NONE;
+    const ubyte * src;
+    
+    
+    tga_set_error( error, TGA_ERR_NONE );
+
+    switch( format ) {
+
+    case TGA_TRUECOLOR_24:
+    case TGA_TRUECOLOR_32:
+        break;
+
+    default:
+        tga_set_error( error, TGA_ERR_BAD_FORMAT );
+        return( 0 );
+
+    }
+
+    if( width <= 0 || height <= 0 || width > 0xFFFF || height > 0xFFFF || 
+        stride < row_bytes ) {
+        tga_set_error( error, TGA_ERR_BAD_DIMENSIONS );
+        return( 0 );
+    }
+
+    tga = fopen( file, "wb" );
+
+    if( tga == NULL ) {
+        tga_set_error( error, TGA_ERR_OPEN_FAILS );
+        return( 0 );
+    }
+
+    if( !tga_write_header( tga, width, height, format, (flags & TGA_RLE) ? 10 : 2 ) ) {
+        fclose( tga );
+        tga_set_error( error, TGA_ERR_WRITE_FAILS );
+        return( 0 );
+    }
+
+    tga_init_unpremultiply( recip );
+
+    if( flags & TGA_RLE ) {
+
+        // rows are encoded independently (packets never cross a row), so
+        // a chunk of rows goes to the runner at once, each row into its own
+        // slot.  the slots are then packed together and written in order.
+
+        job.recip     = recip;
+        job.dat       = dat;
+        job.stride    = stride;
+        job.width     = width;
+        job.height    = height;
+        job.format    = format;
+        job.flags     = flags;
+        job.slot_size = row_bytes + (width + 127) / 128;
+
+        rows_per_block = TGA_RLE_CHUNK_SIZE / job.slot_size;
+        if( rows_per_block == 0 ) {
+            rows_per_block = 1;
+        }
+        if( rows_per_block > (uint32)height ) {
+            rows_per_block = height;
+        }
+
+        job.slots   = (ubyte *)malloc( rows_per_block * job.slot_size );
+        job.lengths = (uint32 *)malloc( rows_per_block * sizeof( uint32 ) );
+
+        for( y = 0; y < height; y += block_rows ) {
+
+            block_rows = rows_per_block;
+            if( block_rows > (uint32)(height - y) ) {
+                block_rows = height - y;
+            }
+
+            job.first_row = y;
+            TargaRunner( tga_rle_rows, &job, block_rows );
+
+            out = job.slots + job.lengths[0];
+            for( i = 1; i < (int)block_rows; i++ ) {
+                memmove( out, job.slots + i * job.slot_size, job.lengths[i] );
+                out += job.lengths[i];
+            }
+
+            if( fwrite( job.slots, out - job.slots, 1, tga ) != 1 ) {
+                free( job.slots );
+                free( job.lengths );
+                fclose( tga );
+                tga_set_error( error, TGA_ERR_WRITE_FAILS );
+                return( 0 );
+            }
+
+        }
+
+        free( job.slots );
+        free( job.lengths );
+
+    } else {
+
+        rows_per_block = TGA_WRITE_BUFFER_SIZE / row_bytes;
+        if( rows_per_block == 0 ) {
+            rows_per_block = 1;
+        }
+        block = (ubyte *)malloc( rows_per_block * row_bytes );
+
+        // the file is written bottom row first, so top-down data is walked backwards.
+        for( y = 0; y < height; y++ ) {
+
+            row = (flags & TGA_TOP_DOWN) ? height - 1 - y : y;
+            src = dat + (size_t)row * stride;
+
+            tga_encode_row( recip, src, block + block_rows * row_bytes, width, format );
+
+            if( ++block_rows == rows_per_block || y == height - 1 ) {
+                if( fwrite( block, row_bytes, block_rows, tga ) != block_rows ) {
+                    free( block );
+                    fclose( tga );
+                    tga_set_error( error, TGA_ERR_WRITE_FAILS );
+                    return( 0 );
+                }
+                block_rows = 0;
+            }
+
+        }
+
+        free( block );
+
+    }
+
+    if( fclose( tga ) ) {
+        tga_set_error( error, TGA_ERR_WRITE_FAILS );
+        return( 0 );
+    }
+
+    return( 1 );
+
+}
+
+
+
+
+int tga_write_rle( const char * file, int width, int height, unsigned char * dat, unsigned int format ) {
+
+    return( tga_write( file, width, height, dat, format, TGA_RLE ) );
+
+}
+
+
+
+
+
+/*************************************************************************************************/
+
+
+
+
+
+static uint32 tga_stream_read( tga_stream * s, ubyte * dst, uint32 count ) {
+
+    // copy the next count bytes of the file to dst, refilling the
+    // buffer as needed.  returns the number of bytes actually read.
+
+    uint32 avail;
+    uint32 done = 0;
+
+    while( done < count ) {
+
+        avail = s->len - s->pos;
+
+        if( avail == 0 ) {
+
+            /* large requests skip the buffer and go straight to dst */
+            if( count - done >= TGA_READ_BUFFER_SIZE ) {
+                done += (uint32)fread( dst + done, 1, count - done, s->file );
                 break;
             }
 
-            if( nc == oc ) {
-                repcount = 0;
-                state = RLP;
-            } else {
-                repcount = 0;
-                state = RAWP;
-                for( j = 0; j < format; j++ ) {
-#ifdef WORDS_BIGENDIAN
-                    rawbuf[(repcount * format) + j] = (ubyte)(*((&oc)+format-j-1));
-#else
-                    rawbuf[(repcount * format) + j] = *(((ubyte *)(&oc)) + j);
-#endif
-                }
+            s->pos = 0;
+            s->len = (uint32)fread( s->buf, 1, TGA_READ_BUFFER_SIZE, s->file );
+            if( s->len == 0 ) {
+                break;
+            }
+            avail = s->len;
+
+        }
+
+        if( avail > count - done ) {
+            avail = count - done;
+        }
+
+        memcpy( dst + done, s->buf + s->pos, avail );
+        s->pos += avail;
+        done += avail;
+
+    }
+
+    /* past end-of-file we hand out null pixels. */
+    if( done < count ) {
+        memset( dst + done, 0, count - done );
+    }
+
+    return( done );
+
+}
+
+
+
+
+static ubyte * tga_stream_read_all( tga_stream * s, size_t * count ) {
+
+    // read everything left in the file into one malloc'd block.
+
+    size_t size = s->len - s->pos;
+    size_t capacity = size + TGA_READ_BUFFER_SIZE;
+    size_t got;
+    ubyte * all = (ubyte *)malloc( capacity );
+
+    memcpy( all, s->buf + s->pos, size );
+    s->pos = s->len;
+
+    for( ;; ) {
+
+        if( size == capacity ) {
+            capacity *= 2;
+            all = (ubyte *)realloc( all, capacity );
+        }
+
+        got = fread( all + size, 1, capacity - size, s->file );
+        if( got == 0 ) {
+            break;
+        }
+        size += got;
+
+    }
+
+    *count = size;
+    return( all );
+
+}
+
+
+
+
+static void tga_rle_scan( tga_read_job * job, uint32 w, uint32 h, ubyte bytes_per_pix ) {
+
+    // walk the packet headers once, recording for every row the packet it
+    // starts in and how far into that packet it starts.
+
+    size_t pos = 0;
+    size_t pixel = 0;           // first pixel of the current packet
+    uint32 n;
+    uint32 y = 0;
+    ubyte  header;
+
+    while( y < h ) {
+
+        if( pos >= job->data_len ) {
+            /* out of data -- the remaining rows decode to null pixels */
+            for( ; y < h; y++ ) {
+                job->row_offset[y] = job->data_len;
+                job->row_skip[y]   = 0;
+            }
+            break;
+        }
+
+        header = job->data[pos];
+        n = (header & 0x7F) + 1;
+
+        for( ; y < h && (size_t)y * w < pixel + n; y++ ) {
+            job->row_offset[y] = pos;
+            job->row_skip[y]   = (uint32)((size_t)y * w - pixel);
+        }
+
+        pos += 1 + ((header & 0x80) ? bytes_per_pix : n * bytes_per_pix);
+        pixel += n;
+
+    }
+
+}
+
+
+
+
+static void tga_copy_packed( ubyte * dst, const tga_read_job * job, size_t pos, uint32 count ) {
+
+    // copy count bytes of packed data, with null bytes past the end of it.
+
+    size_t avail = pos < job->data_len ? job->data_len - pos : 0;
+
+    if( avail > count ) {
+        avail = count;
+    }
+
+    memcpy( dst, job->data + pos, avail );
+    memset( dst + avail, 0, count - avail );
+
+}
+
+
+
+
+static void tga_rle_expand_rows( void * arg, int first, int last ) {
+
+    // expand and convert file rows [first, last).
+
+    const tga_read_job * job = (const tga_read_job *)arg;
+    const TGA_READER * tga = job->tga;
+
+    uint32 bpp = tga->bytes_per_pix;
+    ubyte * rowbuf = (ubyte *)malloc( tga->width * bpp );
+    ubyte * row;
+
+    size_t pos;
+    uint32 skip;
+    uint32 x;
+    uint32 n;
+    uint32 i;
+    ubyte  header;
+    int    y;
+
+    for( y = first; y < last; y++ ) {
+
+        pos  = job->row_offset[y];
+        skip = job->row_skip[y];
+
+        for( x = 0; x < tga->width; x += n ) {
+
+            // past the end every packet reads as a raw pair of null pixels.
+            header = pos < job->data_len ? job->data[pos] : 1;
+            pos++;
+
+            n = (header & 0x7F) + 1 - skip;
+            if( n > tga->width - x ) {
+                n = tga->width - x;
+            }
+
+            if( header & 0x80 ) {
+                /* run length packet */
+                tga_copy_packed( rowbuf + x * bpp, job, pos, bpp );
+                for( i = 1; i < n; i++ ) {
+                    memcpy( rowbuf + (x + i) * bpp, rowbuf + x * bpp, bpp );
+                }
+                pos += bpp;
+            } else {
+                /* raw packet */
+                tga_copy_packed( rowbuf + x * bpp, job, pos + skip * bpp, n * bpp );
+                pos += ((header & 0x7F) + 1) * bpp;
+            }
+
+            skip = 0;
+
+        }
+
+        row = tga_row_address( job->dat, job->img_desc, y, tga->height, job->stride );
+        tga_decode_row( job->decoder, rowbuf, row, tga->width );
+        tga_orient_row( row, job->img_desc, tga->width, job->format );
+
+    }
+
+    free( rowbuf );
+
+}
+
+
+
+
+static void tga_convert_rows( void * arg, int first, int last ) {
+
+    // convert uncompressed file rows [first, last) straight from memory.
+
+    const tga_read_job * job = (const tga_read_job *)arg;
+    const TGA_READER * tga = job->tga;
+
+    uint32 row_bytes = tga->width * tga->bytes_per_pix;
+    ubyte * row;
+    int y;
+
+    for( y = first; y < last; y++ ) {
+
+        row = tga_row_address( job->dat, job->img_desc, y, tga->height, job->stride );
+        tga_decode_row( job->decoder, job->data + (size_t)y * row_bytes, row, tga->width );
+        tga_orient_row( row, job->img_desc, tga->width, job->format );
+
+    }
+
+}
+
+
+
+
+static int tga_map_file( FILE * file, tga_mapping * map ) {
+
+    // map all of file read-only, hinting that it will be read front to
+    // back.  returns 0 if the platform won't map it.
+
+#ifdef _WIN32
+    HANDLE handle = (HANDLE)_get_osfhandle( _fileno( file ) );
+    LARGE_INTEGER size;
+
+    if( handle == INVALID_HANDLE_VALUE || !GetFileSizeEx( handle, &size ) || size.QuadPart == 0 ) {
+        return( 0 );
+    }
+
+    map->mapping = CreateFileMapping( handle, NULL, PAGE_READONLY, 0, 0, NULL );
+    if( map->mapping == NULL ) {
+        return( 0 );
+    }
+
+    map->base = (const ubyte *)MapViewOfFile( map->mapping, FILE_MAP_READ, 0, 0, 0 );
+    if( map->base == NULL ) {
+        CloseHandle( map->mapping );
+        return( 0 );
+    }
+
+    map->size = (size_t)size.QuadPart;
+    return( 1 );
+#else
+    struct stat info;
+    void * base;
+    int fd = fileno( file );
+
+    if( fstat( fd, &info ) != 0 || info.st_size <= 0 ) {
+        return( 0 );
+    }
+
+    base = mmap( NULL, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, fd, 0 );
+    if( base == MAP_FAILED ) {
+        return( 0 );
+    }
+
+    madvise( base, (size_t)info.st_size, MADV_SEQUENTIAL );
+
+    map->base = (const ubyte *)base;
+    map->size = (size_t)info.st_size;
+    return( 1 );
+#endif
+
+}
+
+
+
+
+static void tga_unmap_file( tga_mapping * map ) {
+
+#ifdef _WIN32
+    UnmapViewOfFile( map->base );
+    CloseHandle( map->mapping );
+#else
+    munmap( (void *)map->base, map->size );
+#endif
+
+}
+
+
+
+
+static int tga_check_header( const ubyte * hdr ) {
+
+    // the checks that need nothing past the 18 header bytes.
+
+    if( tga_get_uint16( &hdr[HDR_IMG_SPEC_WIDTH] ) == 0 || 
+        tga_get_uint16( &hdr[HDR_IMG_SPEC_HEIGHT] ) == 0 ) {
+        return( TGA_ERR_BAD_DIMENSIONS );
+    }
+
+    /* if this is a 'nodata' image, just jump out. */
+    switch( hdr[HDR_IMAGE_TYPE] ) {
+
+    case TGA_IMG_UNC_TRUECOLOR:
+    case TGA_IMG_UNC_GRAYSCALE:
+    case TGA_IMG_UNC_PALETTED:
+    case TGA_IMG_RLE_TRUECOLOR:
+    case TGA_IMG_RLE_GRAYSCALE:
+    case TGA_IMG_RLE_PALETTED:
+        return( TGA_ERR_NONE );
+
+    case TGA_IMG_NODATA:
+        return( TGA_ERR_NODATA_IMAGE );
+
+    default:
+        return( TGA_ERR_BAD_IMAGE_TYPE );
+
+    }
+
+}
+
+
+
+
+static void tga_fill_info( TGA_INFO * info, ubyte image_type, ubyte pix_depth, ubyte true_bits, 
+                          ubyte img_desc, uint32 width, uint32 height ) {
+
+    info->width         = width;
+    info->height        = height;
+    info->depth         = pix_depth;
+    info->color_bits    = true_bits;
+    info->alpha_bits    = img_desc & 0x0F;
+    info->top_down      = (img_desc & 0x20) != 0;
+    info->right_to_left = (img_desc & 0x10) != 0;
+    info->rle           = image_type == TGA_IMG_RLE_TRUECOLOR || 
+                          image_type == TGA_IMG_RLE_GRAYSCALE ||
+                          image_type == TGA_IMG_RLE_PALETTED;
+    info->paletted      = image_type == TGA_IMG_UNC_PALETTED || 
+                          image_type == TGA_IMG_RLE_PALETTED;
+
+}
+
+
+
+
+static void tga_init_decoder( tga_decoder * dec, ubyte bytes_per_pix, uint32 bits, 
+                             ubyte alphabits, uint32 format ) {
+
+    dec->bytes_per_pix    = bytes_per_pix;
+    dec->bits             = bits;
+    dec->alphabits        = alphabits;
+    dec->format           = format;
+    dec->colormap         = NULL;
+    dec->cmap_bytes_entry = 0;
+    dec->cmap_first       = 0;
+    dec->cmap_length      = 0;
+    dec->lut              = NULL;
+    dec->lut_mask         = 0;
+
+}
+
+
+
+
+static void tga_build_lut( tga_decoder * dec ) {
+
+    // 15 and 16-bit pixels and palette indices have few enough values
+    // that every one can be converted up front, leaving one table lookup
+    // per pixel.  palettes are expanded to premultiplied RGBA, with
+    // indices outside the colormap decoding as a null entry would.
+    // each entry is 4 bytes in output order, whatever the format.
+
+    uint32 entries;
+    uint32 i, j;
+    uint32 pixel;
+    ubyte  scale5[32];          // 5-bit channel to 8-bit
+    ubyte  scale6[64];          // 6-bit channel to 8-bit
+    ubyte * entry;
+
+    if( dec->colormap != NULL ) {
+        if( dec->bytes_per_pix > 2 ) {
+            return;
+        }
+        entries = 1 << (8 * dec->bytes_per_pix);
+    } else if( dec->bits == 15 || (dec->bits == 16 && dec->alphabits == 1) ) {
+        // 5-5-5, the extra bit never reaches the table
+        entries = 1 << 15;
+    } else if( dec->bits == 16 ) {
+        entries = 1 << 16;
+    } else {
+        return;
+    }
+
+    dec->lut      = (ubyte *)malloc( entries * 4 );
+    dec->lut_mask = entries - 1;
+
+    if( dec->colormap != NULL ) {
+
+        for( i = 0, entry = dec->lut; i < entries; i++, entry += 4 ) {
+
+            pixel = 0;
+            if( i >= dec->cmap_first && i - dec->cmap_first < dec->cmap_length ) {
+                for( j = 0; j < dec->cmap_bytes_entry; j++ ) {
+                    pixel += dec->colormap[dec->cmap_bytes_entry * (i - dec->cmap_first) + j] << (8 * j);
+                }
+            }
+
+            pixel = tga_convert_color( pixel, dec->bits, dec->alphabits, TGA_TRUECOLOR_32 );
+            for( j = 0; j < 4; j++ ) {
+                entry[j] = (ubyte)((pixel >> (j * 8)) & 0xFF);
+            }
+
+        }
+
+        return;
+
+    }
+
+    // same scale factors tga_convert_color uses, so both paths agree.
+    for( i = 0; i < 32; i++ ) {
+        scale5[i] = (ubyte)(((float)i) * 8.2258f);
+    }
+    for( i = 0; i < 64; i++ ) {
+        scale6[i] = (ubyte)(((float)i) * 4.0476f);
+    }
+
+    for( i = 0, entry = dec->lut; i < entries; i++, entry += 4 ) {
+        if( entries == (1 << 16) ) {
+            entry[0] = scale5[(i & 0xF800) >> 11];
+            entry[1] = scale6[(i & 0x07E0) >> 5];
+        } else {
+            entry[0] = scale5[(i & 0x7C00) >> 10];
+            entry[1] = scale5[(i & 0x03E0) >> 5];
+        }
+        entry[2] = scale5[i & 0x001F];
+        entry[3] = 0xFF;
+    }
+
+}
+
+
+
+
+static void tga_free_decoder( tga_decoder * dec ) {
+
+    if( dec->lut != NULL ) {
+        free( dec->lut );
+        dec->lut = NULL;
+    }
+
+}
+
+
+
+
+static ubyte tga_premultiply( ubyte c, ubyte a ) {
+
+    return( (ubyte)(((float)c / 255.0f) * ((float)a / 255.0f) * 255.0f) );
+
+}
+
+
+
+
+static void tga_decode_row( const tga_decoder * dec, const ubyte * src, ubyte * dst, uint32 count ) {
+
+    // convert count pixels of file data to the output format.  the common
+    // truecolor depths get their own loops, 15/16-bit and paletted pixels
+    // are looked up in the decoder's table, and anything else goes
+    // through tga_convert_color one pixel at a time.
+
+    uint32 i, j;
+    uint32 pixel;
+    uint32 index;
+    uint32 step = dec->format;
+    uint32 in_step = dec->bytes_per_pix;
+    ubyte  a;
+
+    if( dec->lut != NULL ) {
+
+        if( in_step == 1 ) {
+            for( i = 0; i < count; i++, src++, dst += step ) {
+                memcpy( dst, dec->lut + 4 * src[0], step );
             }
-            break;
+        } else if( step == TGA_TRUECOLOR_32 ) {
+            for( i = 0; i < count; i++, src += 2, dst += 4 ) {
+                pixel = (src[0] + (src[1] << 8)) & dec->lut_mask;
+                memcpy( dst, dec->lut + 4 * pixel, 4 );
+            }
+        } else {
+            for( i = 0; i < count; i++, src += 2, dst += 3 ) {
+                pixel = (src[0] + (src[1] << 8)) & dec->lut_mask;
+                memcpy( dst, dec->lut + 4 * pixel, 3 );
+            }
+        }
+
+        return;
 
+    }
 
-        case RLP:
-            repcount++;
+    if( dec->colormap != NULL ) {
 
-            if( column == 0 ) {
-                // finish off rlp.
-                repcount |= 0x80;
-                fwrite( &repcount, 1, 1, tga );
-#ifdef WORDS_BIGENDIAN
-                fwrite( (&oc)+4, format, 1, tga );  // byte order..
-#else
-                fwrite( &oc, format, 1, tga );
-#endif
-                state = NONE;
-                break;
+        // indices too wide to tabulate, look each one up as it comes.
+        for( i = 0; i < count; i++, src += in_step, dst += step ) {
+
+            index = 0;
+            for( j = 0; j < in_step; j++ ) {
+                index += src[j] << (8 * j);
             }
 
-            if( repcount == 127 ) {
-                // finish off rlp.
-                repcount |= 0x80;
-                fwrite( &repcount, 1, 1, tga );
-#ifdef WORDS_BIGENDIAN
-                fwrite( (&oc)+4, format, 1, tga );  // byte order..
-#else
-                fwrite( &oc, format, 1, tga );
-#endif
-                state = NONE;
-                break;
+            /* entries outside the colormap come out as null pixels */
+            pixel = 0;
+            if( index >= dec->cmap_first && index - dec->cmap_first < dec->cmap_length ) {
+                index -= dec->cmap_first;
+                for( j = 0; j < dec->cmap_bytes_entry; j++ ) {
+                    pixel += dec->colormap[dec->cmap_bytes_entry * index + j] << (8 * j);
+                }
             }
 
-            if( nc != oc ) {
-                // finish off rlp
-                repcount |= 0x80;
-                fwrite( &repcount, 1, 1, tga );
-#ifdef WORDS_BIGENDIAN
-                fwrite( (&oc)+4, format, 1, tga );  // byte order..
-#else
-                fwrite( &oc, format, 1, tga );
-#endif
-                state = NONE;
+            pixel = tga_convert_color( pixel, dec->bits, dec->alphabits, dec->format );
+            for( j = 0; j < step; j++ ) {
+                dst[j] = (ubyte)((pixel >> (j * 8)) & 0xFF);
             }
-            break;
 
+        }
 
-        case RAWP:
-            repcount++;
+        return;
 
-            if( column == 0 ) {
-                // finish off rawp.
-                for( j = 0; j < format; j++ ) {
-#ifdef WORDS_BIGENDIAN
-                    rawbuf[(repcount * format) + j] = (ubyte)(*((&oc)+format-j-1));
-#else
-                    rawbuf[(repcount * format) + j] = *(((ubyte *)(&oc)) + j);
-#endif
+    }
+
+    switch( dec->bits ) {
+
+    case 32:
+#ifdef TGA_USE_SSE2
+        // swap blue and red four pixels at a time, as long as all four are
+        // opaque (or have no alpha to speak of) and need no premultiplying.
+        if( step == TGA_TRUECOLOR_32 ) {
+            const __m128i alpha = _mm_set1_epi32( (int)0xFF000000 );
+            const __m128i green = _mm_set1_epi32( 0x0000FF00 );
+            const __m128i low   = _mm_set1_epi32( 0x000000FF );
+            __m128i v;
+
+            for( i = 0; i + 4 <= count; i += 4, src += 16, dst += 16 ) {
+                v = _mm_loadu_si128( (const __m128i *)src );
+                if( dec->alphabits == 0 ) {
+                    v = _mm_or_si128( v, alpha );
+                } else if( _mm_movemask_epi8( _mm_cmpeq_epi32( 
+                               _mm_and_si128( v, alpha ), alpha ) ) != 0xFFFF ) {
+                    break;
                 }
-                fwrite( &repcount, 1, 1, tga );
-                fwrite( rawbuf, (repcount + 1) * format, 1, tga );
-                state = NONE;
-                break;
+                v = _mm_or_si128( _mm_and_si128( v, _mm_or_si128( alpha, green ) ),
+                    _mm_or_si128( _mm_and_si128( _mm_srli_epi32( v, 16 ), low ),
+                                  _mm_slli_epi32( _mm_and_si128( v, low ), 16 ) ) );
+                _mm_storeu_si128( (__m128i *)dst, v );
             }
-
-            if( repcount == 127 ) {
-                // finish off rawp.
-                for( j = 0; j < format; j++ ) {
-#ifdef WORDS_BIGENDIAN
-                    rawbuf[(repcount * format) + j] = (ubyte)(*((&oc)+format-j-1));
-#else
-                    rawbuf[(repcount * format) + j] = *(((ubyte *)(&oc)) + j);
+            count -= i;
+        }
 #endif
+        if( dec->alphabits != 0 ) {
+            // BGRA, premultiply unless the pixel is fully opaque or clear.
+            for( i = 0; i < count; i++, src += 4, dst += step ) {
+                a = src[3];
+                if( a == 0xFF ) {
+                    dst[0] = src[2];
+                    dst[1] = src[1];
+                    dst[2] = src[0];
+                } else if( a == 0 ) {
+                    dst[0] = dst[1] = dst[2] = 0;
+                } else {
+                    dst[0] = tga_premultiply( src[2], a );
+                    dst[1] = tga_premultiply( src[1], a );
+                    dst[2] = tga_premultiply( src[0], a );
+                }
+                if( step == TGA_TRUECOLOR_32 ) {
+                    dst[3] = a;
                 }
-                fwrite( &repcount, 1, 1, tga );
-                fwrite( rawbuf, (repcount + 1) * format, 1, tga );
-                state = NONE;
-                break;
             }
+            return;
+        }
+        /* intentional fall-thru -- 24-bit in disguise */
 
-            if( nc == oc ) {
-                // finish off rawp
-                repcount--;
-                fwrite( &repcount, 1, 1, tga );
-                fwrite( rawbuf, (repcount + 1) * format, 1, tga );
-                
-                // start new rlp
-                repcount = 0;
-                state = RLP;
-                break;
+    case 24:
+        for( i = 0; i < count; i++, src += in_step, dst += step ) {
+            dst[0] = src[2];
+            dst[1] = src[1];
+            dst[2] = src[0];
+            if( step == TGA_TRUECOLOR_32 ) {
+                dst[3] = 0xFF;
             }
+        }
+        return;
 
-            // continue making rawp
-            for( j = 0; j < format; j++ ) {
-#ifdef WORDS_BIGENDIAN
-                rawbuf[(repcount * format) + j] = (ubyte)(*((&oc)+format-j-1));
-#else
-                rawbuf[(repcount * format) + j] = *(((ubyte *)(&oc)) + j);
-#endif
+    default:
+        for( i = 0; i < count; i++, src += in_step, dst += step ) {
+            pixel = 0;
+            for( j = 0; j < in_step; j++ ) {
+                pixel += src[j] << (8 * j);
+            }
+            pixel = tga_convert_color( pixel, dec->bits, dec->alphabits, dec->format );
+            for( j = 0; j < step; j++ ) {
+                dst[j] = (ubyte)((pixel >> (j * 8)) & 0xFF);
             }
-
-            break;
-
         }
-       
+        return;
 
     }
 
+}
 
-    // clean up state.
 
-    switch( state ) {
 
-    case INIT:
-        break;
 
-    case NONE:
-        // write the last 2 pixels in a raw packet.
-        fwrite( &one, 1, 1, tga );
-#ifdef WORDS_BIGENDIAN
-                fwrite( (&oc)+4, format, 1, tga );  // byte order..
-#else
-                fwrite( &oc, format, 1, tga );
-#endif
-#ifdef WORDS_BIGENDIAN
-                fwrite( (&nc)+4, format, 1, tga );  // byte order..
-#else
-                fwrite( &nc, format, 1, tga );
-#endif
+static ubyte * tga_row_address( ubyte * dat, ubyte img_spec, uint32 row, uint32 h, size_t stride ) {
+
+    // find where the row'th row of the file goes in memory, regarding how
+    // the header says the data is ordered.  memory is always bottom-up.
+
+    uint32 y;
+
+    switch( (img_spec & 0x30) >> 4 ) {
+
+    case TGA_UPPER_LEFT:
+    case TGA_UPPER_RIGHT:
+        y = h - 1 - row;
         break;
 
-    case RLP:
-        repcount++;
-        repcount |= 0x80;
-        fwrite( &repcount, 1, 1, tga );
-#ifdef WORDS_BIGENDIAN
-                fwrite( (&oc)+4, format, 1, tga );  // byte order..
-#else
-                fwrite( &oc, format, 1, tga );
-#endif
+    case TGA_LOWER_LEFT:
+    case TGA_LOWER_RIGHT:
+    default:
+        y = row;
         break;
 
-    case RAWP:
-        repcount++;
-        for( j = 0; j < format; j++ ) {
-#ifdef WORDS_BIGENDIAN
-            rawbuf[(repcount * format) + j] = (ubyte)(*((&oc)+format-j-1));
-#else
-            rawbuf[(repcount * format) + j] = *(((ubyte *)(&oc)) + j);
-#endif
+    }
+
+    return( dat + y * stride );
+
+}
+
+
+
+
+static void tga_orient_row( ubyte * row, ubyte img_spec, uint32 w, uint32 format ) {
+
+    // right-to-left files get their rows mirrored after decoding.
+
+    ubyte * left;
+    ubyte * right;
+    ubyte   tmp;
+    uint32  j;
+
+    switch( (img_spec & 0x30) >> 4 ) {
+
+    case TGA_LOWER_RIGHT:
+    case TGA_UPPER_RIGHT:
+        left  = row;
+        right = row + (w - 1) * format;
+        for( ; left < right; left += format, right -= format ) {
+            for( j = 0; j < format; j++ ) {
+                tmp      = left[j];
+                left[j]  = right[j];
+                right[j] = tmp;
+            }
         }
-        fwrite( &repcount, 1, 1, tga );
-        fwrite( rawbuf, (repcount + 1) * 3, 1, tga );
         break;
 
     }
 
+}
+
 
-    // close the file.
-    fclose( tga );
 
-    free( rawbuf );
 
-    return( 1 );
+static uint16 tga_get_uint16( const ubyte * p ) {
+
+    // a little endian 16-bit header field, built from its bytes since
+    // fields needn't be aligned.
+
+    return( (uint16)(p[0] | (p[1] << 8)) );
 
 }
 
 
 
 
+static int tga_write_header( FILE * tga, int width, int height, unsigned int format, ubyte img_type ) {
 
-/*************************************************************************************************/
+    // write the 18 byte header and the image id in one go.  every
+    // field is stored little-endian regardless of the host.
 
+    static const char id[] = "written with libtarga";
 
+    ubyte hdr[HDR_LENGTH + sizeof( id ) - 1];
 
+    memset( hdr, 0, HDR_LENGTH );
 
+    hdr[HDR_IDLEN]                  = (ubyte)(sizeof( id ) - 1);
+    hdr[HDR_CMAP_TYPE]              = 0;
+    hdr[HDR_IMAGE_TYPE]             = img_type;    // 2 - uncompressed truecolor  10 - RLE truecolor
+    hdr[HDR_IMG_SPEC_WIDTH]         = (ubyte)(width & 0xFF);
+    hdr[HDR_IMG_SPEC_WIDTH + 1]     = (ubyte)((width >> 8) & 0xFF);
+    hdr[HDR_IMG_SPEC_HEIGHT]        = (ubyte)(height & 0xFF);
+    hdr[HDR_IMG_SPEC_HEIGHT + 1]    = (ubyte)((height >> 8) & 0xFF);
+    hdr[HDR_IMG_SPEC_PIX_DEPTH]     = (ubyte)(format * 8);
+    hdr[HDR_IMG_SPEC_IMG_DESC]      = format == TGA_TRUECOLOR_32 ? 8 : 0;
 
-static void tga_write_pixel_to_mem( ubyte * dat, ubyte img_spec, uint32 number, 
-                                   uint32 w, uint32 h, uint32 pixel, uint32 format ) {
+    memcpy( hdr + HDR_LENGTH, id, sizeof( id ) - 1 );
 
-    // write the pixel to the data regarding how the
-    // header says the data is ordered.
+    return( fwrite( hdr, sizeof( hdr ), 1, tga ) == 1 );
 
-    uint32 j;
-    uint32 x, y;
-    uint32 addy;
+}
 
-    switch( (img_spec & 0x30) >> 4 ) {
 
-    case TGA_LOWER_RIGHT:
-        x = w - 1 - (number % w);
-        y = number / h;
-        break;
 
-    case TGA_UPPER_LEFT:
-        x = number % w;
-        y = h - 1 - (number / w);
-        break;
 
-    case TGA_UPPER_RIGHT:
-        x = w - 1 - (number % w);
-        y = h - 1 - (number / w);
+static void tga_init_unpremultiply( uint32 * recip ) {
+
+    // recip[a] is 255 / a in 16.16 fixed point, rounded up.  for every
+    // 8-bit c and a, (c * recip[a]) >> 16 is exactly c * 255 / a rounded
+    // down, and the product fits in 32 bits.
+
+    uint32 a;
+
+    recip[0] = 0;
+    for( a = 1; a < 256; a++ ) {
+        recip[a] = (255 * 65536 + a - 1) / a;
+    }
+
+}
+
+
+
+
+static void tga_encode_row( const uint32 * recip, const ubyte * src, ubyte * dst, 
+                           uint32 count, uint32 format ) {
+
+    // convert count pixels of premultiplied RGB(A) to the straight BGR(A)
+    // the file wants.
+
+    uint32 i;
+    uint32 r, g, b, a;
+
+    switch( format ) {
+
+    case TGA_TRUECOLOR_24:
+        for( i = 0; i < count; i++, src += 3, dst += 3 ) {
+            dst[0] = src[2];
+            dst[1] = src[1];
+            dst[2] = src[0];
+        }
         break;
 
-    case TGA_LOWER_LEFT:
-    default:
-        x = number % w;
-        y = number / w;
+    case TGA_TRUECOLOR_32:
+        for( i = 0; i < count; i++, src += 4, dst += 4 ) {
+
+            a = src[3];
+
+            /* fully opaque and fully clear pixels pass through as is */
+            if( a == 0xFF || a == 0 ) {
+                dst[0] = src[2];
+                dst[1] = src[1];
+                dst[2] = src[0];
+                dst[3] = (ubyte)a;
+                continue;
+            }
+
+            /* need to un-premultiply alpha, clamping to 255 */
+            r = (src[0] * recip[a]) >> 16;
+            g = (src[1] * recip[a]) >> 16;
+            b = (src[2] * recip[a]) >> 16;
+
+            dst[0] = (ubyte)(b > 255 ? 255 : b);
+            dst[1] = (ubyte)(g > 255 ? 255 : g);
+            dst[2] = (ubyte)(r > 255 ? 255 : r);
+            dst[3] = (ubyte)a;
+
+        }
         break;
 
     }
 
-    addy = (y * w + x) * format;
-    for( j = 0; j < format; j++ ) {
-        dat[addy + j] = (ubyte)((pixel >> (j * 8)) & 0xFF);
+}
+
+
+
+
+static void tga_run_serial( tga_job_fn job, void * arg, int count ) {
+
+    job( arg, 0, count );
+
+}
+
+
+
+
+static void tga_rle_rows( void * arg, int first, int last ) {
+
+    // encode slots [first, last) of the current chunk.
+
+    tga_rle_job * job = (tga_rle_job *)arg;
+
+    uint32 row_bytes = job->width * job->format;
+    ubyte * pixels = (ubyte *)malloc( row_bytes );
+
+    int i;
+    int row;
+
+    for( i = first; i < last; i++ ) {
+
+        // file rows go bottom to top.
+        row = job->first_row + i;
+        if( job->flags & TGA_TOP_DOWN ) {
+            row = job->height - 1 - row;
+        }
+
+        tga_encode_row( job->recip, job->dat + (size_t)row * job->stride, pixels, job->width, job->format );
+        job->lengths[i] = tga_rle_row( pixels, job->slots + i * job->slot_size, 
+            job->width, job->format );
+
     }
-    
+
+    free( pixels );
+
 }
 
 
 
 
-static uint32 tga_get_pixel( FILE * tga, ubyte bytes_per_pix, 
-                            ubyte * colormap, ubyte cmap_bytes_entry ) {
-    
-    /* get the image data value out */
+static uint32 tga_run_length( const ubyte * p, uint32 count, uint32 format ) {
 
-    uint32 tmp_col;
-    uint32 tmp_int32;
-    ubyte tmp_byte;
+    // number of pixels, at most count, equal to the first one.
 
-    uint32 j;
+    uint32 n = 1;
 
-    tmp_int32 = 0;
-    for( j = 0; j < bytes_per_pix; j++ ) {
-        if( fread( &tmp_byte, 1, 1, tga ) < 1 ) {
-            tmp_int32 = 0;
-        } else {
-            tmp_int32 += tmp_byte << (j * 8);
+#ifdef TGA_USE_SSE2
+    __m128i first;
+    int mask;
+
+    if( format == TGA_TRUECOLOR_32 ) {
+        first = _mm_set1_epi32( p[0] | (p[1] << 8) | (p[2] << 16) | (p[3] << 24) );
+        for( ; n + 4 <= count; n += 4 ) {
+            mask = _mm_movemask_epi8( _mm_cmpeq_epi32( first, 
+                _mm_loadu_si128( (const __m128i *)(p + n * 4) ) ) );
+            if( mask != 0xFFFF ) {
+                break;
+            }
         }
     }
-    
-    /* byte-order correct the thing */
-    switch( bytes_per_pix ) {
-        
-    case 2:
-        tmp_int32 = ttohs( (uint16)tmp_int32 );
-        break;
-        
-    case 3: /* intentional fall-thru */
-    case 4:
-        tmp_int32 = ttohl( tmp_int32 );
-        break;
-        
+#endif
+
+    for( ; n < count; n++ ) {
+        if( memcmp( p, p + n * format, format ) ) {
+            break;
+        }
     }
-    
-    if( colormap != NULL ) {
-        /* need to look up value to get real color */
-        tmp_col = 0;
-        for( j = 0; j < cmap_bytes_entry; j++ ) {
-            tmp_col += colormap[cmap_bytes_entry * tmp_int32 + j] << (8 * j);
+
+    return( n );
+
+}
+
+
+
+
+static uint32 tga_raw_length( const ubyte * p, uint32 count, uint32 format ) {
+
+    // number of pixels, at most count, before two neighbours are equal.
+
+    uint32 n = 0;
+
+#ifdef TGA_USE_SSE2
+    int mask;
+
+    if( format == TGA_TRUECOLOR_32 ) {
+        for( ; n + 5 <= count; n += 4 ) {
+            mask = _mm_movemask_epi8( _mm_cmpeq_epi32( 
+                _mm_loadu_si128( (const __m128i *)(p + n * 4) ), 
+                _mm_loadu_si128( (const __m128i *)(p + n * 4 + 4) ) ) );
+            if( mask & 0x1111 ) {
+                break;
+            }
         }
-    } else {
-        tmp_col = tmp_int32;
     }
-    
-    return( tmp_col );
-    
+#endif
+
+    for( ; n < count; n++ ) {
+        if( n + 1 < count && !memcmp( p + n * format, p + (n + 1) * format, format ) ) {
+            break;
+        }
+    }
+
+    return( n );
+
+}
+
+
+
+
+static uint32 tga_rle_row( const ubyte * src, ubyte * dst, uint32 count, uint32 format ) {
+
+    // rle encode one row of file-order pixels into dst, returning the
+    // number of bytes written.  runs of two or more become run packets,
+    // everything else goes into raw packets of up to 128 pixels.
+
+    ubyte * out = dst;
+    uint32  i = 0;
+    uint32  n;
+    uint32  max;
+
+    while( i < count ) {
+
+        max = count - i;
+        if( max > 128 ) {
+            max = 128;
+        }
+
+        n = tga_run_length( src + i * format, max, format );
+
+        if( n >= 2 ) {
+            /* run length packet */
+            *out++ = (ubyte)(0x80 | (n - 1));
+            memcpy( out, src + i * format, format );
+            out += format;
+        } else {
+            /* raw packet */
+            n = tga_raw_length( src + i * format, max, format );
+            if( n == 0 ) {
+                n = 1;
+            }
+            *out++ = (ubyte)(n - 1);
+            memcpy( out, src + i * format, n * format );
+            out += n * format;
+        }
+
+        i += n;
+
+    }
+
+    return( (uint32)(out - dst) );
+
 }
 
 
@@ -1146,53 +2096,3 @@ is_15_bit_in_disguise:
 }
 
 
-
-static int16 ttohs( int16 val ) {
-
-#ifdef WORDS_BIGENDIAN
-    return( ((val & 0xFF) << 8) + (val >> 8) );
-#else
-    return( val );
-#endif 
-
-}
-
-
-static int16 htots( int16 val ) {
-
-#ifdef WORDS_BIGENDIAN
-    return( ((val & 0xFF) << 8) + (val >> 8) );
-#else
-    return( val );
-#endif
-
-}
-
-
-static int32 ttohl( int32 val ) {
-
-#ifdef WORDS_BIGENDIAN
-    return( ((val & 0x000000FF) << 24) +
-            ((val & 0x0000FF00) << 8)  +
-            ((val & 0x00FF0000) >> 8)  +
-            ((val & 0xFF000000) >> 24) );
-#else
-    return( val );
-#endif 
-
-}
-
-
-static int32 htotl( int32 val ) {
-
-#ifdef WORDS_BIGENDIAN
-    return( ((val & 0x000000FF) << 24) +
-            ((val & 0x0000FF00) << 8)  +
-            ((val & 0x00FF0000) >> 8)  +
-            ((val & 0xFF000000) >> 24) );
-#else
-    return( val );
-#endif 
-
-}
-
@@ -1,6 +1,8 @@
 #ifndef _libtarga_h_
 #define _libtarga_h_
 
+#include <stddef.h>
+
 
 /* uncomment this line if you're compiling on a big-endian machine */
 /* #define WORDS_BIGENDIAN */
@@ -76,15 +78,109 @@ int             tga_get_last_error();
 const char *    tga_error_string( int error_code );
 
 
+/*
+   Reentrant variants  --  every function that can fail has an _r form
+   taking an extra 'int * error', which receives 0 on success or the
+   error code on failure (NULL is allowed).  The _r forms touch no
+   shared state, so threads may load and save different images at the
+   same time.  The plain forms report through tga_get_last_error, which
+   is shared by all threads.
+*/
+
+
 /* Creating/Loading images  --  a return of NULL indicates a fatal error */
 void * tga_create( int width, int height, unsigned int format );
 void * tga_load( const char * file, int * width, int * height, unsigned int format );
+void * tga_load_r( const char * file, int * width, int * height, unsigned int format, int * error );
+
+
+/*
+   Loading into storage you own  --  tga_open reads the header and
+   reports the size, tga_read decodes the pixels into dat (which must
+   hold width * height * format bytes) and tga_close releases the file.
+   tga_read may only be called once per tga_open.  Pass TGA_TOP_DOWN in
+   flags to get the top row first instead of the bottom row.
+*/
+
+#define TGA_TOP_DOWN          (1)
+
+typedef struct tga_reader TGA_READER;
+
+TGA_READER * tga_open( const char * file, int * width, int * height );
+int          tga_read( TGA_READER * tga, void * dat, unsigned int format, unsigned int flags );
+void         tga_close( TGA_READER * tga );
+
+TGA_READER * tga_open_r( const char * file, int * width, int * height, int * error );
+int          tga_read_r( TGA_READER * tga, void * dat, unsigned int format, unsigned int flags, int * error );
+
+/*
+   Padded rows  --  the _rows forms of tga_read_r and tga_write_r take
+   rows that start stride bytes apart instead of packed together, so
+   the caller may pad or align them.  stride must be at least
+   width * format, and may be beyond 2^31 for images over 4 GB.
+*/
+int tga_read_rows_r( TGA_READER * tga, void * dat, size_t stride, unsigned int format, 
+                    unsigned int flags, int * error );
+
+
+/*
+   Probing  --  tga_probe reads only the 18 byte header, so it is cheap
+   enough to check a file before committing to decode it.  tga_info
+   describes a targa that is already open.  A return of 1 indicates
+   success, 0 indicates error.
+*/
+
+typedef struct {
+    int width;
+    int height;
+    int depth;              /* bits per pixel, or per palette index, in the file */
+    int color_bits;         /* bits per color, the palette entry size if paletted */
+    int alpha_bits;
+    int top_down;           /* nonzero if the first row stored is the top row */
+    int right_to_left;      /* nonzero if rows are stored right to left */
+    int rle;                /* nonzero if the pixels are run-length encoded */
+    int paletted;
+} TGA_INFO;
+
+int  tga_probe( const char * file, TGA_INFO * info );
+int  tga_probe_r( const char * file, TGA_INFO * info, int * error );
+void tga_info( TGA_READER * tga, TGA_INFO * info );
 
 
 /* Writing images to file  --  a return of 1 indicates success, 0 indicates error*/
 int tga_write_raw( const char * file, int width, int height, unsigned char * dat, unsigned int format );
 int tga_write_rle( const char * file, int width, int height, unsigned char * dat, unsigned int format );
 
+/*
+   General writer  --  flags may combine TGA_TOP_DOWN, for data stored
+   top row first, and TGA_RLE, for a run-length encoded file.  RLE rows
+   are encoded independently through the runner below.
+*/
+
+#define TGA_RLE               (2)
+
+int tga_write( const char * file, int width, int height, unsigned char * dat, 
+              unsigned int format, unsigned int flags );
+int tga_write_r( const char * file, int width, int height, unsigned char * dat, 
+                unsigned int format, unsigned int flags, int * error );
+int tga_write_rows_r( const char * file, int width, int height, unsigned char * dat, size_t stride, 
+                     unsigned int format, unsigned int flags, int * error );
+
+
+/*
+   Row jobs  --  where libtarga has independent rows to process it calls
+   the runner with a job and a row count.  The runner must call
+   job( arg, first, last ) over ranges covering [0, count) exactly once,
+   from any threads it likes, and return when all of them are done.
+   The default runner calls job( arg, 0, count ) directly.  Set the
+   runner once, before any images are loaded or saved.
+*/
+
+typedef void (*tga_job_fn)( void * arg, int first, int last );
+typedef void (*tga_runner_fn)( tga_job_fn job, void * arg, int count );
+
+void tga_set_runner( tga_runner_fn runner );
+
 
 #ifdef __cplusplus
 }